@@ -76,6 +76,20 @@ static WARN_RESULT ALWAYS_INLINE u64 get_timestamp()
     return result;
 }
 
+/* Read Data Cache Zero ID register: block size of DC ZVA and whether it is prohibited. */
+static WARN_RESULT ALWAYS_INLINE u64 arch_get_dczid()
+{
+    u64 result;
+    asm volatile("mrs %[x], dczid_el0" : [x] "=r"(result));
+    return result;
+}
+
+/* Zero one DC ZVA block at virtual address `addr` (must be block-aligned). */
+static ALWAYS_INLINE void arch_dc_zva(void *addr)
+{
+    asm volatile("dc zva, %[x]" : : [x] "r"(addr) : "memory");
+}
+
 /* Instruction synchronization barrier. */
 static ALWAYS_INLINE void arch_isb()
 {
@@ -160,6 +174,59 @@ static ALWAYS_INLINE void arch_tlbi_vmalle1is()
     arch_fence();
 }
 
+/* Flush TLB entries of this core only. */
+static ALWAYS_INLINE void arch_tlbi_vmalle1()
+{
+    arch_fence();
+    asm volatile("tlbi vmalle1");
+    arch_fence();
+}
+
+/* Flush TLB entries of `asid` on all cores. */
+static ALWAYS_INLINE void arch_tlbi_aside1is(u64 asid)
+{
+    arch_fence();
+    asm volatile("tlbi aside1is, %[x]" : : [x] "r"(asid << 48));
+    arch_fence();
+}
+
+/* Flush TLB entries of `asid` on this core only. */
+static ALWAYS_INLINE void arch_tlbi_aside1(u64 asid)
+{
+    arch_fence();
+    asm volatile("tlbi aside1, %[x]" : : [x] "r"(asid << 48));
+    arch_fence();
+}
+
+/* Flush TLB entries of page `va` tagged with `asid` on this core only.
+   No barriers: callers bracket a batch of these with `arch_fence()`. */
+static ALWAYS_INLINE void __arch_tlbi_vae1(u64 asid, u64 va)
+{
+    asm volatile("tlbi vae1, %[x]"
+                 :
+                 : [x] "r"(asid << 48 | ((va >> 12) & ((1ull << 44) - 1))));
+}
+
+/* Flush TLB entries of page `va` tagged with `asid` on all cores.
+   No barriers: callers bracket a batch of these with `arch_fence()`. */
+static ALWAYS_INLINE void __arch_tlbi_vae1is(u64 asid, u64 va)
+{
+    asm volatile("tlbi vae1is, %[x]"
+                 :
+                 : [x] "r"(asid << 48 | ((va >> 12) & ((1ull << 44) - 1))));
+}
+
+/* CPACR_EL1.FPEN: trap FP/SIMD at EL0 only, or trap nothing. */
+#define CPACR_FPEN_TRAP_EL0 (1 << 20)
+#define CPACR_FPEN_NO_TRAP (3 << 20)
+
+/* Set Architectural Feature Access Control Register (EL1). */
+static ALWAYS_INLINE void arch_set_cpacr(u64 value)
+{
+    asm volatile("msr cpacr_el1, %[x]" : : [x] "r"(value));
+    arch_isb();
+}
+
 /* Set Translation Table Base Register 0 (EL1). */
 static ALWAYS_INLINE void arch_set_ttbr0(u64 addr)
 {
@@ -168,6 +235,15 @@ static ALWAYS_INLINE void arch_set_ttbr0(u64 addr)
     arch_tlbi_vmalle1is();
 }
 
+/* Set TTBR0 (EL1) together with its ASID. TLB entries are tagged with the
+   ASID, so no flush is needed. */
+static ALWAYS_INLINE void arch_set_ttbr0_asid(u64 addr, u64 asid)
+{
+    arch_fence();
+    asm volatile("msr ttbr0_el1, %[x]" : : [x] "r"(addr | asid << 48));
+    arch_isb();
+}
+
 /* Get Translation Table Base Register 0 (EL1). */
 static inline WARN_RESULT u64 arch_get_ttbr0()
 {
@@ -316,4 +392,4 @@ static ALWAYS_INLINE NO_RETURN void arch_stop_cpu()
 
 void delay_us(u64 n);
 u64 psci_cpu_on(u64 cpuid, u64 ep);
-void smp_init();
\ No newline at end of file
+void smp_init();
\ No newline at end of file
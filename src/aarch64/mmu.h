@@ -36,16 +36,20 @@ typedef unsigned long long u64;
 #define PTE_USER (1 << 6)
 #define PTE_RO (1 << 7)
 #define PTE_RW (0 << 7)
+// not global: the TLB entry is tagged with the ASID in TTBR0
+#define PTE_NG (1 << 11)
 
 #define PTE_KERNEL_DATA (PTE_KERNEL | PTE_NORMAL | PTE_BLOCK)
 #define PTE_KERNEL_DEVICE (PTE_KERNEL | PTE_DEVICE | PTE_BLOCK)
-#define PTE_USER_DATA (PTE_USER | PTE_NORMAL | PTE_PAGE)
+#define PTE_USER_DATA (PTE_USER | PTE_NORMAL | PTE_PAGE | PTE_NG)
 
 #define N_PTE_PER_TABLE 512
 
 #define PTE_HIGH_NX (1LL << 54)
 
 #define KSPACE_MASK 0xFFFF000000000000
+// TTBR0 translates [0, USPACE_TOP), see TCR_T0SZ in start.S
+#define USPACE_TOP (1ull << 48)
 
 // convert kernel address into physical address.
 #define K2P(addr) ((u64)(addr) - (KSPACE_MASK))
@@ -6,11 +6,17 @@
 #include <kernel/proc.h>
 #include <kernel/syscall.h>
 #include <kernel/paging.h>
+#include <kernel/uaccess.h>
+#include <kernel/fpsimd.h>
 
 #define SPSR_EL1_DAIF_MASK 0xF
+// SPSR_EL1.M[3:0]: 0 means the exception was taken from EL0
+#define SPSR_EL1_M_MASK 0xF
 
 void trap_global_handler(UserContext *context) {
-    thisproc()->ucontext = context;
+    // 只记录来自用户态的现场；系统调用中 copy_from_user 等触发的内核态缺页不能覆盖它
+    if ((context->spsr & SPSR_EL1_M_MASK) == 0)
+        thisproc()->ucontext = context;
     u64 esr = arch_get_esr();
     u64 ec = esr >> ESR_EC_SHIFT;
     u64 iss = esr & ESR_ISS_MASK;
@@ -21,17 +27,33 @@ void trap_global_handler(UserContext *context) {
         if (ir)
             PANIC();
         else {
+            idle_exit();  // 空闲的 CPU 被中断唤醒
             interrupt_global_handler();
         }
     } break;
     case ESR_EC_SVC64: {
         syscall_entry(context);
     } break;
+    case ESR_EC_FP_ASIMD: {
+        fpsimd_trap();
+    } break;
     case ESR_EC_IABORT_EL0:
+    case ESR_EC_DABORT_EL0: {
+        if (pgfault_handler(iss, false) < 0)
+            thisproc()->killed = true;
+    } break;
     case ESR_EC_IABORT_EL1:
-    case ESR_EC_DABORT_EL0:
     case ESR_EC_DABORT_EL1: {
-        pgfault_handler(iss);
+        // 内核访问用户内存出错：只有登记在异常修复表中的指令（uaccess.S）可以恢复
+        u64 fixup = search_exception_table(context->elr);
+        if (pgfault_handler(iss, fixup != 0) < 0) {
+            if (!fixup) {
+                printk("kernel page fault at %p, pc %p\n", (void *)arch_get_far(),
+                       (void *)context->elr);
+                PANIC();
+            }
+            context->elr = fixup;
+        }
     } break;
     default: {
         printk("Unknwon exception %llu\n", esr);
@@ -45,6 +67,7 @@ void trap_global_handler(UserContext *context) {
     // 当处理完异常或系统调用后，内核会从 ELR_EL1 中读取该地址，决定返回到哪个地址执行下一条指令。
     // 如果该地址指向用户态地址空间，则表明进程即将返回用户态。
     if (thisproc()->killed == true && ((context->elr) & 0xffff000000000000) == 0) exit(-1);
+    if (((context->elr) & 0xffff000000000000) == 0) preempt_if_needed();
 
 }
 
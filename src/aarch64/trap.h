@@ -7,8 +7,15 @@
 #define ESR_IR_MASK (1 << 25)
 
 #define ESR_EC_UNKNOWN 0x00
+#define ESR_EC_FP_ASIMD 0x07  // FP/SIMD access trapped by CPACR_EL1.FPEN
 #define ESR_EC_SVC64 0x15
 #define ESR_EC_IABORT_EL0 0x20
 #define ESR_EC_IABORT_EL1 0x21
 #define ESR_EC_DABORT_EL0 0x24
 #define ESR_EC_DABORT_EL1 0x25
+
+// ISS encoding of instruction/data aborts
+#define ISS_WNR (1 << 6)  // data abort caused by a write
+#define ISS_FSC_MASK 0x3f
+#define ISS_FSC_PERMISSION 0x0c  // permission fault, levels 0-3 in the low 2 bits
+#define ISS_IS_PERMISSION_FAULT(iss) (((iss) & 0x3c) == ISS_FSC_PERMISSION)
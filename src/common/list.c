@@ -75,7 +75,7 @@ void queue_init(Queue *x)
 {
     x->begin = x->end = 0;
     x->sz = 0;
-    init_spinlock(&x->lk);
+    init_spinlock(&x->lk, "queue");
 }
 void queue_lock(Queue *x)
 {
@@ -315,4 +315,88 @@ rb_node _rb_first(rb_root root)
     while (n->rb_left)
         n = n->rb_left;
     return n;
-}
\ No newline at end of file
+}
+rb_node _rb_last(rb_root root)
+{
+    rb_node n;
+    n = root->rb_node;
+    if (!n)
+        return NULL;
+    while (n->rb_right)
+        n = n->rb_right;
+    return n;
+}
+rb_node _rb_next(rb_node node)
+{
+    rb_node parent;
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left)
+            node = node->rb_left;
+        return node;
+    }
+    while ((parent = rb_parent(node)) && node == parent->rb_right)
+        node = parent;
+    return parent;
+}
+rb_node _rb_prev(rb_node node)
+{
+    rb_node parent;
+    if (node->rb_left) {
+        node = node->rb_left;
+        while (node->rb_right)
+            node = node->rb_right;
+        return node;
+    }
+    while ((parent = rb_parent(node)) && node == parent->rb_left)
+        node = parent;
+    return parent;
+}
+/* Rotations only ever move nodes on the path from the deepest changed node to
+   the root, or their siblings, so refreshing those is enough. */
+void _rb_augment_path(rb_node node, rb_augment_f func)
+{
+    rb_node parent;
+    while (1) {
+        func(node);
+        parent = rb_parent(node);
+        if (!parent)
+            return;
+        if (node == parent->rb_left && parent->rb_right)
+            func(parent->rb_right);
+        else if (parent->rb_left)
+            func(parent->rb_left);
+        node = parent;
+    }
+}
+void _rb_augment_insert(rb_node node, rb_augment_f func)
+{
+    if (node->rb_left)
+        node = node->rb_left;
+    else if (node->rb_right)
+        node = node->rb_right;
+    _rb_augment_path(node, func);
+}
+rb_node _rb_augment_erase_begin(rb_node node)
+{
+    rb_node deepest;
+    if (!node->rb_right && !node->rb_left)
+        deepest = rb_parent(node);
+    else if (!node->rb_right)
+        deepest = node->rb_left;
+    else if (!node->rb_left)
+        deepest = node->rb_right;
+    else {
+        deepest = _rb_next(node);
+        if (deepest->rb_right)
+            deepest = deepest->rb_right;
+        else if (rb_parent(deepest) != node)
+            deepest = rb_parent(deepest);
+    }
+    return deepest;
+}
+void _rb_augment_erase_end(rb_node deepest, rb_augment_f func)
+{
+    if (deepest)
+        _rb_augment_path(deepest, func);
+}
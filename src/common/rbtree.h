@@ -20,3 +20,21 @@ void _rb_erase(rb_node node, rb_root root);
 rb_node _rb_lookup(rb_node node, rb_root rt,
                    bool (*cmp)(rb_node lnode, rb_node rnode));
 rb_node _rb_first(rb_root root);
+rb_node _rb_last(rb_root root);
+rb_node _rb_next(rb_node node);
+rb_node _rb_prev(rb_node node);
+
+/* Augmented trees: every node caches a value computed from itself and its
+   children (e.g. the max end of an interval subtree). `func` recomputes that
+   value for one node from its children. Call `_rb_augment_insert` after
+   `_rb_insert`, and wrap `_rb_erase` with `_rb_augment_erase_begin/end`:
+       deepest = _rb_augment_erase_begin(node);
+       _rb_erase(node, root);
+       _rb_augment_erase_end(deepest, func);
+   `_rb_augment_path` refreshes the values from `node` up to the root after the
+   node's own value changed in place. */
+typedef void (*rb_augment_f)(rb_node node);
+void _rb_augment_path(rb_node node, rb_augment_f func);
+void _rb_augment_insert(rb_node node, rb_augment_f func);
+rb_node _rb_augment_erase_begin(rb_node node);
+void _rb_augment_erase_end(rb_node deepest, rb_augment_f func);
@@ -0,0 +1,68 @@
+#include <common/rwlock.h>
+
+#define RW_WRITER_LOCKED 0xffu
+#define RW_WRITER_WAITING 0x100u
+#define RW_WRITER_MASK (RW_WRITER_LOCKED | RW_WRITER_WAITING)
+#define RW_READER_BIAS 0x200u
+
+void init_rwlock(RWLock *lock, const char *name)
+{
+    lock->cnts = 0;
+    init_spinlock(&lock->wait_lock, name);
+}
+
+// 等到 (cnts & mask) == val，返回当时的 cnts。ldaxr 监视 cnts，它一变 wfe 就会醒来。
+static u32 wait_cnts(RWLock *lock, u32 mask, u32 val)
+{
+    u32 cnts, tmp;
+    asm volatile("   sevl\n"
+                 "1: wfe\n"
+                 "   ldaxr %w[cnts], [%[p]]\n"
+                 "   and %w[tmp], %w[cnts], %w[mask]\n"
+                 "   cmp %w[tmp], %w[val]\n"
+                 "   b.ne 1b\n"
+                 : [cnts] "=&r"(cnts), [tmp] "=&r"(tmp)
+                 : [p] "r"(&lock->cnts), [mask] "r"(mask), [val] "r"(val)
+                 : "cc", "memory");
+    return cnts;
+}
+
+void read_lock(RWLock *lock)
+{
+    u32 cnts = __atomic_add_fetch(&lock->cnts, RW_READER_BIAS, __ATOMIC_ACQUIRE);
+    if (!(cnts & RW_WRITER_MASK))
+        return;
+    // 有写者持有或在等：退出来，排到 wait_lock 上（在等的写者此时正持有它）
+    __atomic_sub_fetch(&lock->cnts, RW_READER_BIAS, __ATOMIC_RELAXED);
+    acquire_spinlock(&lock->wait_lock);
+    __atomic_add_fetch(&lock->cnts, RW_READER_BIAS, __ATOMIC_RELAXED);
+    wait_cnts(lock, RW_WRITER_LOCKED, 0);
+    release_spinlock(&lock->wait_lock);
+}
+
+void read_unlock(RWLock *lock)
+{
+    __atomic_sub_fetch(&lock->cnts, RW_READER_BIAS, __ATOMIC_RELEASE);
+}
+
+void write_lock(RWLock *lock)
+{
+    u32 cnts = 0;
+    if (__atomic_compare_exchange_n(&lock->cnts, &cnts, RW_WRITER_LOCKED, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    acquire_spinlock(&lock->wait_lock);
+    // 先挂上等待标记挡住新的读者，再等已有的读者和写者全部离开
+    __atomic_fetch_or(&lock->cnts, RW_WRITER_WAITING, __ATOMIC_RELAXED);
+    do {
+        cnts = wait_cnts(lock, ~0u, RW_WRITER_WAITING);
+    } while (!__atomic_compare_exchange_n(&lock->cnts, &cnts, RW_WRITER_LOCKED, false,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    release_spinlock(&lock->wait_lock);
+}
+
+// 只清掉低 8 位的持有标记，不碰可能正在增加的读者计数与等待标记
+void write_unlock(RWLock *lock)
+{
+    __atomic_store_n((volatile u8 *)&lock->cnts, 0, __ATOMIC_RELEASE);
+}
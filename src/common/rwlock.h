@@ -0,0 +1,18 @@
+#pragma once
+#include <common/spinlock.h>
+
+// 读写锁，给读远多于写的数据结构用（进程树、inode 链表）。
+// cnts 的低 8 位是写者持有标记，第 8 位表示有写者在等，其余位是读者个数。
+// 没有争用时读写都只是一次原子操作；有争用时在 wait_lock（票据锁）上排队，
+// 写者一旦开始等待，新来的读者也要排在它后面，所以写者不会被读者饿死。
+// 持有期间不能睡眠。
+typedef struct {
+    volatile u32 cnts;
+    SpinLock wait_lock;
+} RWLock;
+
+void init_rwlock(RWLock *, const char *name);
+void read_lock(RWLock *);
+void read_unlock(RWLock *);
+void write_lock(RWLock *);
+void write_unlock(RWLock *);
@@ -4,13 +4,75 @@
 #include <kernel/printk.h>
 #include <common/list.h>
 #include <common/checker.h>
+#include <kernel/syscall.h>
+
+void init_wait_queue(WaitQueue *wq) { init_list_node(&wq->sleeplist); }
+
+bool _sleep_on(WaitQueue *wq, SpinLock *lock, bool exclusive, bool alertable) {
+    WaitData wait = {.up = false, .exclusive = exclusive, .proc = thisproc()};
+    if (exclusive)
+        _insert_into_list(wq->sleeplist.prev, &wait.slnode);
+    else
+        _insert_into_list(&wq->sleeplist, &wait.slnode);
+    acquire_sched_lock();
+    release_spinlock(lock);
+    sched(alertable ? SLEEPING : DEEPSLEEPING);
+    acquire_spinlock(lock);
+    if (!wait.up)
+        _detach_from_list(&wait.slnode);
+    return wait.up;
+}
+
+int _wake_up(WaitQueue *wq, int nr_exclusive) {
+    int woken = 0;
+    ListNode *p = wq->sleeplist.next;
+    while (p != &wq->sleeplist) {
+        auto wait = container_of(p, WaitData, slnode);
+        p = p->next;
+        bool exclusive = wait->exclusive;
+        wait->up = true;
+        _detach_from_list(&wait->slnode);
+        activate_proc(wait->proc);
+        woken++;
+        if (exclusive && --nr_exclusive == 0)
+            break;
+    }
+    return woken;
+}
 
 void init_sem(Semaphore *sem, int val) {
     sem->val = val;
-    init_spinlock(&sem->lock);
-    init_list_node(&sem->sleeplist);
+    init_spinlock(&sem->lock, "sem");
+    init_wait_queue(&sem->wq);
+#ifdef LOCK_STAT
+    sem->cls = NULL;
+#endif
+}
+
+#ifdef LOCK_STAT
+void init_sleeplock(SleepLock *lock, const char *name) {
+    init_sem(lock, 1);
+    lock->cls = lock_class_of(name, true);
+}
+
+// 获取前 val <= 0 说明锁已被持有，要睡眠等待，记为一次争用
+bool _acquire_sleeplock(SleepLock *lock, bool alertable) {
+    u64 t = get_timestamp();
+    _lock_sem(lock);
+    bool contended = lock->val <= 0;
+    if (!_wait_sem(lock, alertable))
+        return false;
+    lock->hold_start = get_timestamp();
+    lock_stat_acquired(lock->cls, contended, lock->hold_start - t);
+    return true;
 }
 
+void release_sleeplock(SleepLock *lock) {
+    lock_stat_released(lock->cls, get_timestamp() - lock->hold_start);
+    post_sem(lock);
+}
+#endif
+
 void _lock_sem(Semaphore *sem) { acquire_spinlock(&sem->lock); }
 
 void _unlock_sem(Semaphore *sem) { release_spinlock(&sem->lock); }
@@ -37,48 +99,33 @@ int get_all_sem(Semaphore *sem) {
     return ret;
 }
 
+// 一次把所有等待者都叫醒，不再逐个 post 再取回
 int post_all_sem(Semaphore *sem) {
-    int ret = -1;
+    int ret = 0;
     _lock_sem(sem);
-    do
-        _post_sem(sem), ret++;
-    while (!_get_sem(sem));
+    if (sem->val < 0) {
+        ret = _wake_up_all(&sem->wq);
+        ASSERT(ret == -sem->val);
+        sem->val = 0;
+    }
     _unlock_sem(sem);
     return ret;
 }
 
+// 信号量的等待都是独占的：一次 post 只交出一个单位，只需叫醒一个进程
 bool _wait_sem(Semaphore *sem, bool alertable) {
     if (--sem->val >= 0) {
         release_spinlock(&sem->lock);
         return true;
     }
-    WaitData *wait = kalloc(sizeof(WaitData));
-    wait->proc = thisproc();
-    wait->up = false;
-    _insert_into_list(&sem->sleeplist, &wait->slnode);
-    acquire_sched_lock();
-    // printk("sched begin!\n");
-    release_spinlock(&sem->lock);
-    sched(alertable ? SLEEPING : DEEPSLEEPING);
-    // printk("sched end\n");
-    acquire_spinlock(&sem->lock); // also the lock for waitdata
-    if (!wait->up) {
+    bool ret = _sleep_on(&sem->wq, &sem->lock, true, alertable);
+    if (!ret)
         ASSERT(++sem->val <= 0);
-        _detach_from_list(&wait->slnode);
-    }
     release_spinlock(&sem->lock);
-    bool ret = wait->up;
-    kfree(wait);
     return ret;
 }
 
 void _post_sem(Semaphore *sem) {
-    if (++sem->val <= 0) {
-        ASSERT(!_empty_list(&sem->sleeplist));
-        auto wait = container_of(sem->sleeplist.prev, WaitData, slnode);
-        wait->up = true;
-        _detach_from_list(&wait->slnode);
-        activate_proc(wait->proc);
-    }
-    // printk("post_sem done\n");
-}
\ No newline at end of file
+    if (++sem->val <= 0)
+        ASSERT(_wake_up_one(&sem->wq) == 1);
+}
@@ -4,16 +4,38 @@
 
 struct Proc;
 
+// 等待记录放在睡眠者自己的栈上：唤醒方只在持有保护队列的锁时访问它，
+// 睡眠者醒来后要先重新拿到这把锁才能返回，所以不用为每次睡眠分配内存。
 typedef struct {
-    bool up;
+    bool up;         // 被 _wake_up 唤醒；false 表示是被 alert 叫醒的
+    bool exclusive;  // 独占等待，一次唤醒只叫醒指定个数
     struct Proc *proc;
     ListNode slnode;
 } WaitData;
 
+// 等待队列，由调用者自己的自旋锁保护（通常就是保护等待条件的那把锁）。
+// 非独占的等待者排在队首，独占的按到达顺序排在队尾，
+// 唤醒时先叫醒全部非独占的，再叫醒至多 nr_exclusive 个独占的，避免惊群。
 typedef struct {
-    SpinLock lock;
-    int val;
     ListNode sleeplist;
+} WaitQueue;
+
+void init_wait_queue(WaitQueue *);
+// 调用者持有 lock；睡眠期间放开它，返回前重新拿到。返回 false 表示被 alert 打断。
+WARN_RESULT bool _sleep_on(WaitQueue *, SpinLock *lock, bool exclusive, bool alertable);
+// 调用者持有保护 wq 的锁，nr_exclusive 为 0 表示全部唤醒，返回唤醒的个数
+int _wake_up(WaitQueue *, int nr_exclusive);
+#define _wake_up_one(wq) _wake_up(wq, 1)
+#define _wake_up_all(wq) _wake_up(wq, 0)
+
+typedef struct {
+    SpinLock lock;
+    int val;  // 小于 0 时 -val 就是在 wq 上睡眠的进程数
+    WaitQueue wq;
+#ifdef LOCK_STAT
+    struct lock_class *cls;  // 只有当作 SleepLock 用时才有
+    u64 hold_start;
+#endif
 } Semaphore;
 
 void init_sem(Semaphore *, int val);
@@ -38,7 +60,15 @@ int post_all_sem(Semaphore *);
     })
 
 #define SleepLock Semaphore
-#define init_sleeplock(lock) init_sem(lock, 1)
+#ifdef LOCK_STAT
+void init_sleeplock(SleepLock *, const char *name);
+WARN_RESULT bool _acquire_sleeplock(SleepLock *, bool alertable);
+void release_sleeplock(SleepLock *);
+#define acquire_sleeplock(lock) _acquire_sleeplock(lock, true)
+#define unalertable_acquire_sleeplock(lock) ASSERT(_acquire_sleeplock(lock, false))
+#else
+#define init_sleeplock(lock, name) init_sem(lock, 1)
 #define acquire_sleeplock(lock) wait_sem(lock)
 #define unalertable_acquire_sleeplock(lock) unalertable_wait_sem(lock)
 #define release_sleeplock(lock) post_sem(lock)
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+#include <common/spinlock.h>
+
+// 顺序锁：读者不写任何共享内存，只在读前后各看一次 seq，
+// 中途有写者（seq 为奇数或前后不同）就重读。适合几个字段要读到一致快照、
+// 而写很少的场合；读到的数据里不能有会被写者释放的指针。
+typedef struct {
+    volatile u32 seq;
+    SpinLock lock;  // 写者之间互斥
+} SeqLock;
+
+static INLINE void init_seqlock(SeqLock *sl, const char *name)
+{
+    sl->seq = 0;
+    init_spinlock(&sl->lock, name);
+}
+
+static INLINE WARN_RESULT u32 read_seqbegin(const SeqLock *sl)
+{
+    u32 seq;
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+        arch_yield();
+    return seq;
+}
+
+// 返回 true 表示读的过程中有写者，需要重读
+static INLINE WARN_RESULT bool read_seqretry(const SeqLock *sl, u32 seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static INLINE void write_seqlock(SeqLock *sl)
+{
+    acquire_spinlock(&sl->lock);
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static INLINE void write_sequnlock(SeqLock *sl)
+{
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    release_spinlock(&sl->lock);
+}
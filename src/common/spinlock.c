@@ -1,28 +1,312 @@
 #include <aarch64/intrinsic.h>
 #include <common/spinlock.h>
 
-void init_spinlock(SpinLock *lock)
+#ifndef NULL
+#define NULL 0
+#endif
+
+static INLINE bool ticket_trylock(SpinLock *lock)
+{
+    u32 val, tmp;
+    // 只有 owner == next（没有人持有也没有人排队）时才取票
+    asm volatile("   ldaxr %w[val], [%[lock]]\n"
+                 "   eor %w[tmp], %w[val], %w[val], ror #16\n"
+                 "   cbnz %w[tmp], 1f\n"
+                 "   add %w[val], %w[val], #(1 << 16)\n"
+                 "   stxr %w[tmp], %w[val], [%[lock]]\n"
+                 "1:\n"
+                 : [val] "=&r"(val), [tmp] "=&r"(tmp)
+                 : [lock] "r"(lock)
+                 : "memory");
+    return tmp == 0;
+}
+
+// 返回是否排过队
+static INLINE bool ticket_lock(SpinLock *lock)
+{
+    u32 val, tmp, owner, waited;
+    asm volatile(
+        // 取票：next 加一，val 中是取票前的 owner 与 next
+        "   prfm pstl1strm, [%[lock]]\n"
+        "1: ldaxr %w[val], [%[lock]]\n"
+        "   add %w[tmp], %w[val], #(1 << 16)\n"
+        "   stxr %w[owner], %w[tmp], [%[lock]]\n"
+        "   cbnz %w[owner], 1b\n"
+        "   eor %w[waited], %w[val], %w[val], ror #16\n"
+        "   cbz %w[waited], 3f\n"
+        // 排队：ldaxrh 让本 CPU 监视 owner，持有者的 stlrh 会清掉监视并唤醒 wfe
+        "   sevl\n"
+        "2: wfe\n"
+        "   ldaxrh %w[owner], [%[lock]]\n"
+        "   eor %w[tmp], %w[owner], %w[val], lsr #16\n"
+        "   cbnz %w[tmp], 2b\n"
+        "3:\n"
+        : [val] "=&r"(val), [tmp] "=&r"(tmp), [owner] "=&r"(owner), [waited] "=&r"(waited)
+        : [lock] "r"(lock)
+        : "memory");
+    return waited != 0;
+}
+
+static INLINE void ticket_unlock(SpinLock *lock)
+{
+    u32 owner;
+    asm volatile("   ldrh %w[owner], [%[lock]]\n"
+                 "   add %w[owner], %w[owner], #1\n"
+                 "   stlrh %w[owner], [%[lock]]\n"
+                 : [owner] "=&r"(owner)
+                 : [lock] "r"(lock)
+                 : "memory");
+}
+
+#ifdef LOCK_STAT
+static SpinLock lock_class_lock;  // 它本身不计入统计，否则会递归
+static struct lock_class lock_classes[LOCK_STAT_MAX_CLASSES];
+static int nr_lock_classes;
+static struct lock_class unnamed_class = {"(unnamed)", false, 0, 0, 0, 0, 0};
+
+static bool same_name(const char *a, const char *b)
+{
+    while (*a != '\0' && *a == *b)
+        a++, b++;
+    return *a == *b;
+}
+
+// 按名字查找锁类，没有就新建一个；类满了则归入 "(unnamed)"
+struct lock_class *lock_class_of(const char *name, bool sleep)
+{
+    struct lock_class *cls = &unnamed_class;
+    if (name == NULL)
+        return cls;
+    ticket_lock(&lock_class_lock);
+    int i = 0;
+    while (i < nr_lock_classes &&
+           !(lock_classes[i].sleep == sleep && same_name(lock_classes[i].name, name)))
+        i++;
+    if (i < LOCK_STAT_MAX_CLASSES) {
+        cls = &lock_classes[i];
+        if (i == nr_lock_classes) {
+            cls->name = name;
+            cls->sleep = sleep;
+            nr_lock_classes++;
+        }
+    }
+    ticket_unlock(&lock_class_lock);
+    return cls;
+}
+
+static void atomic_max(u64 *p, u64 v)
+{
+    u64 old = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (v > old &&
+           !__atomic_compare_exchange_n(p, &old, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// 同一类的多把锁可以同时被不同 CPU 持有，所以计数都用原子操作
+void lock_stat_acquired(struct lock_class *cls, bool contended, u64 wait)
+{
+    if (cls == NULL)
+        cls = &unnamed_class;
+    __atomic_fetch_add(&cls->acquire, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_fetch_add(&cls->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cls->wait, wait, __ATOMIC_RELAXED);
+        atomic_max(&cls->max_wait, wait);
+    }
+}
+
+void lock_stat_released(struct lock_class *cls, u64 hold)
+{
+    atomic_max(cls ? &cls->max_hold : &unnamed_class.max_hold, hold);
+}
+
+static u64 ticks_to_ns(u64 ticks, u64 freq)
+{
+    return ticks / freq * 1000000000 + ticks % freq * 1000000000 / freq;
+}
+
+static void fill_lock_stat(struct lock_stat *st, struct lock_class *cls, u64 freq)
+{
+    int i = 0;
+    for (; i < (int)sizeof(st->name) - 1 && cls->name[i] != '\0'; i++)
+        st->name[i] = cls->name[i];
+    st->name[i] = '\0';
+    st->sleep = cls->sleep;
+    st->acquire = __atomic_load_n(&cls->acquire, __ATOMIC_RELAXED);
+    st->contended = __atomic_load_n(&cls->contended, __ATOMIC_RELAXED);
+    st->wait_ns = ticks_to_ns(__atomic_load_n(&cls->wait, __ATOMIC_RELAXED), freq);
+    st->max_wait_ns = ticks_to_ns(__atomic_load_n(&cls->max_wait, __ATOMIC_RELAXED), freq);
+    st->max_hold_ns = ticks_to_ns(__atomic_load_n(&cls->max_hold, __ATOMIC_RELAXED), freq);
+}
+
+int get_lock_stat(struct lock_stat *st, int n)
+{
+    u64 freq = get_clock_frequency();
+    ticket_lock(&lock_class_lock);
+    int total = nr_lock_classes + 1;
+    // 插入排序：类最多几十个
+    for (int i = 0; i < total; i++) {
+        struct lock_class *cls = i < nr_lock_classes ? &lock_classes[i] : &unnamed_class;
+        u64 wait_ns = ticks_to_ns(__atomic_load_n(&cls->wait, __ATOMIC_RELAXED), freq);
+        int j = MIN(i, n);
+        while (j > 0 && st[j - 1].wait_ns < wait_ns) {
+            if (j < n)
+                st[j] = st[j - 1];
+            j--;
+        }
+        if (j < n)
+            fill_lock_stat(&st[j], cls, freq);
+    }
+    ticket_unlock(&lock_class_lock);
+    return total;
+}
+#endif
+
+void init_spinlock(SpinLock *lock, const char *name)
 {
-    lock->locked = 0;
+    lock->owner = 0;
+    lock->next = 0;
+#ifdef LOCK_STAT
+    lock->cls = lock_class_of(name, false);
+    lock->hold_start = 0;
+#else
+    (void)name;
+#endif
 }
 
+#ifdef LOCK_STAT
 bool try_acquire_spinlock(SpinLock *lock)
 {
-    if (!lock->locked &&
-        !__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE)) {
-        return true;
-    } else {
+    if (!ticket_trylock(lock))
         return false;
-    }
+    lock->hold_start = get_timestamp();
+    lock_stat_acquired(lock->cls, false, 0);
+    return true;
 }
 
 void acquire_spinlock(SpinLock *lock)
 {
-    while (!try_acquire_spinlock(lock))
-        arch_yield();
+    u64 t = get_timestamp();
+    bool waited = ticket_lock(lock);
+    lock->hold_start = get_timestamp();
+    lock_stat_acquired(lock->cls, waited, lock->hold_start - t);
 }
 
 void release_spinlock(SpinLock *lock)
 {
-    __atomic_clear(&lock->locked, __ATOMIC_RELEASE);
+    lock_stat_released(lock->cls, get_timestamp() - lock->hold_start);
+    ticket_unlock(lock);
+}
+#else
+bool try_acquire_spinlock(SpinLock *lock)
+{
+    return ticket_trylock(lock);
+}
+
+void acquire_spinlock(SpinLock *lock)
+{
+    ticket_lock(lock);
+}
+
+void release_spinlock(SpinLock *lock)
+{
+    ticket_unlock(lock);
+}
+#endif
+
+// 等到 *p 非零并返回它。ldaxr 设置独占监视，别的 CPU 写 *p 时 wfe 会醒来。
+static u64 wait_nonzero(volatile u64 *p)
+{
+    u64 val;
+    asm volatile("   sevl\n"
+                 "1: wfe\n"
+                 "   ldaxr %[val], [%[p]]\n"
+                 "   cbz %[val], 1b\n"
+                 : [val] "=&r"(val)
+                 : [p] "r"(p)
+                 : "memory");
+    return val;
+}
+
+static struct mcs_node *get_mcs_node()
+{
+    struct mcs_node *node = this_cpu_mcs_nodes();
+    for (int i = 0; i < MCS_NODES_PER_CPU; i++, node++) {
+        if (!node->in_use) {
+            node->in_use = true;
+            node->next = NULL;
+            node->locked = 0;
+            return node;
+        }
+    }
+    PANIC();
+}
+
+void init_mcs_lock(MCSLock *lock, const char *name)
+{
+    lock->tail = NULL;
+    lock->holder = NULL;
+#ifdef LOCK_STAT
+    lock->cls = lock_class_of(name, false);
+    lock->hold_start = 0;
+#else
+    (void)name;
+#endif
+}
+
+bool try_acquire_mcs_lock(MCSLock *lock)
+{
+    if (lock->tail != NULL)
+        return false;
+    struct mcs_node *node = get_mcs_node(), *expected = NULL;
+    if (__atomic_compare_exchange_n(&lock->tail, &expected, node, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        lock->holder = node;
+#ifdef LOCK_STAT
+        lock->hold_start = get_timestamp();
+        lock_stat_acquired(lock->cls, false, 0);
+#endif
+        return true;
+    }
+    node->in_use = false;
+    return false;
+}
+
+void acquire_mcs_lock(MCSLock *lock)
+{
+#ifdef LOCK_STAT
+    u64 t = get_timestamp();
+#endif
+    struct mcs_node *node = get_mcs_node();
+    struct mcs_node *prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (prev != NULL) {
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        wait_nonzero(&node->locked);
+    }
+    lock->holder = node;
+#ifdef LOCK_STAT
+    lock->hold_start = get_timestamp();
+    lock_stat_acquired(lock->cls, prev != NULL, lock->hold_start - t);
+#endif
+}
+
+void release_mcs_lock(MCSLock *lock)
+{
+    struct mcs_node *node = lock->holder;
+#ifdef LOCK_STAT
+    lock_stat_released(lock->cls, get_timestamp() - lock->hold_start);
+#endif
+    struct mcs_node *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (next == NULL) {
+        struct mcs_node *expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            node->in_use = false;
+            return;
+        }
+        // 后继已经换掉了 tail，但还没来得及把自己挂到 node->next 上
+        next = (struct mcs_node *)wait_nonzero((volatile u64 *)&node->next);
+    }
+    __atomic_store_n(&next->locked, 1, __ATOMIC_RELEASE);
+    node->in_use = false;
 }
@@ -2,11 +2,84 @@
 #include <common/defines.h>
 #include <aarch64/intrinsic.h>
 
+// 打开 LOCK_STAT（cmake -DLOCK_STAT=ON）后，每把 SpinLock/MCSLock/SleepLock 都带一个名字，
+// 同名的锁（例如所有块缓存的 lock）合计为一个 lock_class，统计获取次数、需要等待的次数、
+// 等待时间与最长持有时间。关闭时下面的字段与统计代码全部不编译。
+// 由 lockstat 系统调用返回给用户态（关闭 LOCK_STAT 时该调用返回 -1），按等待时间总和从大到小排列
+struct lock_stat {
+    char name[24];
+    u64 sleep;
+    u64 acquire;
+    u64 contended;
+    u64 wait_ns;
+    u64 max_wait_ns;
+    u64 max_hold_ns;
+};
+
+#ifdef LOCK_STAT
+struct lock_class {
+    const char *name;
+    bool sleep;  // SleepLock：等待时间是睡眠而不是自旋
+    u64 acquire;
+    u64 contended;  // 获取时锁已被别人持有（或已有人在排队）
+    u64 wait;  // 等待时间总和，单位为系统计数器的 tick
+    u64 max_wait;
+    u64 max_hold;
+};
+
+#define LOCK_STAT_MAX_CLASSES 64
+
+struct lock_class *lock_class_of(const char *name, bool sleep);
+void lock_stat_acquired(struct lock_class *cls, bool contended, u64 wait);
+void lock_stat_released(struct lock_class *cls, u64 hold);
+// 把至多 n 个类的统计按等待时间排序后写入 st，返回类的总数
+int get_lock_stat(struct lock_stat *st, int n);
+#endif
+
+// 票据锁：next 是下一张要发出的票，owner 是正在服务的票，按取票顺序先来先得。
+// 两个字段合在一个 32 位字里（owner 在低 16 位），取票是一次 ldaxr/stxr，
+// 等待时用 wfe 睡在这个字上，持有者释放时的写操作会把等待者唤醒。
+// 全零就是未上锁的状态，所以静态变量不调用 init_spinlock 也可以直接使用。
 typedef struct {
-    volatile bool locked;
+    volatile u16 owner;
+    volatile u16 next;
+#ifdef LOCK_STAT
+    struct lock_class *cls;
+    u64 hold_start;
+#endif
 } SpinLock;
 
-void init_spinlock(SpinLock *);
+// `name` 只在 LOCK_STAT 打开时使用，须在锁的整个生命期内有效（通常是字符串常量）
+void init_spinlock(SpinLock *, const char *name);
 WARN_RESULT bool try_acquire_spinlock(SpinLock *);
 void acquire_spinlock(SpinLock *);
 void release_spinlock(SpinLock *);
+
+// MCS 队列锁：每个等待者在自己的节点上自旋，释放时只写后继的节点，
+// 锁本身所在的 cache line 只在入队/出队时被碰一次，CPU 多时比票据锁更省总线。
+// 节点取自每个 CPU 的一个小池子，所以接口与 SpinLock 相同，不需要调用者提供节点。
+// 限制：持有期间不能 sched()（释放时要找回获取时用的节点，它属于获取锁的 CPU）；
+// 同一 CPU 上同时持有的 MCSLock 不能超过 MCS_NODES_PER_CPU 个。
+#define MCS_NODES_PER_CPU 4
+
+struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile u64 locked;  // 前驱交出锁时置 1
+    bool in_use;  // 只被所属 CPU 访问
+} __attribute__((aligned(64)));  // 每个等待者在自己的 cache line 上自旋
+
+typedef struct {
+    struct mcs_node *volatile tail;  // 队尾，NULL 表示未上锁
+    struct mcs_node *holder;  // 持有者的节点，只有持有者读写
+#ifdef LOCK_STAT
+    struct lock_class *cls;
+    u64 hold_start;
+#endif
+} MCSLock;
+
+void init_mcs_lock(MCSLock *, const char *name);
+WARN_RESULT bool try_acquire_mcs_lock(MCSLock *);
+void acquire_mcs_lock(MCSLock *);
+void release_mcs_lock(MCSLock *);
+// 本 CPU 的 MCS_NODES_PER_CPU 个节点。池子放在 kernel/cpu.c 的 struct cpu 中，由内核提供
+struct mcs_node *this_cpu_mcs_nodes();
@@ -1,53 +1,6 @@
 #include <common/string.h>
 
-void *memset(void *s, int c, usize n)
-{
-    for (usize i = 0; i < n; i++)
-        ((u8 *)s)[i] = (u8)(c & 0xff);
-
-    return s;
-}
-
-void *memcpy(void *restrict dest, const void *restrict src, usize n)
-{
-    for (usize i = 0; i < n; i++)
-        ((u8 *)dest)[i] = ((u8 *)src)[i];
-
-    return dest;
-}
-
-int memcmp(const void *s1, const void *s2, usize n)
-{
-    for (usize i = 0; i < n; i++) {
-        int c1 = ((u8 *)s1)[i];
-        int c2 = ((u8 *)s2)[i];
-
-        if (c1 != c2)
-            return c1 - c2;
-    }
-
-    return 0;
-}
-
-void *memmove(void *dest, const void *src, usize n)
-{
-    const char *s = (const char *)src;
-    char *d = (char *)dest;
-
-    if (s < d && (usize)(d - s) < n) {
-        s += n;
-        d += n;
-        while (n-- > 0) {
-            *--d = *--s;
-        }
-    } else {
-        while (n-- > 0) {
-            *d++ = *s++;
-        }
-    }
-
-    return dest;
-}
+// memset/memcpy/memcmp/memmove 用汇编实现，见 aarch64/string.S。
 
 char *strncpy(char *restrict dest, const char *restrict src, usize n)
 {
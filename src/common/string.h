@@ -2,6 +2,7 @@
 
 #include <common/defines.h>
 
+// implemented in aarch64/string.S with 16-byte ldp/stp; memset(0) uses DC ZVA.
 void *memset(void *s, int c, usize n);
 void *memcpy(void *restrict dest, const void *restrict src, usize n);
 WARN_RESULT int memcmp(const void *s1, const void *s2, usize n);
@@ -74,6 +74,11 @@ static inline void w_icc_eoir1_el1(u32 x)
     asm volatile("msr S3_0_C12_C12_1, %0" : : "r"(x));
 }
 
+static inline void w_icc_sgi1r_el1(u64 x)
+{
+    asm volatile("msr S3_0_C12_C11_5, %0" : : "r"(x));
+}
+
 static inline u32 icc_sre_el1()
 {
     u32 x;
@@ -248,6 +253,7 @@ void gicv3_init_percpu()
     gic_redist_init(cpu);
 
     gic_setup_ppi(cpuid(), TIMER_IRQ, 0);
+    gic_setup_ppi(cpuid(), IPI_RESCHED, 0);
 
     gic_enable();
 }
@@ -268,6 +274,16 @@ bool gic_enabled()
     return (icc_igrpen1_el1() & 0x1) && (rd32(GICD_CTLR) & 0x1);
 }
 
+// 向一个 CPU 发 Group 1 的 SGI。qemu virt 上 CPU i 的 MPIDR 是 Aff0 = i，
+// 其余亲和性字段为 0，所以 TargetList 就是 1 << cpu。
+void gic_send_sgi(u32 cpu, u32 intid)
+{
+    ASSERT(intid < 16 && cpu < 16);
+    arch_dsb_sy();  // 先让队列的修改对目标 CPU 可见
+    w_icc_sgi1r_el1((u64)intid << 24 | (1u << cpu));
+    arch_isb();
+}
+
 u32 gic_iar()
 {
     return icc_iar1_el1();
@@ -3,6 +3,7 @@
 #define NUM_IRQ_TYPES 64
 
 typedef enum {
+    IPI_RESCHED = 1,  // SGI，让目标 CPU 重新调度
     IRQ_AUX = 29,
     TIMER_IRQ = 27,
     UART_IRQ = 33,
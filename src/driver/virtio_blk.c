@@ -210,5 +210,5 @@ void virtio_init() {
 
     arch_fence();
     set_interrupt_handler(VIRTIO_BLK_IRQ, virtio_blk_intr);
-    init_spinlock(&disk.lk);
+    init_spinlock(&disk.lk, "disk");
 }
@@ -4,6 +4,7 @@
 #include <kernel/mem.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
+#include <kernel/slab.h>
 
 static const SuperBlock* sblock;
 static const BlockDevice* device;
@@ -14,12 +15,13 @@ static SpinLock bitmap_lock;
 static ListNode head;     // the list of all allocated in-memory block.
 static LogHeader header;  // in-memory copy of log header block.
 static usize block_num;   // 全局变量记录当前 bcache 中块的个数
+static KMemCache* block_cache;
 
 struct {
     // bool committing;  // 日志是否正在提交？无需，end_op写回的时候大锁锁死算了
     // 当然可以每次log中blocks写回的时候都放锁，然后这committing其实就相当于锁，不允许sync
     int outstanding;  // 当前正在等待提交的操作数，也就是正在进行的操作的数量。
-    Semaphore log_sem;
+    WaitQueue log_wait;  // 等待日志空间的 begin_op，由 log_lock 保护
 } log;
 
 // read the content from disk.
@@ -44,7 +46,7 @@ static void init_block(Block* block) {
     init_list_node(&block->node);
     block->acquired = false;
     block->pinned = false;
-    init_sleeplock(&block->lock);
+    init_sleeplock(&block->lock, "block");
     block->valid = false;
     memset(block->data, 0, sizeof(block->data));
 }
@@ -66,7 +68,7 @@ void manage_block_num() {
         if (!current_block->acquired && !current_block->pinned){
             _detach_from_list(p);
             block_num--;
-            kfree(current_block);
+            kmem_cache_free(block_cache, current_block);
         }
         p = q;
     }
@@ -103,7 +105,7 @@ static Block* cache_acquire(usize block_no) {
     // 如果在cache中没有找到acquire的块：要allocate空间搞个新块，block_no赋为传入值
     // 并且把这一块放到cache中，还要处理cache中block数量小于软上界。
     manage_block_num();
-    acquired_block = kalloc(sizeof(Block));
+    acquired_block = kmem_cache_alloc(block_cache);
     init_block(acquired_block);
     if (!wait_sem(&acquired_block->lock)) PANIC();
     acquired_block->block_no = block_no;
@@ -137,9 +139,8 @@ static void cache_begin_op(OpContext* ctx) {
     acquire_spinlock(&log_lock);
     ctx->rm = OP_MAX_NUM_BLOCKS;
     while (LOG_MAX_SIZE <= header.num_blocks + (log.outstanding+1) * OP_MAX_NUM_BLOCKS) {
-        release_spinlock(&log_lock);
-        if (!wait_sem(&log.log_sem)) PANIC();
-        acquire_spinlock(&log_lock);
+        // 一次 end_op 只腾出一个操作的空间，所以独占地等，只被叫醒一个
+        if (!_sleep_on(&log.log_wait, &log_lock, true, true)) PANIC();
     }
     log.outstanding++;  // begin_op了，日志记录新增一个待处理的操作数
     release_spinlock(&log_lock);
@@ -182,7 +183,7 @@ static void cache_end_op(OpContext* ctx) {
     log.outstanding--;
     // 如果还有未完成的操作，不能end_op，直接返回
     if (log.outstanding > 0) {
-        post_sem(&log.log_sem);
+        _wake_up_one(&log.log_wait);
         release_spinlock(&log_lock);
         return;
     }
@@ -200,7 +201,7 @@ static void cache_end_op(OpContext* ctx) {
     }
     header.num_blocks = 0;
     write_header();
-    post_all_sem(&log.log_sem);
+    _wake_up_all(&log.log_wait);  // 日志清空了，等着的都可能进得来
     release_spinlock(&log_lock);
 }
 
@@ -209,8 +210,9 @@ void init_bcache(const SuperBlock* _sblock, const BlockDevice* _device) {
     sblock = _sblock;
     device = _device;
     block_num = 0;
-    init_spinlock(&lock); init_spinlock(&bitmap_lock);
-    init_sem(&log.log_sem,0); init_spinlock(&log_lock);
+    block_cache = kmem_cache_create("block", sizeof(Block), NULL);
+    init_spinlock(&lock, "bcache_lock"); init_spinlock(&bitmap_lock, "bitmap_lock");
+    init_wait_queue(&log.log_wait); init_spinlock(&log_lock, "log_lock");
     log.outstanding = 0; init_list_node(&head);
     read_header();
     for (usize i = 0; i < header.num_blocks; i++){
@@ -14,7 +14,7 @@ static struct ftable ftable;
 
 void init_ftable() {
     // TODO: initialize your ftable.
-    init_spinlock(&ftable.ftable_lock);
+    init_spinlock(&ftable.ftable_lock, "ftable_lock");
 }
 
 void init_oftable(struct oftable *oftable) {
@@ -42,9 +42,8 @@ struct file* file_alloc() {
 /* Increment ref count for file f. */
 struct file* file_dup(struct file* f) {
     /* (Final) TODO BEGIN */
-    acquire_spinlock(&ftable.ftable_lock);
-    f->ref++;
-    release_spinlock(&ftable.ftable_lock);
+    // 调用者已经持有一个引用，ref 不会同时降到 0 被 file_alloc 重用，不需要 ftable_lock
+    __atomic_fetch_add(&f->ref, 1, __ATOMIC_RELAXED);
     /* (Final) TODO END */
     return f;
 }
@@ -53,12 +52,14 @@ struct file* file_dup(struct file* f) {
 void file_close(struct file* f) {
     /* (Final) TODO BEGIN */
     if(f->type == FD_NONE) return;
+    // 不是最后一个引用时只做一次原子减；最后一个引用要在 ftable_lock 下清掉，
+    // 与 file_alloc 的扫描互斥
+    int ref = __atomic_load_n(&f->ref, __ATOMIC_RELAXED);
+    while (ref > 1)
+        if (__atomic_compare_exchange_n(&f->ref, &ref, ref - 1, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
     acquire_spinlock(&ftable.ftable_lock);
-    f->ref--;
-    if(f->ref > 0){
-        release_spinlock(&ftable.ftable_lock);
-        return;
-    }
     struct file now = *f;
     f->ref = 0;
     f->type = FD_NONE;
@@ -4,11 +4,13 @@
 #include <kernel/printk.h>
 #include <common/sem.h>
 #include <common/spinlock.h>
+#include <common/rwlock.h>
 #include <common/rc.h>
 #include <kernel/proc.h>
 #include <kernel/console.h>
 #include <sys/stat.h>
 #include <kernel/sched.h>
+#include <kernel/slab.h>
 #include <assert.h>
 
 /**
@@ -41,6 +43,24 @@ static SpinLock lock;
  */
 static ListNode head;
 
+/**
+    @brief protects `head`. Lookups in `inode_get` only take the read lock;
+    inserting a new inode and unlinking a dead one take the write lock.
+ */
+static RWLock list_lock;
+
+/**
+    @brief the slab cache which in-memory inodes are allocated from.
+ */
+static KMemCache* inode_cache;
+
+// 页缓存：按 4KB 页缓存文件内容（Inode::pages）。读直接从缓存页拷贝；写同时更新缓存页，
+// 并照旧经过日志写到块上（write-through），所以除了被共享映射写脏的页（dirty_pages）
+// 之外，缓存页与块的内容总是一致的。整个文件系统只有 FSSIZE 个块，
+// 页缓存的总大小不会超过它，因此不做回收；inode 被清空或释放时丢弃它的缓存页。
+#define BLOCKS_PER_PAGE (PAGE_SIZE / BLOCK_SIZE)
+static usize pc_hit, pc_miss;
+
 // return which block `inode_no` lives on.
 static INLINE usize to_block_no(usize inode_no) {
     return sblock->inode_start + (inode_no / (INODE_PER_BLOCK));
@@ -58,8 +78,10 @@ static INLINE u32* get_addrs(Block* block) {
 
 // initialize inode tree.
 void init_inodes(const SuperBlock* _sblock, const BlockCache* _cache) {
-    init_spinlock(&lock);
+    init_spinlock(&lock, "inode_lock");
     init_list_node(&head);
+    init_rwlock(&list_lock, "inode_list");
+    inode_cache = kmem_cache_create("inode", sizeof(Inode), NULL);
     sblock = _sblock;
     cache = _cache;
     if (ROOT_INODE_NO < sblock->num_inodes)
@@ -70,11 +92,16 @@ void init_inodes(const SuperBlock* _sblock, const BlockCache* _cache) {
 
 // initialize in-memory inode.
 static void init_inode(Inode* inode) {
-    init_sleeplock(&inode->lock);
+    init_sleeplock(&inode->lock, "inode");
     init_rc(&inode->rc);
     init_list_node(&inode->node);
     inode->inode_no = 0; // 0在一些函数中用于表示「没有 Inode」的意思。
     inode->valid = false;
+    memset(inode->pages, 0, sizeof(inode->pages));
+    init_spinlock(&inode->page_lock, "inode_pages");
+    inode->dirty_pages = 0;
+    inode->text_pages = 0;
+    memset(inode->shared_writers, 0, sizeof(inode->shared_writers));
 }
 
 // see `inode.h`.
@@ -135,33 +162,64 @@ static void inode_sync(OpContext* ctx, Inode* inode, bool do_write) {
     else if(!inode->valid && do_write) { PANIC(); }
 }
 
-// see `inode.h`.
-// 获得一个 inode（依然在inode中维护一个链表）
-static Inode* inode_get(usize inode_no) {
-    if(inode_no == 0) return NULL;
-    ASSERT(inode_no > 0);
-    ASSERT(inode_no < sblock->num_inodes);
-    // TODO
-    _for_in_list(p, &head){
+// 在链表中找 inode_no，找到就把引用计数加一。调用者持有 list_lock（读或写）。
+static Inode* find_inode(usize inode_no) {
+    _for_in_list(p, &head) {
         if (p == &head) continue;
         auto current_inode = container_of(p, Inode, node);
         if (current_inode->inode_no == inode_no) {
             increment_rc(&current_inode->rc);
-            release_spinlock(&lock);
             return current_inode;
         }
     }
-    Inode* new_inode = kalloc(sizeof(Inode));
+    return NULL;
+}
+
+// see `inode.h`.
+// 获得一个 inode（依然在inode中维护一个链表）
+static Inode* inode_get(usize inode_no) {
+    if(inode_no == 0) return NULL;
+    ASSERT(inode_no > 0);
+    ASSERT(inode_no < sblock->num_inodes);
+    // TODO
+    read_lock(&list_lock);
+    Inode* inode = find_inode(inode_no);
+    read_unlock(&list_lock);
+    if (inode) return inode;
+    // 从磁盘读入可能睡眠，不能持有 list_lock；读完再查一次，别人可能已经插入了同一个 inode
+    Inode* new_inode = kmem_cache_alloc(inode_cache);
     init_inode(new_inode);
     new_inode->inode_no = inode_no;
     increment_rc(&new_inode->rc);
     inode_lock(new_inode);
     inode_sync(NULL, new_inode, false);
     inode_unlock(new_inode);
-    _insert_into_list(&head, &new_inode->node);
+    write_lock(&list_lock);
+    inode = find_inode(inode_no);
+    if (inode == NULL)
+        _insert_into_list(&head, &new_inode->node);
+    write_unlock(&list_lock);
+    if (inode) {
+        kmem_cache_free(inode_cache, new_inode);
+        return inode;
+    }
     return new_inode;
 }
 
+// 丢弃 inode 的所有缓存页。已经映射了这些页的进程继续使用它们，直到解除映射。
+static void drop_pages(Inode* inode) {
+    acquire_spinlock(&inode->page_lock);
+    for (usize i = 0; i < INODE_MAX_PAGES; i++) {
+        if (inode->pages[i]) {
+            kfree_page(inode->pages[i]);
+            inode->pages[i] = NULL;
+        }
+    }
+    release_spinlock(&inode->page_lock);
+    inode->dirty_pages = 0;
+    inode->text_pages = 0;
+}
+
 // see `inode.h`.
 // 清空 inode 的内容（使文件变成长度为 0 的空文件）
 static void inode_clear(OpContext* ctx, Inode* inode) {
@@ -187,6 +245,7 @@ static void inode_clear(OpContext* ctx, Inode* inode) {
     inode->entry.num_bytes=0;
     inode_sync(ctx, inode, true);
     release_spinlock(&lock);
+    drop_pages(inode);
 }
 
 // see `inode.h`.
@@ -201,13 +260,22 @@ static Inode* inode_share(Inode* inode) {
 // 释放 inode，判断是否清空inode内容
 static void inode_put(OpContext* ctx, Inode* inode) {
     // TODO
-    decrement_rc(&inode->rc);
+    // 计数不会降到 0 时不碰 list_lock；可能降到 0 时在写锁下减，
+    // 这样 inode_get 不会在我们摘下它的同时又找到它
+    isize cnt = __atomic_load_n(&inode->rc.count, __ATOMIC_RELAXED);
+    while (cnt > 1)
+        if (__atomic_compare_exchange_n(&inode->rc.count, &cnt, cnt - 1, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return;
+    write_lock(&list_lock);
     // if no one needs the inode any more
-    if(inode->rc.count == 0 && inode->entry.num_links == 0) {
+    bool dead = decrement_rc(&inode->rc) && inode->entry.num_links == 0;
+    if (dead) _detach_from_list(&inode->node);
+    write_unlock(&list_lock);
+    if (dead) {
         inode->entry.type = INODE_INVALID;
         inode_clear(ctx, inode);
-        _detach_from_list(&inode->node);
-        kfree(inode);  // dont forget to kfree
+        kmem_cache_free(inode_cache, inode);  // dont forget to free
     }
 }
 
@@ -265,6 +333,56 @@ static usize inode_map(OpContext* ctx, Inode* inode, usize offset, bool* modifie
 }
 
 
+// see `inode.h`.
+// 取得缓存 inode 第 index 页的页，不在缓存中就从块读入；分配不到页时返回 NULL，缓存不变
+static void* inode_get_page(Inode* inode, usize index, bool dirty) {
+    ASSERT(index < INODE_MAX_PAGES);
+    u8* page = inode->pages[index];
+    if (page) {
+        __atomic_fetch_add(&pc_hit, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&pc_miss, 1, __ATOMIC_RELAXED);
+        page = kalloc_zeroed_page();
+        if (page == NULL)
+            return NULL;
+        usize first = index * BLOCKS_PER_PAGE;
+        usize num_blocks = (inode->entry.num_bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        bool modified = false;
+        for (usize i = first; i < first + BLOCKS_PER_PAGE && i < num_blocks; i++) {
+            Block* block = cache->acquire(inode_map(NULL, inode, i, &modified));
+            memmove(page + (i - first) * BLOCK_SIZE, block->data, BLOCK_SIZE);
+            cache->release(block);
+        }
+        ASSERT(modified == false);
+        kshare_page(page);
+        acquire_spinlock(&inode->page_lock);
+        inode->pages[index] = page;
+        release_spinlock(&inode->page_lock);
+    }
+    if (dirty)
+        inode->dirty_pages |= 1u << index;
+    return page;
+}
+
+// see `inode.h`.
+// 把被共享映射写脏的页经日志写回它的块（只写文件长度以内的块）
+static void inode_sync_page(OpContext* ctx, Inode* inode, usize index) {
+    ASSERT(index < INODE_MAX_PAGES);
+    if (!(inode->dirty_pages & (1u << index)))
+        return;
+    u8* page = inode->pages[index];
+    usize first = index * BLOCKS_PER_PAGE;
+    usize num_blocks = (inode->entry.num_bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (usize i = first; i < first + BLOCKS_PER_PAGE && i < num_blocks; i++) {
+        bool modified = false;
+        Block* block = cache->acquire(inode_map(ctx, inode, i, &modified));
+        memcpy(block->data, page + (i - first) * BLOCK_SIZE, BLOCK_SIZE);
+        cache->sync(ctx, block);
+        cache->release(block);
+    }
+    inode->dirty_pages &= ~(1u << index);
+}
+
 // see `inode.h`.
 // 将 inode 的 offset 处的 len 字节读入 buf
 static usize inode_read(Inode* inode, u8* dest, usize offset, usize count) {
@@ -278,20 +396,43 @@ static usize inode_read(Inode* inode, u8* dest, usize offset, usize count) {
     ASSERT(offset <= entry->num_bytes);
     ASSERT(end <= entry->num_bytes);
     ASSERT(offset <= end);
-    bool modified = false;
     for(usize have_read = 0,sz = 0;have_read < count;have_read+=sz) {
-        Block* block = cache->acquire(inode_map(NULL,inode,offset / BLOCK_SIZE,&modified));
-        if(count - have_read < BLOCK_SIZE - offset % BLOCK_SIZE) sz = count - have_read;
-        else sz = BLOCK_SIZE - offset % BLOCK_SIZE;
-        memmove(dest, block->data + offset % BLOCK_SIZE, sz);
-        // for(usize i=0;i<sz;i++) printk("%c", block->data[i]);
-        cache->release(block);
+        u8* page = inode_get_page(inode, offset / PAGE_SIZE, false);
+        if (page == NULL)  // 内存不足，返回已经读到的部分
+            return have_read;
+        sz = MIN(count - have_read, PAGE_SIZE - offset % PAGE_SIZE);
+        memmove(dest, page + offset % PAGE_SIZE, sz);
         dest += sz; offset += sz;
     }
-    ASSERT(modified == false);
     return count;
 }
 
+// 第 index 页被运行中的程序映射成了代码时，先给页缓存换一份副本再写，
+// 程序继续执行旧页上的内容（旧页在最后一个映射解除时释放）。要写的缓存页（没有缓存时为 NULL）
+// 放在 *page 中；分配不到副本时返回 -1，缓存与 text_pages 都不变。
+static int unshare_text_page(Inode* inode, usize index, u8** page) {
+    u8* old = inode->pages[index];
+    *page = old;
+    if (old == NULL || !(inode->text_pages & (1u << index)))
+        return 0;
+    if (get_page_ref((u64)old) == 1) {  // 只剩页缓存自己的引用
+        inode->text_pages &= ~(1u << index);
+        return 0;
+    }
+    u8* copy = kalloc_page();
+    if (copy == NULL)
+        return -1;
+    memcpy(copy, old, PAGE_SIZE);
+    kshare_page(copy);
+    acquire_spinlock(&inode->page_lock);
+    inode->pages[index] = copy;
+    inode->text_pages &= ~(1u << index);
+    release_spinlock(&inode->page_lock);
+    kfree_page(old);
+    *page = copy;
+    return 0;
+}
+
 // see `inode.h`.
 // 将长度为 len 的 buf 写入 inode 的 offset 处
 static usize inode_write(OpContext* ctx, Inode* inode, u8* src, usize offset, usize count) {
@@ -308,6 +449,7 @@ static usize inode_write(OpContext* ctx, Inode* inode, u8* src, usize offset, us
     ASSERT(offset <= end);
     // TODO
     // Update file size if the write extends beyond current file size
+    usize old_size = entry->num_bytes;
     if (end > entry->num_bytes) {
         entry->num_bytes = end;
         inode_sync(ctx, inode, true);
@@ -318,6 +460,15 @@ static usize inode_write(OpContext* ctx, Inode* inode, u8* src, usize offset, us
         usize block_index = offset / BLOCK_SIZE;  // Block number
         usize block_offset = offset % BLOCK_SIZE;  // offset within the block
         usize bytes_to_write = MIN(BLOCK_SIZE - block_offset, end - offset);
+        // 先准备好缓存页：换不出代码页的副本时在写块之前停下，块和缓存页保持一致
+        u8* page;
+        if (unshare_text_page(inode, offset / PAGE_SIZE, &page) < 0) {
+            if (entry->num_bytes > MAX(old_size, offset)) {
+                entry->num_bytes = MAX(old_size, offset);
+                inode_sync(ctx, inode, true);
+            }
+            break;
+        }
         bool modified = false;
         usize block_no = inode_map(ctx, inode, block_index, &modified);
         ASSERT(block_no != 0);
@@ -326,6 +477,8 @@ static usize inode_write(OpContext* ctx, Inode* inode, u8* src, usize offset, us
         memcpy(block->data + block_offset, src, bytes_to_write);
         cache->sync(ctx, block);
         cache->release(block);
+        // keep the cached page (if any) in step with the block
+        if (page) memcpy(page + offset % PAGE_SIZE, src, bytes_to_write);
         src += bytes_to_write;
         offset += bytes_to_write;
         bytes_written += bytes_to_write;
@@ -405,8 +558,32 @@ InodeTree inodes = {
     .lookup = inode_lookup,
     .insert = inode_insert,
     .remove = inode_remove,
+    .get_page = inode_get_page,
+    .sync_page = inode_sync_page,
 };
 
+void get_page_cache_stat(struct page_cache_stat* st) {
+    memset(st, 0, sizeof(*st));
+    read_lock(&list_lock);
+    _for_in_list(p, &head) {
+        if (p == &head) continue;
+        Inode* inode = container_of(p, Inode, node);
+        // 不能在这里睡眠等 inode 锁，用 page_lock 挡住缓存页的装入、替换与释放
+        acquire_spinlock(&inode->page_lock);
+        u32 dirty = __atomic_load_n(&inode->dirty_pages, __ATOMIC_RELAXED);
+        for (usize i = 0; i < INODE_MAX_PAGES; i++) {
+            if (inode->pages[i] == NULL) continue;
+            st->cached++;
+            st->mapped += get_page_ref((u64)inode->pages[i]) - 1;
+            if (dirty & (1u << i)) st->dirty++;
+        }
+        release_spinlock(&inode->page_lock);
+    }
+    read_unlock(&list_lock);
+    st->hit = __atomic_load_n(&pc_hit, __ATOMIC_RELAXED);
+    st->miss = __atomic_load_n(&pc_miss, __ATOMIC_RELAXED);
+}
+
 /**
     @brief read the next path element from `path` into `name`.
     @param[out] name next path element.
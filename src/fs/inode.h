@@ -1,4 +1,5 @@
 #pragma once
+#include <aarch64/mmu.h>
 #include <common/list.h>
 #include <common/rc.h>
 #include <common/spinlock.h>
@@ -15,6 +16,11 @@
  */
 #define ROOT_INODE_NO 1
 
+/**
+    @brief the number of 4KB pages needed to hold the largest file.
+ */
+#define INODE_MAX_PAGES ((INODE_MAX_BYTES + PAGE_SIZE - 1) / PAGE_SIZE)
+
 /**
     @brief an inode in memory.
 
@@ -59,8 +65,55 @@ typedef struct {
         @brief the real in-memory copy of the inode on disk.
      */
     InodeEntry entry; 
+
+    /**
+        @brief the page cache of this inode.
+        `pages[i]` caches bytes [i * 4KB, (i + 1) * 4KB) of the file, or is NULL.
+        The cache holds one `pages_ref` reference on each page; mappings
+        (exec, mmap) take their own with `vmmap`.
+        @note changed only with both `lock` and `page_lock` held, so holding
+        either one is enough to read it.
+     */
+    void* pages[INODE_MAX_PAGES];
+
+    /**
+        @brief guards `pages` for readers that cannot sleep on `lock`
+        (the page cache statistics).
+     */
+    SpinLock page_lock;
+
+    /**
+        @brief bitmap of cached pages modified through a shared mapping and
+        not yet written back to the blocks.
+        @note protected by `lock`.
+     */
+    u32 dirty_pages;
+
+    /**
+        @brief number of page table entries that map cached page i writable
+        through a shared mapping. Such a page can be written again without a
+        fault, so write-back keeps it in `dirty_pages` while this is nonzero.
+        @note protected by `lock`.
+     */
+    u16 shared_writers[INODE_MAX_PAGES];
+
+    /**
+        @brief bitmap of cached pages that have been mapped as program text.
+        A write through `inodes.write` gives the cache a fresh copy of such a
+        page first, so running programs keep executing the old contents.
+        @note protected by `lock`.
+     */
+    u32 text_pages;
 } Inode;
 
+struct page_cache_stat {
+    usize cached;  // pages in all page caches
+    usize mapped;  // page table entries pointing at cached pages
+    usize dirty;
+    usize hit;
+    usize miss;
+};
+
 /**
     @brief interface of inode layer.
  */
@@ -198,8 +251,30 @@ typedef struct {
         @throw panic if `inode` is not a directory.
      */
     void (*remove)(OpContext* ctx, Inode* inode, usize index);
+
+    /**
+        @brief get the page cache page holding bytes [index * 4KB, (index + 1) * 4KB)
+        of `inode`, reading it from disk if it is not cached yet.
+        Bytes past the end of the file are zero.
+        @param dirty mark the page as modified through a shared mapping, so
+        that `sync_page` writes it back.
+        @return the page (kernel address), or NULL if no page could be
+        allocated (the cache is left unchanged). Map it with `vmmap` to keep
+        it alive after the inode lock is released.
+        @note caller must hold the lock of `inode`.
+     */
+    void* (*get_page)(Inode* inode, usize index, bool dirty);
+
+    /**
+        @brief write a dirty page back to its blocks through the log, within
+        the current file size. Does nothing if the page is clean.
+        @note caller must hold the lock of `inode`.
+     */
+    void (*sync_page)(OpContext* ctx, Inode* inode, usize index);
 } InodeTree;
 
+void get_page_cache_stat(struct page_cache_stat* st);
+
 /**
     @brief the global inode layer instance.
  */
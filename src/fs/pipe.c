@@ -6,10 +6,10 @@
 
 void init_pipe(Pipe *pi) {
     /* (Final) TODO BEGIN */
-    init_spinlock(&pi->lock);
+    init_spinlock(&pi->lock, "pipe");
     pi->readopen = 1; pi->writeopen = 1;
     pi->nread = 0; pi->nwrite = 0;
-    init_sem(&pi->rlock, 0); init_sem(&pi->wlock, 0);
+    init_wait_queue(&pi->rwait); init_wait_queue(&pi->wwait);
     /* (Final) TODO END */
 }
 
@@ -52,8 +52,8 @@ bad:
 void pipe_close(Pipe *pi, int writable) {
     /* (Final) TODO BEGIN */
     acquire_spinlock(&pi->lock);
-    if (writable) { pi->writeopen = 0; post_sem(&pi->rlock); } // 通知等待读取的进程
-    else { pi->readopen=0; post_sem(&pi->wlock); } // 通知等待写入的进程
+    if (writable) { pi->writeopen = 0; _wake_up_all(&pi->rwait); } // 通知所有等待读取的进程
+    else { pi->readopen=0; _wake_up_all(&pi->wwait); } // 通知所有等待写入的进程
     release_spinlock(&pi->lock);
     // 如果读写端都已关闭，释放管道的内存
     if (pi->readopen==0 && pi->writeopen==0) kfree((void*) pi);
@@ -70,14 +70,15 @@ int pipe_write(Pipe *pi, u64 addr, int n) {
                 release_spinlock(&pi->lock);
                 return -1; // 写失败
             }
-            post_sem(&pi->rlock); // 通知可能有进程在读取
-            release_spinlock(&pi->lock);
-            unalertable_wait_sem(&pi->wlock); // 等待可写信号量
+            _wake_up_one(&pi->rwait); // 通知可能有进程在读取
+            ASSERT(_sleep_on(&pi->wwait, &pi->lock, true, false)); // 等待可写
         }
         // 写入数据到管道缓冲区
         pi->data[pi->nwrite++ % PIPE_SIZE] = *((char *)addr + i);
     }
-    post_sem(&pi->rlock);
+    _wake_up_one(&pi->rwait);
+    // 读写者都是独占等待，一次只叫醒一个；还有空间就把机会传给下一个写者
+    if (pi->nwrite != pi->nread + PIPE_SIZE) _wake_up_one(&pi->wwait);
     release_spinlock(&pi->lock);
     return n;
     /* (Final) TODO END */
@@ -92,15 +93,15 @@ int pipe_read(Pipe *pi, u64 addr, int n) {
             release_spinlock(&pi->lock);
             return -1; // 读取失败
         }
-        release_spinlock(&pi->lock);
-        unalertable_wait_sem(&pi->rlock); // 等待可读信号量
+        ASSERT(_sleep_on(&pi->rwait, &pi->lock, true, false)); // 等待可读
     }
     int i;
     for (i = 0; i < n; i++){
         if (pi->nread == pi->nwrite) break; // 没有更多数据可读
         *((char *)addr + i) = pi->data[pi->nread++ % PIPE_SIZE];
     }
-    post_sem(&pi->wlock); // 通知可能有进程等待写入
+    _wake_up_one(&pi->wwait); // 通知可能有进程等待写入
+    if (pi->nread != pi->nwrite) _wake_up_one(&pi->rwait); // 还有数据，交给下一个读者
     release_spinlock(&pi->lock);
     return i;
     /* (Final) TODO END */
@@ -9,7 +9,7 @@
 
 typedef struct pipe {
     SpinLock lock;
-    Semaphore wlock, rlock;
+    WaitQueue wwait, rwait;  // 等待写入/读取的进程，由 lock 保护
     char data[PIPE_SIZE];
     u32 nread; // Number of bytes read
     u32 nwrite; // Number of bytes written
@@ -67,7 +67,7 @@ struct console cons;
 
 void console_init() {
     /* (Final) TODO BEGIN */
-    init_spinlock(&(cons.lock));
+    init_spinlock(&(cons.lock), "console");
     init_sem(&(cons.sem), 0);
     /* (Final) TODO END */
 }
@@ -19,6 +19,9 @@ NO_RETURN void idle_entry() {
         yield();
         if (panic_flag)
             break;
+        // 没有可运行的进程：趁空闲补充预清零页池，再进入 wfi
+        refill_zeroed_pages();
+        idle_enter();
         arch_with_trap {
             arch_wfi();
         }
@@ -53,12 +56,12 @@ void kernel_entry() {
      */
     Proc *p = thisproc();
     p->cwd = inodes.root;
-    struct section *sec = kalloc(sizeof(struct section));
+    struct section *sec = alloc_section();
     sec->flags = ST_TEXT;
     sec->begin = (u64)icode - PAGE_BASE((u64)icode);
     sec->end = sec->begin + (u64)eicode - (u64)icode;
-    init_sleeplock(&(sec->sleeplock));
-    _insert_into_list(&p->pgdir.section_head, &sec->stnode);
+    init_sleeplock(&(sec->sleeplock), "section");
+    insert_section(&p->pgdir, sec);
     u64 va = 0;
     for(u64 ka = PAGE_BASE((u64)icode); ka <= (u64)eicode; ka += PAGE_SIZE) {
         vmmap(&(p->pgdir), va, (void *)ka, PTE_USER_DATA | PTE_RO);
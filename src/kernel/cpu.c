@@ -8,6 +8,10 @@
 
 struct cpu cpus[NCPU];
 
+struct mcs_node *this_cpu_mcs_nodes() {
+    return cpus[cpuid()].mcs_nodes;
+}
+
 static bool __timer_cmp(rb_node lnode, rb_node rnode) {
     i64 d = container_of(lnode, struct timer, _node)->_key -
             container_of(rnode, struct timer, _node)->_key;
@@ -18,14 +22,16 @@ static bool __timer_cmp(rb_node lnode, rb_node rnode) {
     return false;
 }
 
+// 只为最近的一个定时器设置时钟；没有定时器时关掉时钟，空闲的 CPU 不会被无谓地唤醒
 static void __timer_set_clock() {
     auto node = _rb_first(&cpus[cpuid()].timer);
     if (!node) {
-        reset_clock(10);
+        disable_timer();
         return;
     }
     auto t1 = container_of(node, struct timer, _node)->_key;
     auto t0 = get_timestamp_ms();
+    enable_timer();
     if (t1 <= t0)
         reset_clock(0);
     else
@@ -33,7 +39,7 @@ static void __timer_set_clock() {
 }
 
 static void timer_clock_handler() {
-    reset_clock(10);
+    __timer_set_clock();
     while (1) {
         auto node = _rb_first(&cpus[cpuid()].timer);
         if (!node)
@@ -51,14 +57,6 @@ void init_clock_handler() {
     set_clock_handler(&timer_clock_handler);
 }
 
-static struct timer hello_timer[4];
-
-static void hello(struct timer *t) {
-    // printk("CPU %lld: living\n", cpuid());
-    t->data++;
-    set_cpu_timer(&hello_timer[cpuid()]);
-}
-
 void set_cpu_timer(struct timer *timer)
 {
     timer->triggered = false;
@@ -85,9 +83,7 @@ void set_cpu_on()
     init_clock();
     cpus[cpuid()].online = true;
     printk("CPU %lld: hello\n", cpuid());
-    hello_timer[cpuid()].elapse = 5000;
-    hello_timer[cpuid()].handler = hello;
-    set_cpu_timer(&hello_timer[cpuid()]);
+    __timer_set_clock();
 }
 
 void set_cpu_off()
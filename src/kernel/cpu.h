@@ -1,18 +1,54 @@
 #pragma once
 #include <kernel/proc.h>
+#include <kernel/sched.h>
 #include <common/rbtree.h>
+#include <common/spinlock.h>
 #define NCPU 4
 
+struct sched_stat {
+    u64 switches;  // 上下文切换次数
+    u64 steals;  // 本 CPU 将要空闲时从别的 CPU 偷来的进程数
+    u64 balances;  // 周期性负载均衡拉过来的进程数
+    u64 wake_migrations;  // 唤醒时被放到别的 CPU 上的次数
+    u64 lock_acquire;  // 本 CPU 队列锁被获取的次数（含其它 CPU 来拿）
+    u64 lock_contended;  // 其中第一次没拿到、需要自旋的次数
+    u64 idle_wakeups;  // 空闲时从 wfi 醒来的次数
+    u64 idle_ns;  // 在 wfi 中度过的时间
+    u64 ipi_sent;  // 别的 CPU 发给本 CPU 的重新调度 IPI
+    u64 ipi_received;
+    u64 wakeup_preempts;  // 被唤醒的进程抢占当前进程的次数
+    u64 fp_traps;  // 用户进程第一次用 FP/SIMD 时的陷入
+    u64 fp_restores;  // 其中需要从内存装入寄存器的次数（寄存器属于别的进程）
+    u64 fp_saves;  // 切换走时保存 FP/SIMD 寄存器的次数
+};
+
 struct sched {
     // TODO: customize your sched info
     Proc* thisproc;  // cpu当前正在运行的进程
     Proc* idle;  // 每个cpu都有一个idle进程（记录main函数的上下文自然演化而来）
-};
+    SpinLock lock;  // 保护本 CPU 的运行队列，以及属于本 CPU 的进程的 state
+    struct rb_root_ rq;  // 本 CPU 上 RUNNABLE 的普通进程按 vruntime 排序，不含正在运行的进程
+    ListNode rt_rq[SCHED_RT_PRIO_LEVELS];  // RUNNABLE 的实时进程，每个优先级一个 FIFO 链表
+    u64 rt_bitmap[2];  // rt_rq[i] 非空时第 i 位为 1
+    u64 min_vruntime;  // 单调增长，新进程与睡醒进程的 vruntime 以它为基准
+    int nr_queued;  // rq 中的进程数
+    int nr_running;  // 属于本 CPU 的非 idle 进程数：nr_queued 加上正在运行的那个
+    u64 cfs_load;  // 其中普通进程（含 SCHED_IDLE）的权重之和
+    int ticks;
+    bool need_balance;
+    bool tick_stopped;  // 本 CPU 至多一个进程，没有开调度时钟
+    bool need_resched;  // 本 CPU 上唤醒了更该运行的进程，返回用户态前让出
+    bool ipi_pending;  // 已经发了 IPI_RESCHED 但本 CPU 还没处理
+    u64 idle_since;  // 进入 wfi 的时间戳，醒来后清零
+    Proc* push_proc;  // 刚让出本 CPU、但 cpus_allowed 中已没有本 CPU 的进程，等待 push_migrating
+    struct sched_stat stat;
+} __attribute__((aligned(64)));
 
 struct cpu {
     bool online;
     struct rb_root_ timer;
     struct sched sched;
+    struct mcs_node mcs_nodes[MCS_NODES_PER_CPU];  // MCSLock 的等待节点，见 common/spinlock.h
 };
 
 extern struct cpu cpus[NCPU];
@@ -33,4 +69,6 @@ void set_cpu_on();
 void set_cpu_off();
 
 void set_cpu_timer(struct timer *timer);
-void cancel_cpu_timer(struct timer *timer);
\ No newline at end of file
+void cancel_cpu_timer(struct timer *timer);
+
+void get_sched_stat(int cpu, struct sched_stat *st);
@@ -9,15 +9,34 @@
 #include <kernel/mem.h>
 #include <kernel/paging.h>
 #include <kernel/printk.h>
+#include <kernel/fpsimd.h>
+#include <aarch64/intrinsic.h>
 #include <aarch64/trap.h>
 #include <fs/file.h>
 #include <fs/inode.h>
 
 extern int fdalloc(struct file* f);
 
+// 从 execve 开始到新程序第一次系统调用（musl 启动代码里的 set_tid_address）的时间，
+// 包括了新程序开头执行时的所有缺页，用来衡量按需加载对启动延迟的影响
+static u64 exec_cnt, exec_cycles, exec_last;
+
+void exec_latency_record(u64 cycles) {
+	__atomic_fetch_add(&exec_cnt, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&exec_cycles, cycles, __ATOMIC_RELAXED);
+	__atomic_store_n(&exec_last, cycles, __ATOMIC_RELAXED);
+}
+
+void get_exec_stat(u64 *cnt, u64 *cycles, u64 *last) {
+	*cnt = __atomic_load_n(&exec_cnt, __ATOMIC_RELAXED);
+	*cycles = __atomic_load_n(&exec_cycles, __ATOMIC_RELAXED);
+	*last = __atomic_load_n(&exec_last, __ATOMIC_RELAXED);
+}
+
 int execve(const char *path, char *const argv[], char *const envp[]) {
 	/* (Final) TODO BEGIN */
 	// printk("------ exec start ------\n");
+	u64 exec_start = get_timestamp();
 	OpContext ctx;
 	bcache.begin_op(&ctx);
 	Inode* inode_p = namei(path, &ctx);
@@ -30,6 +49,17 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 	    return -1;
 	}
 	ASSERT(strncmp((const char*)elf_header.e_ident, ELFMAG, 4)==0);
+	// 各 PT_LOAD 段都通过这个 file 在缺页时按需读入
+	struct file* elf_file = file_alloc();
+	if(elf_file == NULL) {
+		inodes.unlock(inode_p); inodes.put(&ctx, inode_p); bcache.end_op(&ctx);
+	    return -1;
+	}
+	elf_file->type = FD_INODE;
+	elf_file->ip = inodes.share(inode_p);
+	elf_file->readable = true;
+	elf_file->writable = false;
+	elf_file->off = 0;
 	struct pgdir* exec_pgdir = kalloc(sizeof(struct pgdir));
 	init_pgdir(exec_pgdir);
 	Elf64_Phdr program_header;
@@ -39,6 +69,7 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 		if(inodes.read(inode_p, (u8*)(&program_header), ph_off, Phdr_size) < Phdr_size){
 			inodes.unlock(inode_p); inodes.put(&ctx, inode_p);
 			bcache.end_op(&ctx); free_pgdir(exec_pgdir);
+			file_close(elf_file);
 			return -1;
 		}
 		ph_off += Phdr_size;
@@ -57,74 +88,48 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 		else {
 			inodes.unlock(inode_p); inodes.put(&ctx, inode_p);
 			bcache.end_op(&ctx); free_pgdir(exec_pgdir);
+			file_close(elf_file);
 			return -1;
 		}
 		// insert into new section
-		struct section *st = kalloc(sizeof(struct section));
-		memset(st, 0, sizeof(struct section));
+		struct section *st = alloc_section();
 		st->begin = program_header.p_vaddr;
         st->end = end;
 		if(end > max_end) max_end = end;
 		st->flags = section_flag;
-		init_sleeplock(&(st->sleeplock));
-		_insert_into_list(&(exec_pgdir->section_head), &(st->stnode));
-		// load
-		// (1) allocate memory, va region [vaddr, vaddr+filesz)
-		// (2) copy [offset, offset + filesz) of file to va [vaddr, vaddr+filesz) of memory
-		// copy page by page
-		u64 file_sz = program_header.p_filesz;
-		u64 off = program_header.p_offset;
-		u64 va = program_header.p_vaddr;
-		while(file_sz > 0) {
-			u64 va0 = PAGE_BASE(va);
-			u64 sz = MIN(PAGE_SIZE - (va-va0), file_sz);
-			void* dest = kalloc_page();
-			memset(dest, 0, PAGE_SIZE);
-			u64 pte_flag = PTE_USER_DATA;
-			if(section_flag == ST_TEXT) pte_flag |= PTE_RO;
-			vmmap(exec_pgdir, va0, dest, pte_flag);
-			if(inodes.read(inode_p, (u8*)(dest+(va-va0)), off, sz) != sz){
-				inodes.unlock(inode_p); inodes.put(&ctx, inode_p);
-				bcache.end_op(&ctx); free_pgdir(exec_pgdir);
-				return -1;
-			}
-			file_sz -= sz; off += sz; va += sz;
-		}
-		// for bss
-		// [p_vaddr+p_filesz, p_vaddr+p_memsz) the bss section which is required to set to 0
-		// COW by using the zero page
-		if(va != PAGE_BASE(va)) va = PAGE_BASE(va) + PAGE_SIZE;
-		if((section_flag == ST_FILE) && (program_header.p_memsz > (va - program_header.p_vaddr))){
-			void* dest = get_zero_page();
-			file_sz = program_header.p_memsz - (va - program_header.p_vaddr);
-			while(file_sz > 0) {
-				u64 va0 = PAGE_BASE(va);
-				u64 sz = MIN(PAGE_SIZE - (va-va0), file_sz);
-				vmmap(exec_pgdir, va0, dest, PTE_USER_DATA | PTE_RO);
-				file_sz -= sz; va += sz;
-			}
-		}
+		init_sleeplock(&(st->sleeplock), "section");
+		insert_section(exec_pgdir, st);
+		// 不在这里读入段的内容：[p_vaddr, p_vaddr + p_filesz) 来自文件的 p_offset 处，
+		// 第一次访问时由 pgfault_handler 从 st->fp 读入；数据段剩下的 bss 部分缺页时分配零页。
+		st->fp = file_dup(elf_file);
+		st->offset = program_header.p_offset;
+		st->length = program_header.p_filesz;
+		if(section_flag == ST_TEXT) map_cached_text(exec_pgdir, st);
 	}
 	inodes.unlock(inode_p);
 	inodes.put(&ctx, inode_p);
 	bcache.end_op(&ctx);
+	file_close(elf_file);
 
 	// create user stack
 	u64 stack_page_size = 10;
 	u64 sp = PAGE_BASE(max_end) + PAGE_SIZE + stack_page_size * PAGE_SIZE;
-	for(u64 i=1;i<=stack_page_size;++i){
-		void* p = kalloc_page();
-		memset(p, 0, PAGE_SIZE);
-		vmmap(exec_pgdir, sp-i*PAGE_SIZE, p, PTE_USER_DATA);
-	}
-	// add stack to section
-	struct section *stack_st = kalloc(sizeof(struct section));
-	memset(stack_st, 0, sizeof(struct section));
+	// add stack to section, before mapping its pages so that free_pgdir releases them on failure
+	struct section *stack_st = alloc_section();
 	stack_st->flags = 1024;
 	stack_st->begin = sp - stack_page_size*PAGE_SIZE;
 	stack_st->end = sp;
-	init_sleeplock(&(stack_st->sleeplock));
-	_insert_into_list(&(exec_pgdir->section_head), &(stack_st->stnode));
+	init_sleeplock(&(stack_st->sleeplock), "section");
+	insert_section(exec_pgdir, stack_st);
+	for(u64 i=1;i<=stack_page_size;++i){
+		void* p = kalloc_zeroed_page();
+		if(p == NULL){
+			free_pgdir(exec_pgdir);
+			kfree(exec_pgdir);
+			return -1;
+		}
+		vmmap(exec_pgdir, sp-i*PAGE_SIZE, p, PTE_USER_DATA);
+	}
 	// fill in stack
 	struct Proc* this_proc = thisproc();
 	// leave more room in case stack continue to pop and page fault
@@ -176,6 +181,8 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
 	_detach_from_list(&(exec_pgdir->section_head));
 	kfree(exec_pgdir);
 	attach_pgdir(&(this_proc->pgdir));
+	fpsimd_exec(this_proc);
+	this_proc->exec_start = exec_start;
 	// printk("------ exec over ------\n");
 	return 0;
 	/* (Final) TODO END */
@@ -0,0 +1,60 @@
+#include <aarch64/intrinsic.h>
+#include <common/string.h>
+#include <kernel/cpu.h>
+#include <kernel/fpsimd.h>
+#include <kernel/sched.h>
+
+static struct {
+    Proc *owner;  // 寄存器里是它的状态（它的 fpsimd_cpu 也指向本 CPU 时才算数）
+    bool enabled;  // 当前进程可以直接用 FP/SIMD，也就是寄存器可能比 owner->fpsimd 新
+} fp_cpu[NCPU];
+
+static INLINE bool fpsimd_live(Proc *p, int cpu) {
+    return fp_cpu[cpu].owner == p && p->fpsimd_cpu == cpu;
+}
+
+static void fpsimd_enable(int cpu, bool enable) {
+    if (fp_cpu[cpu].enabled == enable) return;
+    fp_cpu[cpu].enabled = enable;
+    arch_set_cpacr(enable ? CPACR_FPEN_NO_TRAP : CPACR_FPEN_TRAP_EL0);
+}
+
+void fpsimd_switch(Proc *prev, Proc *next) {
+    int cpu = cpuid();
+    if (fp_cpu[cpu].enabled) {
+        // prev 这一次运行中用过 FP/SIMD；保存后寄存器仍然有效，prev 回来时不用重新装入
+        fpsimd_save_regs(&prev->fpsimd);
+        cpus[cpu].sched.stat.fp_saves++;
+    }
+    fpsimd_enable(cpu, fpsimd_live(next, cpu));
+}
+
+void fpsimd_trap() {
+    Proc *p = thisproc();
+    int cpu = cpuid();
+    cpus[cpu].sched.stat.fp_traps++;
+    fpsimd_enable(cpu, true);
+    if (!fpsimd_live(p, cpu)) {
+        // 原来的 owner 被切换走时已经保存过了，直接覆盖
+        fpsimd_load_regs(&p->fpsimd);
+        fp_cpu[cpu].owner = p;
+        p->fpsimd_cpu = cpu;
+        cpus[cpu].sched.stat.fp_restores++;
+    }
+}
+
+void fpsimd_fork(Proc *child, Proc *parent) {
+    if (fp_cpu[cpuid()].enabled)
+        fpsimd_save_regs(&parent->fpsimd);
+    memcpy(&child->fpsimd, &parent->fpsimd, sizeof(struct fpsimd_state));
+    child->fpsimd_cpu = -1;
+}
+
+void fpsimd_exec(Proc *p) {
+    int cpu = cpuid();
+    memset(&p->fpsimd, 0, sizeof(struct fpsimd_state));
+    p->fpsimd_cpu = -1;
+    if (fp_cpu[cpu].owner == p)
+        fp_cpu[cpu].owner = NULL;
+    fpsimd_enable(cpu, false);
+}
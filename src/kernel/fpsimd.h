@@ -0,0 +1,19 @@
+#pragma once
+#include <kernel/proc.h>
+
+// 用户进程的 FP/SIMD 寄存器按需切换。每个 CPU 记着寄存器里是哪个进程的状态（owner），
+// 切换到 owner 时直接放行 FP/SIMD；切换到别的进程时关掉 EL0 的 FP/SIMD，进程第一次
+// 用到时陷入内核，再从 Proc 中装入。寄存器只在进程这一次运行中用过 FP/SIMD 时才在切换走时保存，
+// 不用 FP/SIMD 的进程没有任何额外开销。
+
+// called by sched() before switching from prev to next
+void fpsimd_switch(Proc *prev, Proc *next);
+// EL0 FP/SIMD access trap
+void fpsimd_trap();
+// the child starts with a copy of the parent's current FP/SIMD state
+void fpsimd_fork(Proc *child, Proc *parent);
+// a new program starts with zeroed FP/SIMD state
+void fpsimd_exec(Proc *p);
+
+void fpsimd_save_regs(struct fpsimd_state *st);
+void fpsimd_load_regs(const struct fpsimd_state *st);
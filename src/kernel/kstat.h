@@ -0,0 +1,32 @@
+#pragma once
+
+// 统计类系统调用拷给用户的结构体，内核和用户程序（bench、mmaptest）共用这一份定义，
+// 只用基本类型，不依赖内核的头文件。改动字段时两边一起重新编译，不会再出现大小不一致。
+
+// SYS_execstat
+struct exec_stat {
+    unsigned long long exec_cnt;
+    unsigned long long exec_last_ns;  // execve 到第一次系统调用，最近一次
+    unsigned long long exec_avg_ns;
+    unsigned long long pgfault_cnt;
+    unsigned long long pgfault_avg_ns;
+    unsigned long long fault_around;  // fault-around 顺带映射的页数
+    unsigned long long text_shared;  // 映射页缓存中共享页的代码页数（累计）
+    unsigned long long text_private;  // 私有读入的代码页数（累计）
+    unsigned long long pagecache_pages;  // 页缓存中的页数
+    unsigned long long pagecache_mapped;  // 指向页缓存页的页表项数
+    unsigned long long mmap_fault;  // mmap 段的缺页数
+    unsigned long long mmap_dirtied;  // 共享映射中被写脏的页数（写保护缺页）
+    unsigned long long mmap_writeback;  // msync/munmap/exit 写回的脏页数
+};
+
+// SYS_asidstat
+struct asid_stat {
+    unsigned long long alloc;      // ASID allocations (first attach, or after a rollover)
+    unsigned long long rollover;   // generation rollovers, each costs every CPU one local TLB flush
+    unsigned long long flush_va;   // pages invalidated by VA + ASID
+    unsigned long long flush_asid; // whole-ASID invalidations
+    unsigned long long flush_local;     // shootdowns done with local tlbi only
+    unsigned long long flush_broadcast; // shootdowns that had to broadcast (another CPU runs the pgdir)
+    unsigned long long flush_deferred;  // CPUs left to flush the ASID on their next attach
+};
@@ -1,80 +1,340 @@
+#include <aarch64/intrinsic.h>
 #include <aarch64/mmu.h>
 #include <common/rc.h>
 #include <common/spinlock.h>
 #include <driver/memlayout.h>
 #include <kernel/mem.h>
+#include <kernel/cpu.h>
 #include <common/list.h>
 #include <common/string.h>
 
 #define NULL 0
 extern char end[];
-#define phy_start PAGE_BASE((u64)&end)
-#define phy_end P2K(PHYSTOP)
+#define phy_start round_up((u64)&end, PAGE_SIZE)
+#define phy_end (P2K(PHYSTOP) - PAGES_REF_SIZE)
 #define PAGES_REF_SIZE (sizeof(struct page))*(PHYSTOP/PAGE_SIZE)
 
-RefCount kalloc_page_cnt;
-RefCount _left_page_cnt;
+// 每个 CPU 的页缓存（magazine）。kalloc_page/kfree_page 只操作本 CPU 的 magazine，
+// 空了就从伙伴系统批量取 PAGE_MAG_BATCH 个 0 阶页，满了就批量还回一半，
+// 这样伙伴系统的锁和计数只在批量搬运时才会被碰到。
+#define PAGE_MAG_SIZE 64
+#define PAGE_MAG_BATCH (PAGE_MAG_SIZE / 2)
+
+struct page_magazine {
+    usize cnt;
+    void* pages[PAGE_MAG_SIZE];
+    isize alloc_cnt;  // 本 CPU 分配出去的页数减去本 CPU 释放的页数
+} __attribute__((aligned(64)));  // 独占 cache line，避免 CPU 之间的伪共享
+
+// 伙伴系统：free_area[k] 链着所有空闲的 2^k 页块，链表节点就放在空闲块的第一页里。
+// 块的“伙伴”是物理页号异或 2^k 得到的那一块，释放时若伙伴也空闲且同阶就合并。
+struct free_area {
+    ListNode head;
+    usize nr_free;
+};
+
+static struct page_magazine magazines[NCPU];
+static SpinLock page_pool_lock;  // 保护 free_area、buddy_stat 与 _left_page_cnt
+static struct free_area free_area[BUDDY_MAX_ORDER + 1];
+static struct buddy_stat buddy_stat;
+static usize _left_page_cnt;  // 伙伴系统中空闲的页数（不含各 magazine 中缓存的页）
+static u64 start_pfn, end_pfn;  // 伙伴系统管理的物理页号范围 [start_pfn, end_pfn)
+// 每个 CPU 一个预先清零的页池，只由本 CPU 在 idle_entry 中补充、在 kalloc_zeroed_page 中取用，
+// 和 magazine 一样不需要锁。池中的页不计入 kalloc_page_cnt，但计入 left_page_cnt。
+#define ZERO_POOL_SIZE 64
+#define ZERO_REFILL_BATCH 16
+
+struct zero_pool {
+    usize cnt;
+    void* pages[ZERO_POOL_SIZE];
+    struct zero_pool_stat stat;  // 不用其中的 pooled
+} __attribute__((aligned(64)));
+
+static struct zero_pool zero_pools[NCPU];
+static usize dc_zva_size;  // DC ZVA 每次清零的字节数，0 表示不能用 DC ZVA
 void* zero_page_ptr;
-SpinLock kernel_mem_lock;
-// 页队列
-QueueNode* nodes;
+MCSLock kernel_mem_lock;  // 保护 free[]
 struct page* pages_ref;
 // 空闲块队列。 free[i] 表示大小为 (i+1) * BLOCK_SIZE 的空闲块队列
 // free[i] 中每个元素是一个队列节点，存储指向可用的空闲块的指针。
 static QueueNode* free[256];
 
-// 初始化所有page插入队列。EXTMEM ⾄ PHYSTOP 这段物理地址内的空间即为我们的物理内存。
-// 但考虑到我们的内核代码也会置于内存中，实际可供分配的物理内存空间为 end ⾄ PHYSTOP。
+static INLINE u64 pfn_of(void* ka) {
+    return K2P(ka) / PAGE_SIZE;
+}
+
+static INLINE void* pfn_to_ka(u64 pfn) {
+    return (void*)P2K(pfn * PAGE_SIZE);
+}
+
+static INLINE struct page* page_of(void* ka) {
+    return &pages_ref[pfn_of(ka)];
+}
+
+// 从 free_area 中取出一个 2^order 页的块，不够就把更大的块逐级对半拆开。调用者持有 page_pool_lock。
+static void* buddy_alloc(int order) {
+    int k = order;
+    while (k <= BUDDY_MAX_ORDER && free_area[k].nr_free == 0)
+        k++;
+    if (k > BUDDY_MAX_ORDER) {
+        buddy_stat.alloc_fail++;
+        return NULL;
+    }
+    ListNode* node = free_area[k].head.next;
+    _detach_from_list(node);
+    free_area[k].nr_free--;
+    u64 pfn = pfn_of(node);
+    pages_ref[pfn].buddy_free = false;
+    while (k > order) {
+        // 留下前一半，后一半作为空闲块挂到低一阶
+        k--;
+        u64 buddy = pfn + (1ull << k);
+        pages_ref[buddy].order = k;
+        pages_ref[buddy].buddy_free = true;
+        _insert_into_list(&free_area[k].head, (ListNode*)pfn_to_ka(buddy));
+        free_area[k].nr_free++;
+        buddy_stat.split++;
+    }
+    pages_ref[pfn].order = order;
+    _left_page_cnt -= 1ull << order;
+    buddy_stat.alloc[order]++;
+    return pfn_to_ka(pfn);
+}
+
+// 把 2^order 页的块还给 free_area，并尽可能与伙伴合并。调用者持有 page_pool_lock。
+static void buddy_free(void* p, int order) {
+    u64 pfn = pfn_of(p);
+    _left_page_cnt += 1ull << order;
+    buddy_stat.free[order]++;
+    while (order < BUDDY_MAX_ORDER) {
+        u64 buddy = pfn ^ (1ull << order);
+        // 只有空闲块的首页才会标记 buddy_free，越界的伙伴一定不在 free_area 里
+        if (buddy < start_pfn || buddy >= end_pfn)
+            break;
+        if (!pages_ref[buddy].buddy_free || pages_ref[buddy].order != order)
+            break;
+        _detach_from_list((ListNode*)pfn_to_ka(buddy));
+        free_area[order].nr_free--;
+        pages_ref[buddy].buddy_free = false;
+        pfn &= ~(1ull << order);
+        order++;
+        buddy_stat.merge++;
+    }
+    pages_ref[pfn].order = order;
+    pages_ref[pfn].buddy_free = true;
+    _insert_into_list(&free_area[order].head, (ListNode*)pfn_to_ka(pfn));
+    free_area[order].nr_free++;
+}
+
+// 初始化伙伴系统。EXTMEM ⾄ PHYSTOP 这段物理地址内的空间即为我们的物理内存。
+// 但考虑到我们的内核代码也会置于内存中，实际可供分配的物理内存空间为 end ⾄ PHYSTOP，
+// 其中最高处的 PAGES_REF_SIZE 字节留给 pages_ref。
+// 从低地址起每次放入能对齐、且不越界的最大块。
 void init_page() {
-    for(u64 p = PAGE_BASE(end); p < P2K(PHYSTOP)-PAGES_REF_SIZE; p = p + 4096) {
-        add_to_queue(&nodes, (void*)p);
-        increment_rc(&_left_page_cnt);
+    start_pfn = K2P(phy_start) / PAGE_SIZE;
+    end_pfn = K2P(phy_end) / PAGE_SIZE;
+    for (int k = 0; k <= BUDDY_MAX_ORDER; k++) {
+        init_list_node(&free_area[k].head);
+        free_area[k].nr_free = 0;
+    }
+    for (u64 pfn = start_pfn; pfn < end_pfn; pfn++) {
+        pages_ref[pfn].order = 0;
+        pages_ref[pfn].buddy_free = false;
+    }
+    for (u64 pfn = start_pfn; pfn < end_pfn;) {
+        int k = BUDDY_MAX_ORDER;
+        while (k > 0 && ((pfn & ((1ull << k) - 1)) || pfn + (1ull << k) > end_pfn))
+            k--;
+        pages_ref[pfn].order = k;
+        pages_ref[pfn].buddy_free = true;
+        _insert_into_list(&free_area[k].head, (ListNode*)pfn_to_ka(pfn));
+        free_area[k].nr_free++;
+        _left_page_cnt += 1ull << k;
+        pfn += 1ull << k;
     }
 }
 
 void kinit() {
-    init_rc(&kalloc_page_cnt);
-    init_rc(&_left_page_cnt);
-    init_spinlock(&kernel_mem_lock);
+    _left_page_cnt = 0;
+    init_spinlock(&page_pool_lock, "page_pool_lock");
+    init_mcs_lock(&kernel_mem_lock, "kernel_mem_lock");
+    memset(magazines, 0, sizeof(magazines));
+    memset(&buddy_stat, 0, sizeof(buddy_stat));
+    memset(zero_pools, 0, sizeof(zero_pools));
+    u64 dczid = arch_get_dczid();
+    dc_zva_size = (dczid & (1 << 4)) ? 0 : 4ull << (dczid & 0xf);
     zero_page_ptr = NULL;
-    pages_ref = (struct page*)(P2K(PHYSTOP)-PAGES_REF_SIZE);
+    pages_ref = (struct page*)phy_end;
     init_page();
     zero_page_ptr = kalloc_page();
     memset(zero_page_ptr, 0, PAGE_SIZE);
-    u64 page_num = ((u64)K2P(zero_page_ptr))/PAGE_SIZE;
-    pages_ref[page_num].ref.count = 1;
+    page_of(zero_page_ptr)->ref.count = 1;
 }
 
 u64 left_page_cnt() {
-    return _left_page_cnt.count;
+    u64 ret = _left_page_cnt;
+    for (int i = 0; i < NCPU; i++)
+        ret += magazines[i].cnt + zero_pools[i].cnt;
+    return ret;
+}
+
+isize kalloc_page_cnt() {
+    isize ret = 0;
+    for (int i = 0; i < NCPU; i++)
+        ret += magazines[i].alloc_cnt;
+    return ret;
+}
+
+void get_buddy_stat(struct buddy_stat* st) {
+    acquire_spinlock(&page_pool_lock);
+    *st = buddy_stat;
+    for (int k = 0; k <= BUDDY_MAX_ORDER; k++)
+        st->nr_free[k] = free_area[k].nr_free;
+    release_spinlock(&page_pool_lock);
+}
+
+// 从伙伴系统批量取 0 阶页填充 magazine
+static void refill_magazine(struct page_magazine* mag) {
+    acquire_spinlock(&page_pool_lock);
+    while (mag->cnt < PAGE_MAG_BATCH) {
+        void* p = buddy_alloc(0);
+        if (p == NULL) break;
+        mag->pages[mag->cnt++] = p;
+    }
+    release_spinlock(&page_pool_lock);
+}
+
+// 把 magazine 中最早缓存的一批页还给伙伴系统，保留最近释放（cache 更热）的那些
+static void drain_magazine(struct page_magazine* mag) {
+    acquire_spinlock(&page_pool_lock);
+    for (usize i = 0; i < PAGE_MAG_BATCH; i++)
+        buddy_free(mag->pages[i], 0);
+    release_spinlock(&page_pool_lock);
+    mag->cnt -= PAGE_MAG_BATCH;
+    memmove(mag->pages, mag->pages + PAGE_MAG_BATCH, mag->cnt * sizeof(void*));
+}
+
+// 分配 2^order 个物理连续、并按 2^order 页对齐的页。0 阶直接走 magazine。
+void* kalloc_pages(int order) {
+    ASSERT(order >= 0 && order <= BUDDY_MAX_ORDER);
+    if (order == 0) return kalloc_page();
+    acquire_spinlock(&page_pool_lock);
+    void* ret = buddy_alloc(order);
+    release_spinlock(&page_pool_lock);
+    if (ret == NULL) return NULL;
+    magazines[cpuid()].alloc_cnt += 1ll << order;
+    page_of(ret)->ref.count = 0;
+    return ret;
+}
+
+// 释放 kalloc_pages(order) 分配的块，order 必须与分配时一致。
+// 多页块不参与页引用计数，直接还给伙伴系统。
+void kfree_pages(void* p, int order) {
+    ASSERT(order >= 0 && order <= BUDDY_MAX_ORDER);
+    if (order == 0) {
+        kfree_page(p);
+        return;
+    }
+    ASSERT(((pfn_of(p)) & ((1ull << order) - 1)) == 0);
+    acquire_spinlock(&page_pool_lock);
+    buddy_free(p, order);
+    release_spinlock(&page_pool_lock);
+    magazines[cpuid()].alloc_cnt -= 1ll << order;
 }
 
 // 分配以 PAGE_SIZE 对⻬的 PAGE_SIZE ⼤⼩内存（即分配⼀整个物理⻚）
 void* kalloc_page() {
-    increment_rc(&kalloc_page_cnt);
-    decrement_rc(&_left_page_cnt);
-    void* ret = fetch_from_queue(&nodes);
-    u64 page_num = ((u64)K2P(ret))/PAGE_SIZE;
-    pages_ref[page_num].ref.count = 0;
-    init_spinlock(&(pages_ref[page_num].ref_lock));
+    struct page_magazine* mag = &magazines[cpuid()];
+    if (mag->cnt == 0) {
+        refill_magazine(mag);
+        if (mag->cnt == 0) return NULL;
+    }
+    void* ret = mag->pages[--mag->cnt];
+    mag->alloc_cnt++;
+    page_of(ret)->ref.count = 0;
     return ret;
 }
 // 释放 kalloc_page 分配的物理⻚
 void kfree_page(void* p) {
-    decrement_rc(&kalloc_page_cnt);
-    u64 page_num = ((u64)K2P(p))/PAGE_SIZE;
-    acquire_spinlock(&(pages_ref[page_num].ref_lock));
-    decrement_rc(&(pages_ref[page_num].ref));
-    if(pages_ref[page_num].ref.count <= 0){
-        add_to_queue(&nodes, (QueueNode*)p);
-        increment_rc(&_left_page_cnt);
+    if (!decrement_rc(&page_of(p)->ref)) return;
+    // 内核镜像中的页（如 icode 所在页）也可能被 vmmap 到用户空间，它们不归伙伴系统管
+    u64 pfn = pfn_of(p);
+    if (pfn < start_pfn || pfn >= end_pfn) return;
+    struct page_magazine* mag = &magazines[cpuid()];
+    if (mag->cnt == PAGE_MAG_SIZE) drain_magazine(mag);
+    mag->pages[mag->cnt++] = p;
+    mag->alloc_cnt--;
+}
+
+// 清零一整页。DC ZVA 直接按 cache line 清零而不必先把旧数据读进 cache，
+// 不可用时退化为 8 字节宽的写，仍比逐字节的 memset 快得多。
+void zero_page(void* p) {
+    if (dc_zva_size) {
+        for (u8* q = p; q < (u8*)p + PAGE_SIZE; q += dc_zva_size)
+            arch_dc_zva(q);
+    } else {
+        for (u64* q = p; q < (u64*)((u8*)p + PAGE_SIZE); q += 4) {
+            q[0] = 0; q[1] = 0; q[2] = 0; q[3] = 0;
+        }
     }
-    release_spinlock(&(pages_ref[page_num].ref_lock));
-    return;
+}
+
+// 分配一个内容全为 0 的物理页。本 CPU 的池中有预先清零的页时直接取，否则当场清零。
+void* kalloc_zeroed_page() {
+    struct zero_pool* zp = &zero_pools[cpuid()];
+    if (zp->cnt == 0) {
+        zp->stat.miss++;
+        void* ret = kalloc_page();
+        if (ret != NULL) zero_page(ret);
+        return ret;
+    }
+    void* ret = zp->pages[--zp->cnt];
+    zp->stat.hit++;
+    magazines[cpuid()].alloc_cnt++;
+    page_of(ret)->ref.count = 0;
+    return ret;
+}
+
+// 由空闲 CPU 调用：从伙伴系统取最多 ZERO_REFILL_BATCH 页，清零后放入本 CPU 的池中。
+// 每次只做一小批，不会让 idle 循环长时间不响应调度。
+void refill_zeroed_pages() {
+    struct zero_pool* zp = &zero_pools[cpuid()];
+    usize want = MIN((usize)ZERO_REFILL_BATCH, ZERO_POOL_SIZE - zp->cnt);
+    if (want == 0) return;
+    // 伙伴系统里空闲页不多时把它们留给真正的分配
+    if (_left_page_cnt < PAGE_MAG_BATCH * NCPU) return;
+    usize n = 0;
+    void** batch = &zp->pages[zp->cnt];
+    acquire_spinlock(&page_pool_lock);
+    while (n < want) {
+        void* p = buddy_alloc(0);
+        if (p == NULL) break;
+        batch[n++] = p;
+    }
+    release_spinlock(&page_pool_lock);
+    for (usize i = 0; i < n; i++)
+        zero_page(batch[i]);
+    arch_dsb_sy();
+    zp->cnt += n;
+    zp->stat.refilled += n;
+}
+
+void get_zero_pool_stat(struct zero_pool_stat* st) {
+    memset(st, 0, sizeof(*st));
+    for (int i = 0; i < NCPU; i++) {
+        st->hit += zero_pools[i].stat.hit;
+        st->miss += zero_pools[i].stat.miss;
+        st->refilled += zero_pools[i].stat.refilled;
+        st->pooled += zero_pools[i].cnt;
+    }
+}
+
+void kshare_page(void* p) {
+    increment_rc(&page_of(p)->ref);
 }
 
 void* kalloc(unsigned long long size) {
-    acquire_spinlock(&kernel_mem_lock);
+    acquire_mcs_lock(&kernel_mem_lock);
     size = size + 8;
     int number;
     if(size % 16 == 0) number = size / 16;
@@ -83,7 +343,7 @@ void* kalloc(unsigned long long size) {
         void* node = kalloc_page();
         *(int*) node = 256;
         node = node + 8;
-        release_spinlock(&kernel_mem_lock);
+        release_mcs_lock(&kernel_mem_lock);
         return node;
     }
     for(int i = number - 1; i < 256 ; i++) {
@@ -94,7 +354,7 @@ void* kalloc(unsigned long long size) {
             if(freenumber != 0) add_to_queue(&free[freenumber - 1], (QueueNode*)freeblock);
             *(int*) node = number - 1;
             node = node + 8;
-            release_spinlock(&kernel_mem_lock);
+            release_mcs_lock(&kernel_mem_lock);
             return node;
         }
     }
@@ -104,14 +364,16 @@ void* kalloc(unsigned long long size) {
     add_to_queue(&free[freenumber - 1], (QueueNode*)freeblock);
     *(int*) node = number - 1;
     node = node + 8;
-    release_spinlock(&kernel_mem_lock);
+    release_mcs_lock(&kernel_mem_lock);
     return node;
 }
 
 void kfree(void* ptr) {
     ptr = ptr - 8;
     int* address = ptr;
+    acquire_mcs_lock(&kernel_mem_lock);
     add_to_queue(&free[*address], ptr);
+    release_mcs_lock(&kernel_mem_lock);
     return;
 }
 
@@ -121,8 +383,5 @@ void* get_zero_page() {
 
 usize get_page_ref(u64 addr){
     auto index = PAGE_INDEX(PAGE_BASE(addr));
-    acquire_spinlock(&kernel_mem_lock);
-    auto ret = pages_ref[index].ref.count;
-    release_spinlock(&kernel_mem_lock);
-    return ret;
+    return __atomic_load_n(&pages_ref[index].ref.count, __ATOMIC_ACQUIRE);
 }
\ No newline at end of file
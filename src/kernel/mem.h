@@ -5,18 +5,59 @@
 #include <common/rc.h>
 
 #define PAGE_COUNT ((P2K(PHYSTOP) - PAGE_BASE((u64) & end)) / PAGE_SIZE - 1)
-#define PAGE_INDEX(page_base) ((KSPACE((u64)page_base) - P2K(EXTMEM)) / PAGE_SIZE)
+// index into pages_ref, which is indexed by physical page frame number
+#define PAGE_INDEX(page_base) (PSPACE((u64)page_base) / PAGE_SIZE)
+
+// largest block handed out by the buddy allocator is 2^BUDDY_MAX_ORDER pages (4MB)
+#define BUDDY_MAX_ORDER 10
 
 struct page {
-    RefCount ref;
-    SpinLock ref_lock;
+    RefCount ref;  // updated atomically, no lock needed
+    // buddy allocator metadata, protected by the page pool lock.
+    // only meaningful on the first page of a block.
+    u8 order;
+    bool buddy_free;  // first page of a block sitting in a buddy free list
+};
+
+struct buddy_stat {
+    usize split;  // a block was halved to satisfy a smaller request
+    usize merge;  // a freed block was coalesced with its buddy
+    usize alloc_fail;
+    usize alloc[BUDDY_MAX_ORDER + 1];  // blocks handed out, per order
+    usize free[BUDDY_MAX_ORDER + 1];   // blocks given back, per order
+    usize nr_free[BUDDY_MAX_ORDER + 1];  // free blocks currently on each list
 };
 
 void kinit();
 u64 left_page_cnt();
+isize kalloc_page_cnt();
 
 WARN_RESULT void *kalloc_page();
 void kfree_page(void *);
+// take one more reference on a page; it is freed when kfree_page drops the last one
+void kshare_page(void *);
+
+// allocate 2^order physically contiguous pages, aligned to their size.
+WARN_RESULT void *kalloc_pages(int order);
+// free a block from kalloc_pages. `order` must match the allocation.
+void kfree_pages(void *, int order);
+void get_buddy_stat(struct buddy_stat *);
+
+struct zero_pool_stat {
+    usize hit;  // kalloc_zeroed_page served from the pre-zeroed pool
+    usize miss;  // pool was empty, page zeroed on the spot
+    usize refilled;  // pages zeroed in the background by idle CPUs
+    usize pooled;  // pages currently in the pool
+};
+
+// allocate a page that is already filled with zero. Prefer this over
+// kalloc_page + memset: the pool is refilled by idle CPUs.
+WARN_RESULT void *kalloc_zeroed_page();
+// called from the idle loop to top up the pre-zeroed page pool.
+void refill_zeroed_pages();
+// zero a whole page with DC ZVA (or wide stores if DC ZVA is prohibited).
+void zero_page(void *);
+void get_zero_pool_stat(struct zero_pool_stat *);
 
 WARN_RESULT void *kalloc(unsigned long long);
 void kfree(void *);
@@ -1,4 +1,7 @@
+#include <aarch64/intrinsic.h>
 #include <aarch64/mmu.h>
+#include <aarch64/trap.h>
+#include <sys/mman.h>
 #include <common/defines.h>
 #include <common/list.h>
 #include <common/sem.h>
@@ -11,6 +14,113 @@
 #include <kernel/proc.h>
 #include <kernel/pt.h>
 #include <kernel/sched.h>
+#include <kernel/slab.h>
+#include <kernel/syscall.h>
+
+static KMemCache *section_cache;
+define_early_init(section_cache) {
+    section_cache = kmem_cache_create("section", sizeof(struct section), NULL);
+}
+
+// 分配一个全零的 section
+struct section *alloc_section() {
+    struct section *st = kmem_cache_alloc(section_cache);
+    memset(st, 0, sizeof(struct section));
+    return st;
+}
+
+void free_section(struct section *st) {
+    kmem_cache_free(section_cache, st);
+}
+
+// 段索引：pgdir->section_tree 是按 begin 排序的红黑树，每个结点另外记录子树中最大的 end
+// （区间树），查找包含某个地址的段只需 O(log n)。heap 段的 begin 可能与别的段相同，
+// begin 相同时按结构体地址排序。
+static bool section_cmp(rb_node lnode, rb_node rnode) {
+	struct section *l = container_of(lnode, struct section, rbnode);
+	struct section *r = container_of(rnode, struct section, rbnode);
+	return l->begin < r->begin || (l->begin == r->begin && l < r);
+}
+
+static void section_augment(rb_node node) {
+	struct section *st = container_of(node, struct section, rbnode);
+	u64 max_end = st->end;
+	if(node->rb_left) max_end = MAX(max_end, container_of(node->rb_left, struct section, rbnode)->max_end);
+	if(node->rb_right) max_end = MAX(max_end, container_of(node->rb_right, struct section, rbnode)->max_end);
+	st->max_end = max_end;
+}
+
+static void tree_insert_section(struct pgdir *pd, struct section *st) {
+	st->max_end = st->end;
+	ASSERT(0 == _rb_insert(&st->rbnode, &pd->section_tree, section_cmp));
+	_rb_augment_insert(&st->rbnode, section_augment);
+}
+
+static void tree_erase_section(struct pgdir *pd, struct section *st) {
+	rb_node deepest = _rb_augment_erase_begin(&st->rbnode);
+	_rb_erase(&st->rbnode, &pd->section_tree);
+	_rb_augment_erase_end(deepest, section_augment);
+	if(pd->last_hit == st) pd->last_hit = NULL;
+}
+
+void insert_section(struct pgdir *pd, struct section *st) {
+	_insert_into_list(&pd->section_head, &st->stnode);
+	tree_insert_section(pd, st);
+	if(st->flags & ST_HEAP) pd->heap = st;
+}
+
+void remove_section(struct pgdir *pd, struct section *st) {
+	_detach_from_list(&st->stnode);
+	tree_erase_section(pd, st);
+	if(pd->heap == st) pd->heap = NULL;
+}
+
+void resize_section(struct pgdir *pd, struct section *st, u64 begin, u64 end) {
+	if(begin == st->begin){
+		// 只改 end（sbrk）时树的形状不变，更新这条路径上的 max_end 即可
+		st->end = end;
+		_rb_augment_path(&st->rbnode, section_augment);
+		return;
+	}
+	tree_erase_section(pd, st);
+	st->begin = begin;
+	st->end = end;
+	tree_insert_section(pd, st);
+}
+
+// 先看上一次找到的段（缺页和用户指针检查往往连续落在同一个段里），再在区间树中查找：
+// 左子树的 max_end 大于 addr 时，包含 addr 的段如果存在就一定在左子树中。
+struct section *find_section(struct pgdir *pd, u64 addr) {
+	struct section *st = pd->last_hit;
+	if(st && addr >= st->begin && addr < st->end) return st;
+	rb_node node = pd->section_tree.rb_node;
+	while(node){
+		st = container_of(node, struct section, rbnode);
+		if(addr >= st->begin && addr < st->end){
+			pd->last_hit = st;
+			return st;
+		}
+		if(node->rb_left && container_of(node->rb_left, struct section, rbnode)->max_end > addr)
+			node = node->rb_left;
+		else
+			node = node->rb_right;
+	}
+	return NULL;
+}
+
+// 从 hi 往下按地址顺序找第一个放得下 length 字节的空隙。
+u64 find_free_range(struct pgdir *pd, u64 length, u64 lo, u64 hi) {
+	u64 top = hi;
+	for(rb_node node = _rb_last(&pd->section_tree); node; node = _rb_prev(node)){
+		struct section *st = container_of(node, struct section, rbnode);
+		if(st->begin == st->end || st->begin >= top) continue;
+		u64 bottom = MAX(lo, round_up(st->end, PAGE_SIZE));
+		if(bottom <= top && top - bottom >= length) return top - length;
+		top = MIN(top, PAGE_BASE(st->begin));
+		if(top < lo + length) return 0;
+	}
+	return top >= lo + length ? top - length : 0;
+}
 
 void read_page_from_disk(void* ka, u32 bno) {
     for(u32 i=0;i<8;++i){
@@ -36,16 +146,76 @@ void swap_in(struct pgdir* pd, struct section* st){
 	st->flags &= ~ST_SWAP;
 }
 
-void init_sections(ListNode *section_head) {
+void init_sections(struct pgdir *pd) {
     /* (Final) TODO BEGIN */
-	struct section *st = kalloc(sizeof(struct section));
+	struct section *st = alloc_section();
 	st->begin = 0x0; st->end = 0x0; st->flags = 0;
 	st->flags |= ST_HEAP;
-	init_sleeplock(&(st->sleeplock));
-	_insert_into_list(section_head, &(st->stnode));
+	init_sleeplock(&(st->sleeplock), "section");
+	insert_section(pd, st);
     /* (Final) TODO END */
 }
 
+// 共享可写映射的页一开始都是只读映射的，第一次写时在 pgfault_handler 里才变成可写并记为脏页，
+// 同时记下这一页多了一个可写的页表项（Inode::shared_writers）。这里先把本进程在 [begin, end)
+// 内的页表项解除映射（unmap 为真）或重新置为只读，以便捕获下一次写；再按 inode 的脏页集合
+// 写回这段范围内的页，所以别的进程经同一个共享页写脏的页也会写回。写回后还有别的
+// 可写页表项的页仍留在脏页集合里，它们随时可能再被写。
+static void writeback_file_pages(struct pgdir *pd, struct section *st, u64 begin, u64 end, bool unmap) {
+	bool shared = (st->flags & ST_MMAP_SHARED) && (st->prot & PROT_WRITE);
+	Inode* ip = st->fp->ip;
+	if(shared) inodes.lock(ip);
+	for(u64 va = PAGE_BASE(begin); va < end; va += PAGE_SIZE){
+		PTEntriesPtr pte = get_pte(pd, va, false);
+		if(pte == NULL || !(*pte & PTE_VALID)) continue;
+		void* ka = (void*)P2K(PTE_ADDRESS(*pte));
+		usize index = (st->offset + va - st->begin) / PAGE_SIZE;
+		if(shared && !(*pte & PTE_RO) && index < INODE_MAX_PAGES && ip->shared_writers[index] > 0)
+			ip->shared_writers[index]--;
+		if(unmap){
+			kfree_page(ka);
+			*pte = 0;
+		}
+		else if(shared && index < INODE_MAX_PAGES) *pte |= PTE_RO;
+	}
+	if(shared) inodes.unlock(ip);
+	flush_tlb_range(pd, begin, end);
+	if(!shared) return;
+	for(u64 va = PAGE_BASE(begin); va < end; va += PAGE_SIZE){
+		usize index = (st->offset + va - st->begin) / PAGE_SIZE;
+		if(index >= INODE_MAX_PAGES) break;
+		// 先不加锁看一眼，干净的页不必开启日志操作
+		if(!(__atomic_load_n(&ip->dirty_pages, __ATOMIC_RELAXED) & (1u << index))) continue;
+		OpContext ctx;
+		bcache.begin_op(&ctx);
+		inodes.lock(ip);
+		if(ip->dirty_pages & (1u << index)){
+			inodes.sync_page(&ctx, ip, index);
+			if(ip->shared_writers[index] > 0) ip->dirty_pages |= 1u << index;
+			__atomic_fetch_add(&mmap_stat.writeback, 1, __ATOMIC_RELAXED);
+		}
+		inodes.unlock(ip);
+		bcache.end_op(&ctx);
+	}
+}
+
+// fork 把共享可写映射中可写的页表项复制给了子进程：这一页又多了一个可写的映射
+void share_file_page(struct section *st, u64 va) {
+	usize index = (st->offset + PAGE_BASE(va) - st->begin) / PAGE_SIZE;
+	if(!(st->flags & ST_MMAP_SHARED) || !(st->prot & PROT_WRITE) || index >= INODE_MAX_PAGES) return;
+	inodes.lock(st->fp->ip);
+	st->fp->ip->shared_writers[index]++;
+	inodes.unlock(st->fp->ip);
+}
+
+void unmap_file_pages(struct pgdir *pd, struct section *st, u64 begin, u64 end) {
+	writeback_file_pages(pd, st, begin, end, true);
+}
+
+void sync_file_pages(struct pgdir *pd, struct section *st, u64 begin, u64 end) {
+	writeback_file_pages(pd, st, begin, end, false);
+}
+
 // 释放与页目录（pgdir）相关的所有段及其分配的内存资源，确保内存不会泄漏。
 void free_sections(struct pgdir *pd) {
     /* (Final) TODO BEGIN */
@@ -57,6 +227,7 @@ void free_sections(struct pgdir *pd) {
 		st = container_of(node, struct section, stnode);
 		// 如果段被标记为已交换（ST_SWAP），需要先将其从交换设备中调入内存。
 		if(st->flags & ST_SWAP) swap_in(pd, st);
+		if(st->flags & (ST_MMAP_SHARED | ST_MMAP_PRIVATE)) unmap_file_pages(pd, st, st->begin, st->end);
 		// 遍历段的地址范围，逐页释放内存
 		for(u64 i = PAGE_BASE(st->begin); i < st->end; i += PAGE_SIZE){
 			PTEntriesPtr pte_p = get_pte(pd, i, false);
@@ -66,8 +237,8 @@ void free_sections(struct pgdir *pd) {
 		}
 		if(st->fp != NULL) file_close(st->fp);
 		node = node->next;
-		_detach_from_list(&(st->stnode));
-		kfree((void*)st);
+		remove_section(pd, st);
+		free_section(st);
 	}
     /* (Final) TODO END */
 }
@@ -81,18 +252,13 @@ u64 sbrk(i64 size) {
      */
     printk("in sbrk\n");
 	struct Proc* p = thisproc();
-	struct section* st = NULL;
-	_for_in_list(node, &(p->pgdir.section_head)){
-		if(node == &(p->pgdir.section_head)) break;
-		st = container_of(node, struct section, stnode);
-		if(st->flags & ST_HEAP) break;
-	}
+	struct section* st = p->pgdir.heap;
 	ASSERT(st!=NULL);
 	u64 ret = st->end;
-	if(size >= 0) st->end += size*PAGE_SIZE;
+	if(size >= 0) resize_section(&p->pgdir, st, st->begin, st->end + size*PAGE_SIZE);
 	else {
 		ASSERT((u64)(-size)*PAGE_SIZE <= (st->end-st->begin));
-		st->end += size*PAGE_SIZE;
+		resize_section(&p->pgdir, st, st->begin, st->end + size*PAGE_SIZE);
 		if(st->flags & ST_SWAP) swap_in(&(p->pgdir), st);
 		for(int i = 0; i < (-size); i++) {
 			PTEntriesPtr entry_ptr = get_pte(&(p->pgdir), st->end+i*PAGE_SIZE, false);
@@ -102,14 +268,172 @@ u64 sbrk(i64 size) {
 				*(entry_ptr) = 0;
 			}
 		}
+		flush_tlb_range(&p->pgdir, st->end, st->end + (u64)(-size) * PAGE_SIZE);
 	}
-	arch_tlbi_vmalle1is();
 	return ret;
     /* (Final) TODO END */
 }
 
-int pgfault_handler(u64 iss) {
-    // printk("pagefault handle start\n");
+// 缺页次数与处理缺页花费的系统计数器（cntpct）总 tick 数，用于统计平均缺页延迟
+static u64 pgfault_cnt, pgfault_ticks;
+// fault-around 顺带映射的页数
+static u64 pgfault_around;
+// 映射页缓存中共享页 / 私有读入的代码页数
+static u64 text_shared, text_private;
+// 写时复制缺页中真正复制了页 / 原地恢复可写的次数（不加锁，仅供统计）
+struct cow_stat cow_stat;
+struct mmap_stat mmap_stat;
+
+void get_text_stat(u64 *shared, u64 *private_pages) {
+    *shared = __atomic_load_n(&text_shared, __ATOMIC_RELAXED);
+    *private_pages = __atomic_load_n(&text_private, __ATOMIC_RELAXED);
+}
+
+void get_pgfault_stat(u64 *cnt, u64 *ticks, u64 *around) {
+    *cnt = __atomic_load_n(&pgfault_cnt, __ATOMIC_RELAXED);
+    *ticks = __atomic_load_n(&pgfault_ticks, __ATOMIC_RELAXED);
+    *around = __atomic_load_n(&pgfault_around, __ATOMIC_RELAXED);
+}
+
+// 文件中有 va0 所在页要用到的全部内容时返回 true。ELF 段超出文件末尾（文件被截断）时，
+// 缺的部分读不出来，不能当作 0 映射进去。调用者持有 inode 锁。
+static bool file_covers_page(struct section *st, u64 va0) {
+	u64 to = MIN(va0 + PAGE_SIZE, st->begin + st->length);
+	return to <= st->begin || st->offset + (to - st->begin) <= st->fp->ip->entry.num_bytes;
+}
+
+// 读入 va0 所在页中属于文件内容 [begin, begin + length) 的部分，其余部分保持为 0。
+// 读到的字节数不够时返回 -1。调用者持有 inode 锁。
+static int fill_file_page(struct section *st, u64 va0, void *ka) {
+	u64 file_end = st->begin + st->length;
+	u64 from = MAX(va0, st->begin), to = MIN(va0 + PAGE_SIZE, file_end);
+	if(from >= to) return 0;
+	if(!file_covers_page(st, va0)) return -1;
+	usize n = inodes.read(st->fp->ip, (u8*)ka + (from - va0), st->offset + (from - st->begin), to - from);
+	return n == to - from ? 0 : -1;
+}
+
+// 映射 ELF 段中 va 所在的页。代码段直接只读映射文件页缓存中的页，所有运行同一程序的
+// 进程共享同一份物理页；数据段的页每个进程私有，从页缓存复制。读不出文件内容时
+// 什么都不映射，返回 -1。调用者持有 inode 锁。
+static int map_file_page(struct pgdir *pd, struct section *st, u64 va) {
+	u64 pgoff = st->offset + va - st->begin;
+	if((st->flags & ST_RO) && pgoff % PAGE_SIZE == 0){
+		if(!file_covers_page(st, va)) return -1;
+		void* page = inodes.get_page(st->fp->ip, pgoff / PAGE_SIZE, false);
+		if(page == NULL) return -1;
+		vmmap(pd, va, page, PTE_USER_DATA | PTE_RO);
+		st->fp->ip->text_pages |= 1u << (pgoff / PAGE_SIZE);
+		__atomic_fetch_add(&text_shared, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	void* ka = kalloc_zeroed_page();
+	if(ka == NULL) return -1;
+	if(fill_file_page(st, va, ka) < 0){
+		kfree_page(ka);
+		return -1;
+	}
+	vmmap(pd, va, ka, PTE_USER_DATA | ((st->flags & ST_RO) ? PTE_RO : 0));
+	if(st->flags & ST_RO) __atomic_fetch_add(&text_private, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// execve 时把代码段中已经在页缓存里的页直接映射上，常用程序再次启动时代码段不再缺页。
+// 只用已有的缓存页、不分配，空着的槽（包括之前分配失败的）留给缺页时再读。调用者持有 inode 锁。
+void map_cached_text(struct pgdir *pd, struct section *st) {
+	Inode* ip = st->fp->ip;
+	for(u64 va = PAGE_BASE(st->begin); va < st->end; va += PAGE_SIZE){
+		u64 pgoff = st->offset + va - st->begin;
+		if(pgoff % PAGE_SIZE != 0 || ip->pages[pgoff / PAGE_SIZE] == NULL) continue;
+		vmmap(pd, va, ip->pages[pgoff / PAGE_SIZE], PTE_USER_DATA | PTE_RO);
+		ip->text_pages |= 1u << (pgoff / PAGE_SIZE);
+		__atomic_fetch_add(&text_shared, 1, __ATOMIC_RELAXED);
+	}
+}
+
+// 文件映射段（ELF 的代码段和数据段）的缺页：读入 addr 所在的页，并顺带把同一个
+// FAULT_AROUND_PAGES 对齐窗口内还没映射、且有文件内容的页一起读进来（fault-around），
+// 顺序执行/访问时能省掉大部分后续缺页。纯 bss 的页仍然等到真正访问时再分配。
+// 只有 addr 所在的页读不出来才返回 -1，顺带的页读不出来就留着不映射。
+static int file_fault(struct pgdir *pd, struct section *st, u64 addr) {
+	int ret = 0;
+	u64 win = FAULT_AROUND_PAGES * PAGE_SIZE;
+	u64 lo = MAX(PAGE_BASE(st->begin), addr & ~(win - 1));
+	u64 hi = MIN(st->end, (addr & ~(win - 1)) + win);
+	u64 file_end = st->begin + st->length;
+	inodes.lock(st->fp->ip);
+	for(u64 va = lo; va < hi; va += PAGE_SIZE){
+		if(va != PAGE_BASE(addr) && va >= file_end) continue;
+		PTEntriesPtr pte = get_pte(pd, va, true);
+		if(*pte != 0) continue;
+		if(map_file_page(pd, st, va) < 0){
+			if(va == PAGE_BASE(addr)) ret = -1;
+			continue;
+		}
+		if(va != PAGE_BASE(addr)) __atomic_fetch_add(&pgfault_around, 1, __ATOMIC_RELAXED);
+	}
+	inodes.unlock(st->fp->ip);
+	return ret;
+}
+
+// mmap 段的缺页：映射文件页缓存中的页，同一个文件的所有共享映射因此看到同一份物理页。
+// 读缺页只读映射，并顺带映射同一窗口内文件范围中还没映射的页；共享可写映射在第一次写时
+// 才变成可写（见 pgfault_handler），私有映射写时复制。超出文件最大长度的部分是私有的全 0 页。
+// 分配不到内存时什么都不映射，返回 -1。
+static int mmap_fault(struct pgdir *pd, struct section *st, u64 addr, bool write) {
+	Inode* ip = st->fp->ip;
+	bool shared = (st->flags & ST_MMAP_SHARED) && (st->prot & PROT_WRITE);
+	u64 va0 = PAGE_BASE(addr);
+	usize index = (st->offset + va0 - st->begin) / PAGE_SIZE;
+	if(index >= INODE_MAX_PAGES){
+		void* ka = kalloc_zeroed_page();
+		if(ka == NULL) return -1;
+		vmmap(pd, va0, ka, PTE_USER_DATA);
+		return 0;
+	}
+	inodes.lock(ip);
+	void* page = inodes.get_page(ip, index, write && shared);
+	if(page == NULL){
+		inodes.unlock(ip);
+		return -1;
+	}
+	if(write && shared){
+		vmmap(pd, va0, page, PTE_USER_DATA);
+		ip->shared_writers[index]++;
+	}
+	else if(write && (st->prot & PROT_WRITE)){
+		void* copy = kalloc_page();
+		if(copy == NULL){
+			inodes.unlock(ip);
+			return -1;
+		}
+		memcpy(copy, page, PAGE_SIZE);
+		vmmap(pd, va0, copy, PTE_USER_DATA);
+	}
+	else{
+		vmmap(pd, va0, page, PTE_USER_DATA | PTE_RO);
+		u64 win = FAULT_AROUND_PAGES * PAGE_SIZE;
+		u64 lo = MAX(st->begin, addr & ~(win - 1));
+		u64 hi = MIN(st->end, (addr & ~(win - 1)) + win);
+		for(u64 va = lo; va < hi; va += PAGE_SIZE){
+			usize i = (st->offset + va - st->begin) / PAGE_SIZE;
+			if(va == va0 || i >= INODE_MAX_PAGES || i * PAGE_SIZE >= ip->entry.num_bytes) continue;
+			PTEntriesPtr pte = get_pte(pd, va, true);
+			if(*pte != 0) continue;
+			void* around = inodes.get_page(ip, i, false);
+			if(around == NULL) break;  // 顺带的页分配不到就不映射了，等真正访问时再缺页
+			vmmap(pd, va, around, PTE_USER_DATA | PTE_RO);
+			__atomic_fetch_add(&pgfault_around, 1, __ATOMIC_RELAXED);
+		}
+	}
+	inodes.unlock(ip);
+	__atomic_fetch_add(&mmap_stat.fault, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// quiet：内核态访问用户内存出错且有异常修复项时不打印，由 uaccess 返回错误即可
+int pgfault_handler(u64 iss, bool quiet) {
+    u64 t0 = get_timestamp();
     Proc *p = thisproc();
     struct pgdir *pd = &p->pgdir;
     u64 addr = arch_get_far(); // Attempting to access this address caused the page fault
@@ -120,48 +444,97 @@ int pgfault_handler(u64 iss) {
      * 3. Handle the page fault accordingly.
      * 4. Return to user code or kill the process.
      */
-    struct section* st = NULL;
-	_for_in_list(node, &(pd->section_head)) { // 找到包含 addr 的段。
-		if(node == &(pd->section_head)) break;
-		st = container_of(node, struct section, stnode);
-		if(addr >= st->begin && addr < st->end) break;
+    struct section* st = find_section(pd, addr); // 找到包含 addr 的段。
+	if(st == NULL){
+		// 不属于任何段：用户态访问会被杀死，内核态（copy_from_user 等）返回错误
+		if(!quiet) printk("pid %d: page fault at unmapped address %p\n", p->pid, (void*)addr);
+		return -1;
 	}
-	ASSERT(st != NULL);
-	printk("addr is: 0x%x, st_begin is: 0x%x, st_end is: 0x%x\n", (int)addr,(int)st->begin,(int)st->end);
-	ASSERT(addr >= st->begin && addr < st->end);
 	// 如果段被标记为 ST_SWAP（表示已被交换出到磁盘），调用 swap_in 将段从磁盘调入内存。
 	if(st->flags & ST_SWAP) swap_in(pd, st);
 	// 调用 get_pte 获取虚拟地址 addr 的页表项指针。如果页表项不存在且 true 参数允许创建，会创建一个新的页表项。
 	PTEntriesPtr ptentry_ptr = get_pte(pd, addr, true);
-	if(*ptentry_ptr == 0){ // lazy allocation
-		void* new_page = kalloc_page();
+	if(*ptentry_ptr == 0 && (st->flags & ST_FILE) && st->fp != NULL){ // demand paging from ELF
+		if(file_fault(pd, st, addr) < 0){
+			if(!quiet) printk("pid %d: cannot read the page at %p from its file\n", p->pid, (void*)addr);
+			return -1;
+		}
+	}
+	else if(*ptentry_ptr == 0 && (st->flags & (ST_MMAP_SHARED | ST_MMAP_PRIVATE))){ // lazy mmap
+		if(mmap_fault(pd, st, addr, (iss & ISS_WNR) != 0) < 0){
+			if(!quiet) printk("pid %d: out of memory mapping %p\n", p->pid, (void*)addr);
+			return -1;
+		}
+	}
+	else if(*ptentry_ptr == 0){ // lazy allocation
+		void* new_page = kalloc_zeroed_page();
+		if(new_page == NULL){
+			if(!quiet) printk("pid %d: out of memory mapping %p\n", p->pid, (void*)addr);
+			return -1;
+		}
 		vmmap(pd, addr, new_page, PTE_USER_DATA);
 	}
-	else if(PTE_FLAGS(*ptentry_ptr) & PTE_RO){ // copy on write
-		void* new_page = kalloc_page();
+	else if((PTE_FLAGS(*ptentry_ptr) & PTE_RO) && ISS_IS_PERMISSION_FAULT(iss)){ // copy on write
+		// 代码段和没有 PROT_WRITE 的 mmap 段本来就是只读的，写它们是真正的越权访问
+		if((st->flags & ST_RO) || ((st->flags & (ST_MMAP_SHARED | ST_MMAP_PRIVATE)) && !(st->prot & PROT_WRITE))){
+			if(!quiet) printk("pid %d: write to read-only address %p\n", p->pid, (void*)addr);
+			return -1;
+		}
 		void* old_page = (void*)P2K(PTE_ADDRESS(*ptentry_ptr));
-		memcpy(new_page, old_page, PAGE_SIZE);
-		kfree_page(old_page);
-		vmmap(pd, addr, new_page, PTE_USER_DATA);
+		usize index = (st->offset + PAGE_BASE(addr) - st->begin) / PAGE_SIZE;
+		if((st->flags & ST_MMAP_SHARED) && index < INODE_MAX_PAGES){
+			// 共享可写映射第一次写这一页：记为脏页并恢复可写，msync/munmap 时写回
+			inodes.lock(st->fp->ip);
+			st->fp->ip->dirty_pages |= 1u << index;
+			st->fp->ip->shared_writers[index]++;
+			inodes.unlock(st->fp->ip);
+			*ptentry_ptr &= ~(u64)PTE_RO;
+			__atomic_fetch_add(&mmap_stat.dirtied, 1, __ATOMIC_RELAXED);
+		}
+		else if(old_page != get_zero_page() && get_page_ref((u64)old_page) == 1){
+			// 其他进程都已经复制走或退出了，只剩自己在用，直接恢复可写
+			*ptentry_ptr &= ~(u64)PTE_RO;
+			cow_stat.reuse++;
+		}
+		else{
+			// 先分配：失败时旧页的映射和引用计数都原样留着，进程被杀时照常释放
+			bool zero = old_page == get_zero_page();
+			void* new_page = zero ? kalloc_zeroed_page() : kalloc_page();
+			if(new_page == NULL){
+				if(!quiet) printk("pid %d: out of memory copying %p\n", p->pid, (void*)addr);
+				return -1;
+			}
+			if(!zero) memcpy(new_page, old_page, PAGE_SIZE);
+			kfree_page(old_page);
+			vmmap(pd, addr, new_page, PTE_USER_DATA);
+			cow_stat.copy++;
+		}
 	}
 	if(!(PTE_FLAGS(*ptentry_ptr) & PTE_VALID)) PANIC();
-	arch_tlbi_vmalle1is();
-	iss = iss;
-	printk("pagefault handle done\n");
+	// 原来无效的页表项不会进 TLB，只有写时复制改掉的那一项可能有旧的只读 TLB 项
+	flush_tlb_page(pd, addr);
+	__atomic_fetch_add(&pgfault_cnt, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&pgfault_ticks, get_timestamp() - t0, __ATOMIC_RELAXED);
 	return 0;
     /* (Final) TODO END */
 }
 
 // 从一个段链表复制所有段到另一个段链表中（确保段的信息在分页系统间可以复用）
-void copy_sections(ListNode *from_head, ListNode *to_head) {
+void copy_sections(struct pgdir *from, struct pgdir *to) {
     /* (Final) TODO BEGIN */
-	_for_in_list(node, from_head) {
-		if(node == from_head) break;
+	// to 里由 init_sections 建好的空 heap 段换成 from 的 heap 段的副本
+	if(to->heap){
+		struct section* heap = to->heap;
+		remove_section(to, heap);
+		free_section(heap);
+	}
+	_for_in_list(node, &from->section_head) {
+		if(node == &from->section_head) break;
 		struct section* st = container_of(node, struct section, stnode);
-		struct section* new_st = kalloc(sizeof(struct section));
+		struct section* new_st = alloc_section();
 		memmove(new_st, st, sizeof(struct section));
 		if(st->fp != NULL) new_st->fp = file_dup(st->fp);
-		_insert_into_list(to_head, &(new_st->stnode));
+		insert_section(to, new_st);
 	}
     /* (Final) TODO END */
 }
@@ -14,21 +14,66 @@
 #define ST_MMAP_SHARED (1 << 5)
 #define ST_MMAP_PRIVATE (1 << 6)
 
+// a page fault in an ELF section also maps the other pages of its aligned
+// window of this many pages
+#define FAULT_AROUND_PAGES 16
+
 struct section {
     u64 flags;
     u64 begin;
     u64 end;
     ListNode stnode;
+    struct rb_node_ rbnode;  // in pgdir->section_tree
+    u64 max_end;             // max end of the sections in this rbnode's subtree
     SleepLock sleeplock;
-    /* The following fields are for the file-backed sections. */
+    /* The following fields are for the file-backed sections
+       (mmap, and ELF segments loaded on demand: [begin, begin + length)
+       comes from the file at `offset`, the rest of the section is zero). */
     struct file *fp;
     u64 offset; // Offset in file
     u64 length; // Length of mapped content in file
     u64 prot;   // for mmap
 };
 
-int pgfault_handler(u64 iss);
-void init_sections(ListNode *section_head);
+struct cow_stat {
+    u64 copy;   // write faults that copied a shared page
+    u64 reuse;  // write faults on a page nobody else maps any more
+};
+extern struct cow_stat cow_stat;
+
+struct mmap_stat {
+    u64 fault;      // page faults that mapped a page cache page into an mmap section
+    u64 dirtied;    // write-protect faults that marked a shared page dirty
+    u64 writeback;  // dirty pages written back by msync/munmap/exit
+};
+extern struct mmap_stat mmap_stat;
+
+WARN_RESULT struct section *alloc_section();
+void free_section(struct section *st);
+int pgfault_handler(u64 iss, bool quiet);
+// number of page faults handled so far, the cntpct ticks spent on them, and
+// the extra pages mapped by fault-around
+void get_pgfault_stat(u64 *cnt, u64 *ticks, u64 *around);
+// map the pages of an ELF text section that are already in the page cache
+void map_cached_text(struct pgdir *pd, struct section *st);
+// text page mappings that share a page cache page / had to be read privately
+void get_text_stat(u64 *shared, u64 *private_pages);
+void init_sections(struct pgdir *pd);
+// add/remove a section to/from both the section list and the section tree
+void insert_section(struct pgdir *pd, struct section *st);
+void remove_section(struct pgdir *pd, struct section *st);
+// change the range of a section that is already inserted
+void resize_section(struct pgdir *pd, struct section *st, u64 begin, u64 end);
+// the section containing addr, or NULL
+struct section *find_section(struct pgdir *pd, u64 addr);
+// the highest page-aligned free range of `length` bytes in [lo, hi), 0 if none
+u64 find_free_range(struct pgdir *pd, u64 length, u64 lo, u64 hi);
 void free_sections(struct pgdir *pd);
-void copy_sections(ListNode *from_head, ListNode *to_head);
+// unmap [begin, end) of an mmap section, writing dirty shared pages back to the file
+void unmap_file_pages(struct pgdir *pd, struct section *st, u64 begin, u64 end);
+// write dirty shared pages in [begin, end) of an mmap section back to the file
+void sync_file_pages(struct pgdir *pd, struct section *st, u64 begin, u64 end);
+// fork copied a writable PTE of a shared file mapping at va into the child
+void share_file_page(struct section *st, u64 va);
+void copy_sections(struct pgdir *from, struct pgdir *to);
 u64 sbrk(i64 size);
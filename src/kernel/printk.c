@@ -6,7 +6,7 @@
 static SpinLock printk_lock;
 
 void printk_init() {
-    init_spinlock(&printk_lock);
+    init_spinlock(&printk_lock, "printk");
 }
 
 static void _put_char(void *_ctx, char c) {
@@ -3,21 +3,26 @@
 #include <kernel/sched.h>
 #include <aarch64/mmu.h>
 #include <common/list.h>
+#include <common/rwlock.h>
 #include <common/string.h>
 #include <kernel/printk.h>
 #include <kernel/paging.h>
+#include <kernel/slab.h>
+#include <kernel/fpsimd.h>
 
 Proc root_proc;
 void kernel_entry();
 void proc_entry();
-static SpinLock processlock;  // 进程锁
+static RWLock processlock;  // 保护进程树；只查找进程（kill、调度属性）时拿读锁
 static int max_pid;  // 管理global的进程pid最大值（进程数量）
+static KMemCache* proc_cache;
 
 // init_kproc initializes the kernel process
 // NOTE: should call after kinit
 void init_kproc() { // TODO:
     // 1. init global resources (e.g. locks, semaphores)
-    init_spinlock(&processlock);
+    init_rwlock(&processlock, "processlock");
+    proc_cache = kmem_cache_create("proc", sizeof(Proc), NULL);
     // 2. init the root_proc (finished)
     init_proc(&root_proc);
     root_proc.parent = &root_proc;  // 标识进程树的根，parent==self
@@ -26,7 +31,7 @@ void init_kproc() { // TODO:
 
 void init_proc(Proc *p) { // TODO:
     // NOTE: be careful of concurrency
-    acquire_spinlock(&processlock);
+    write_lock(&processlock);
     // setup the Proc with kstack and pid allocated
     memset(p, 0, sizeof(Proc));
     p->killed = false;
@@ -38,36 +43,35 @@ void init_proc(Proc *p) { // TODO:
     init_sem(&p->childexit, 0);
     init_list_node(&p->children);
     init_list_node(&p->ptnode);
-    p->kstack = kalloc_page();
-    memset(p->kstack, 0, PAGE_SIZE);
+    p->kstack = kalloc_zeroed_page();
     init_schinfo(&p->schinfo);
+    p->fpsimd_cpu = -1;
     init_pgdir(&p->pgdir);  // lab3_new_added
     p->kcontext=(KernelContext*)((u64)p->kstack+PAGE_SIZE-16-sizeof(KernelContext)-sizeof(UserContext));
     p->ucontext=(UserContext*)((u64)p->kstack+PAGE_SIZE-16-sizeof(UserContext));
-    p->timeload = 0;
     init_oftable(&(p->oftable));
-    release_spinlock(&processlock);
+    write_unlock(&processlock);
 }
 
 Proc *create_proc() {
-    Proc *p = kalloc(sizeof(Proc));
+    Proc *p = kmem_cache_alloc(proc_cache);
     init_proc(p);
     return p;
 }
 
 void set_parent_to_this(Proc *proc) { // TODO: set the parent of proc to thisproc
     // NOTE: maybe you need to lock the process tree
-    acquire_spinlock(&processlock);
+    write_lock(&processlock);
     // NOTE: it's ensured that the old proc->parent = NULL
     ASSERT(proc->parent == NULL);
     proc->parent = thisproc();
     _insert_into_list(&thisproc()->children, &proc->ptnode);
-    release_spinlock(&processlock);
+    write_unlock(&processlock);
 }
 
 int start_proc(Proc *p, void (*entry)(u64), u64 arg) { // TODO:
     // NOTE: be careful of concurrency
-    acquire_spinlock(&processlock);
+    write_lock(&processlock);
     // 1. set the parent to root_proc if NULL
     if(p->parent == NULL) {
         p->parent = &root_proc;
@@ -79,50 +83,58 @@ int start_proc(Proc *p, void (*entry)(u64), u64 arg) { // TODO:
     p->kcontext->x1 = (u64)arg;
     // 3. activate the proc and return its pid
     activate_proc(p);
-    release_spinlock(&processlock);
+    write_unlock(&processlock);
     return p->pid;
 }
 
 int wait(int *exitcode) { // TODO:
     // 1. return -1 if no children
     // init_list_node里面初始化prev和next都是自己，所以要是没有子进程，也就意味着next等于自己
-    acquire_spinlock(&processlock);
-    if(thisproc()->children.next == &thisproc()->children) { release_spinlock(&processlock); return -1; }
+    read_lock(&processlock);
+    if(thisproc()->children.next == &thisproc()->children) { read_unlock(&processlock); return -1; }
     // 2. wait for childexit
     // 等不到有子进程退出，直接返回-1。
-    release_spinlock(&processlock);
+    read_unlock(&processlock);
     if(!wait_sem(&thisproc()->childexit)) { return -1; }
     // NOTE: be careful of concurrency
-    acquire_spinlock(&processlock);
-    acquire_sched_lock();
+    write_lock(&processlock);
     // 3. if any child exits, clean it up and return its pid and exitcode
+    // is_zombie 要拿子进程所在 CPU 的队列锁：子进程把自己标成 ZOMBIE 后，
+    // 直到切换走才释放这把锁，所以看到 ZOMBIE 时它的内核栈已经不再使用。
     Proc* zombienode = NULL;
     int zombieid = -1;
     _for_in_list(p, &thisproc()->children) {
         if(p == &thisproc()->children) continue;
         auto childproc = container_of(p, Proc, ptnode);
-        if(childproc->state == ZOMBIE) { zombienode = childproc; break; }
+        if(is_zombie(childproc)) { zombienode = childproc; break; }
     }
     if(zombienode) {
         *exitcode = zombienode->exitcode;  // 修改为这个僵尸进程的exitcode
         zombieid = zombienode->pid;  // 记录这个僵尸进程的pid，准备退出
-        release_sched_lock();
-        acquire_sched_lock();
         _detach_from_list(&zombienode->ptnode);  // 释放资源
-        _detach_from_list(&zombienode->schinfo.rqnode);
         kfree_page(zombienode->kstack);
-        kfree(zombienode);
+        kmem_cache_free(proc_cache, zombienode);
     }
-    release_sched_lock();
-    release_spinlock(&processlock);
+    write_unlock(&processlock);
     return zombieid;
 }
 
 NO_RETURN void exit(int code) { // TODO:
     ASSERT(thisproc()!=&root_proc && thisproc()->pid!=-1);
+    // release files and the address space first: closing a file or writing back
+    // a shared mapping may sleep, so it must not happen under the locks below
+    for(int i = 0; i < NOPENFILE; ++i) {
+        if(thisproc()->oftable.openfilelist[i] != NULL) {
+            file_close(thisproc()->oftable.openfilelist[i]);
+            thisproc()->oftable.openfilelist[i] = NULL;
+        }
+    }
+    free_pgdir(&thisproc()->pgdir);
+    attach_pgdir(&thisproc()->pgdir);
     // NOTE: be careful of concurrency
-    acquire_spinlock(&processlock);
-    acquire_sched_lock();
+    // 运行队列锁是每个 CPU 一把，唤醒别的进程（post_sem）时可能要拿本 CPU 的锁，
+    // 所以只在最后 sched 之前才拿本 CPU 的锁。
+    write_lock(&processlock);
     // 1. set the exitcode
     thisproc()->exitcode = code;
     // 2. clean up the resources
@@ -131,10 +143,8 @@ NO_RETURN void exit(int code) { // TODO:
         if(p == &thisproc()->children) continue;
         auto childproc = container_of(p, Proc, ptnode);
         childproc->parent = &root_proc;  // 更新父进程为root进程
-        if(childproc->state == ZOMBIE) {
-            release_sched_lock();
+        if(is_zombie(childproc)) {
             post_sem(&root_proc.childexit);
-            acquire_sched_lock();
         }
     }
     if(!_empty_list(&thisproc()->children)) {
@@ -142,13 +152,6 @@ NO_RETURN void exit(int code) { // TODO:
         _detach_from_list(&thisproc()->children);
     }
 
-    // release files used by this proc
-    for(int i = 0; i < NOPENFILE; ++i) {
-        if(thisproc()->oftable.openfilelist[i] != NULL) {
-            file_close(thisproc()->oftable.openfilelist[i]);
-            thisproc()->oftable.openfilelist[i] = NULL;
-        }
-    }
 /*
     // release current working dictionary
     OpContext ctx;
@@ -158,15 +161,11 @@ NO_RETURN void exit(int code) { // TODO:
     thisproc()->cwd = NULL;
 */
     // 4. sched(ZOMBIE)
-    release_sched_lock();
-    release_spinlock(&processlock);
-    acquire_spinlock(&processlock);
-    acquire_sched_lock();
-    free_pgdir(&thisproc()->pgdir);
-    release_sched_lock();
+    // 父进程被唤醒后要先拿 processlock，再等本 CPU 的队列锁（见 wait），
+    // 所以它看到 ZOMBIE 时本进程已经切换走了。
     post_sem(&thisproc()->parent->childexit);
     acquire_sched_lock();
-    release_spinlock(&processlock);
+    write_unlock(&processlock);
     sched(ZOMBIE);
     PANIC(); // prevent the warning of 'no_return function returns'
 }
@@ -184,23 +183,62 @@ Proc* find_proc(int pid, Proc* current_proc) {
 
 // 遍历进程树，搜索指定pid且状态不为unused的进程
 int kill(int pid) { // TODO:
-    acquire_spinlock(&processlock);
+    // 查找和设置 killed 在同一次读锁内完成，进程不会在中途被 wait 回收
+    read_lock(&processlock);
     Proc* kill_proc = find_proc(pid,&root_proc);
-    release_spinlock(&processlock);
     // Set the killed flag of the proc to true and return 0.
     if (kill_proc) {
-        acquire_spinlock(&processlock);
         kill_proc->killed = true;
         // activate_proc(kill_proc);
         alert_proc(kill_proc);  // _activate_proc(proc, true)
-        release_spinlock(&processlock);
-        return 0;
     }
+    read_unlock(&processlock);
     // Return -1 if the pid is invalid (proc not found).
-    return -1;
+    return kill_proc ? 0 : -1;
 }
 
 
+// 调度属性的读写，pid 为 0 表示当前进程。在 processlock 的读锁下查找，进程不会在中途被回收。
+int get_sched_attr(int pid, struct sched_attr *attr) {
+    read_lock(&processlock);
+    Proc* p = pid ? find_proc(pid, &root_proc) : thisproc();
+    if (p) sched_getattr(p, attr);
+    read_unlock(&processlock);
+    return p ? 0 : -1;
+}
+
+int set_sched_attr(int pid, const struct sched_attr *attr) {
+    read_lock(&processlock);
+    Proc* p = pid ? find_proc(pid, &root_proc) : thisproc();
+    int r = p ? sched_setattr(p, attr) : -1;
+    read_unlock(&processlock);
+    return r;
+}
+
+int get_affinity(int pid, u64 *mask) {
+    read_lock(&processlock);
+    Proc* p = pid ? find_proc(pid, &root_proc) : thisproc();
+    if (p) *mask = sched_getaffinity(p);
+    read_unlock(&processlock);
+    return p ? 0 : -1;
+}
+
+int set_affinity(int pid, u64 mask) {
+    read_lock(&processlock);
+    Proc* p = pid ? find_proc(pid, &root_proc) : thisproc();
+    int r = p ? sched_setaffinity(p, mask) : -1;
+    read_unlock(&processlock);
+    return r;
+}
+
+int get_proc_sched_stat(int pid, struct proc_sched_stat *st) {
+    read_lock(&processlock);
+    Proc* p = pid ? find_proc(pid, &root_proc) : thisproc();
+    if (p) sched_getstat(p, st);
+    read_unlock(&processlock);
+    return p ? 0 : -1;
+}
+
 /*
  * Create a new process copying p as the parent.
  * Sets up stack to return as if from system call.
@@ -220,6 +258,8 @@ int fork() {
     struct Proc* child_proc = create_proc();
     struct Proc* this_proc = thisproc();
     set_parent_to_this(child_proc);
+    sched_fork(child_proc, this_proc);
+    fpsimd_fork(child_proc, this_proc);
     // copy all registers
     memmove(child_proc->ucontext, this_proc->ucontext, sizeof(UserContext));
     // fork return as child
@@ -232,23 +272,26 @@ int fork() {
             child_proc->oftable.openfilelist[i] = file_dup(this_proc->oftable.openfilelist[i]);
         }
     }
-    // copy pgdir
+    // copy pgdir (copy on write)
+    // 父子进程共享所有物理页：可写的私有页在双方页表中都改成只读，
+    // 谁先写谁在 pgfault_handler 里复制一份。MAP_SHARED 的页保持可写、真正共享。
     PTEntriesPtr old_pte;
     _for_in_list(node, &(this_proc->pgdir.section_head)){
         if(node == &(this_proc->pgdir.section_head)) {
             break;
         }
         struct section* st = container_of(node, struct section, stnode);
-        // fork without cow
         for(u64 va = PAGE_BASE(st->begin); va < st->end; va += PAGE_SIZE){
              old_pte = get_pte(&(this_proc->pgdir), va, false);
              if((old_pte == NULL) || !(*old_pte & PTE_VALID)) continue;
-             void* new_page = kalloc_page();
-             vmmap(&(child_proc->pgdir), va, new_page, PTE_FLAGS(*old_pte));
-             copyout(&(child_proc->pgdir), (void*)va, (void*)P2K(PTE_ADDRESS(*old_pte)), PAGE_SIZE);
+             if(!(st->flags & ST_MMAP_SHARED)) *old_pte |= PTE_RO;
+             else if(!(*old_pte & PTE_RO)) share_file_page(st, va);
+             vmmap(&(child_proc->pgdir), va, (void*)P2K(PTE_ADDRESS(*old_pte)), PTE_FLAGS(*old_pte));
         }
     }
-    copy_sections(&(this_proc->pgdir.section_head), &(child_proc->pgdir.section_head));
+    // 父进程的页表项被改成了只读，旧的可写 TLB 项必须作废（只作废父进程的 ASID）
+    flush_tlb_pgdir(&(this_proc->pgdir));
+    copy_sections(&(this_proc->pgdir), &(child_proc->pgdir));
 
     // start proc
     start_proc(child_proc, trap_return, 0);
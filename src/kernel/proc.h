@@ -4,6 +4,7 @@
 #include <common/sem.h>
 #include <common/rbtree.h>
 #include <common/spinlock.h>
+#include <common/seqlock.h>
 #include <kernel/pt.h>
 #include <fs/file.h>
 #include <fs/inode.h>
@@ -13,11 +14,18 @@ enum procstate { UNUSED, RUNNABLE, RUNNING, SLEEPING, DEEPSLEEPING, ZOMBIE };
 
 typedef struct UserContext {
     // TODO: customize your trap frame
-    u64 q0[2];
+    // FP/SIMD 寄存器不在这里，内核不用它们，见 struct fpsimd_state
     u64 spsr; u64 elr; u64 sp; u64 tpidr0;
     u64 x[32]; // 对应trap.S中
 } UserContext;
 
+// 用户态的 FP/SIMD 寄存器，布局与 aarch64/fpsimd.S 一致
+struct fpsimd_state {
+    u64 vregs[64];  // q0~q31
+    u32 fpsr;
+    u32 fpcr;
+} __attribute__((aligned(16)));
+
 // 考虑到aarch64对栈指针的16bytes对齐限制，kcontext最好是16的倍数（包是的）
 typedef struct KernelContext {
     // TODO: customize your context
@@ -29,7 +37,21 @@ typedef struct KernelContext {
 // embeded data for procs
 struct schinfo {
     // TODO: customize your sched info
-    ListNode rqnode;  // all the runnable/running processes
+    struct rb_node_ rbnode;  // 挂在所属 CPU 的运行队列上（仅 RUNNABLE 时）
+    ListNode rtnode;  // 实时进程挂在 rt_rq 上，不用 rbnode
+    int policy;  // SCHED_NORMAL/SCHED_FIFO/SCHED_RR/SCHED_IDLE
+    int rt_priority;  // 实时优先级 1..99，越大越优先；非实时进程为 0
+    int nice;  // -20..19，决定普通进程的权重
+    u32 weight;
+    SeqLock attr_seq;  // 让 getattr/fork 不拿队列锁也能读到一致的 policy/rt_priority/nice/weight
+    int cpu;  // 所属 CPU，由该 CPU 的队列锁保护 state 与 rbnode
+    u64 vruntime;  // 已运行的虚拟时间（ns），运行队列按它排序
+    u64 exec_start;  // 本次开始运行（或上次记账）的时间戳
+    u64 sum_exec;  // 累计运行时间（ns）
+    bool on_rq;  // 在所属 CPU 的 rq/rt_rq 上
+    u64 cpus_allowed;  // 第 i 位为 1 表示允许在 CPU i 上运行，fork 时继承
+    u64 nr_migrations;  // 换过几次 CPU
+    u64 nr_switches;  // 被切换上 CPU 的次数
 };
 
 typedef struct Proc {
@@ -48,10 +70,12 @@ typedef struct Proc {
     void *kstack;  // 内核程序运行时使用的栈
     UserContext *ucontext;  // 用户态上下文，用于保存用户态的寄存器信息，也称作 trap frame
     KernelContext *kcontext;  // 内核态上下文，用于保存内核态的寄存器信息。
-    int timeload;  // 时间负载，衡量当前进程的cpu占用率
     struct oftable oftable;
     Inode *cwd;
     struct vma *vma;
+    u64 exec_start;  // execve 开始的时间戳，新程序第一次系统调用时统计并清零
+    struct fpsimd_state fpsimd;  // 不在寄存器中时保存在这里
+    int fpsimd_cpu;  // 最后一次把 fpsimd 装进寄存器的 CPU，-1 表示没有
 } Proc;
 
 void init_kproc();
@@ -63,10 +87,20 @@ WARN_RESULT Proc *create_proc();
 int start_proc(Proc *, void (*entry)(u64), u64 arg);
 // 当子进程 exit 退出后，父进程会负责管理并回收子进程的资源
 NO_RETURN void exit(int code);
+// execve 到新程序第一次系统调用之间的延迟（cntpct cycles）
+void exec_latency_record(u64 cycles);
+void get_exec_stat(u64 *cnt, u64 *cycles, u64 *last);
 // 并且获取子进程退出的信息 exitcode
 WARN_RESULT int wait(int *exitcode);
 WARN_RESULT int kill(int pid);
 WARN_RESULT int fork();
+struct sched_attr;
+WARN_RESULT int get_sched_attr(int pid, struct sched_attr *attr);
+WARN_RESULT int set_sched_attr(int pid, const struct sched_attr *attr);
+struct proc_sched_stat;
+WARN_RESULT int get_affinity(int pid, u64 *mask);
+WARN_RESULT int set_affinity(int pid, u64 mask);
+WARN_RESULT int get_proc_sched_stat(int pid, struct proc_sched_stat *st);
 
 void set_parent_to_this(struct Proc*);
 
@@ -1,5 +1,6 @@
 #include <aarch64/intrinsic.h>
 #include <common/string.h>
+#include <kernel/cpu.h>
 #include <kernel/mem.h>
 #include <kernel/pt.h>
 #include <kernel/printk.h>
@@ -18,8 +19,7 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) { // TODO:
     PTEntriesPtr pt0 = pgdir->pt, pt1 = NULL, pt2 = NULL, pt3 = NULL;
     if(pt0 == NULL) {
         if(alloc) {
-            pgdir->pt = kalloc_page();
-            memset(pgdir->pt,0,PAGE_SIZE);
+            pgdir->pt = kalloc_zeroed_page();
         }
         else return NULL;
     }
@@ -27,8 +27,7 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) { // TODO:
     pt1 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt0[VA_PART0(va)]));
     if(!(pt0[VA_PART0(va)] & PTE_VALID)){
         if(alloc){
-            pt1 = kalloc_page();
-            memset(pt1,0,PAGE_SIZE);
+            pt1 = kalloc_zeroed_page();
             pt0[VA_PART0(va)] = K2P(pt1) | PTE_TABLE;
         }
         else return NULL;
@@ -36,8 +35,7 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) { // TODO:
     pt2 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt1[VA_PART1(va)]));
     if(!(pt1[VA_PART1(va)] & PTE_VALID)){
         if(alloc){
-            pt2 = kalloc_page();
-            memset(pt2,0,PAGE_SIZE);
+            pt2 = kalloc_zeroed_page();
             pt1[VA_PART1(va)] = K2P(pt2) | PTE_TABLE;
         }
         else return NULL;
@@ -45,8 +43,7 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) { // TODO:
     pt3 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt2[VA_PART2(va)]));
     if(!(pt2[VA_PART2(va)] & PTE_VALID)){
         if(alloc){
-            pt3 = kalloc_page();
-            memset(pt3,0,PAGE_SIZE);
+            pt3 = kalloc_zeroed_page();
             pt2[VA_PART2(va)] = K2P(pt3) | PTE_TABLE;
         }
         else return NULL;
@@ -55,12 +52,16 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) { // TODO:
 }
 
 void init_pgdir(struct pgdir *pgdir) {
-    init_spinlock(&(pgdir->lock));
-    void* p = kalloc_page();
-    memset(p,0,PAGE_SIZE);
+    init_spinlock(&(pgdir->lock), "pgdir");
+    void* p = kalloc_zeroed_page();
     pgdir->pt = (PTEntriesPtr)p;
     init_list_node(&(pgdir->section_head));
-    init_sections(&pgdir->section_head);
+    pgdir->section_tree.rb_node = NULL;
+    pgdir->last_hit = NULL;
+    pgdir->asid = 0;
+    pgdir->cpu_state = 0;
+    pgdir->flush_cpus = 0;
+    init_sections(pgdir);
 }
 
 void free_pgdir(struct pgdir* pgdir) { // TODO
@@ -90,11 +91,201 @@ void free_pgdir(struct pgdir* pgdir) { // TODO
     pgdir->pt = NULL;
 }
 
+// ASID 分配（做法同 Linux）：pgdir 第一次装入 TTBR0 时分到一个 ASID，用户页表项带 nG 位，
+// TLB 项按 ASID 区分，切换进程时不用刷 TLB。pgdir->asid 的高位是分配时的代号（generation），
+// ASID 用完时代号加一，之前分配的 ASID 全部作废，各 CPU 在下次切换时刷一次本地 TLB；
+// 换代时各 CPU 正在用的 ASID 保留给原来的 pgdir，因为这些 CPU 上还有它们的 TLB 项。
+// 释放的 pgdir 不归还 ASID，它的 TLB 项到换代时才被刷掉，在那之前这个 ASID 不会再分出去。
+#define NUM_ASIDS (1 << ASID_BITS)
+#define ASID_MASK (NUM_ASIDS - 1ull)
+#define ASID_FIRST_GEN ((u64)NUM_ASIDS)
+// flush_tlb_range 超过这么多页时直接作废整个 ASID
+#define TLB_FLUSH_MAX_PAGES 64
+
+static SpinLock asid_lock;  // 保护下面除 active_asids 外的全部状态
+static u64 asid_generation = ASID_FIRST_GEN;
+static u64 asid_map[NUM_ASIDS / 64];  // 本代已分配的 ASID
+static u64 asid_next = 1;
+static u64 active_asids[NCPU];  // 各 CPU 正在用的 ASID，换代时清零
+static u64 reserved_asids[NCPU];  // 换代时各 CPU 在用的 ASID
+static u64 tlb_flush_pending;  // 第 i 位为 1：CPU i 下次分配 ASID 前要刷本地 TLB
+static struct asid_stat asid_stat;
+static struct pgdir *attached[NCPU];  // 各 CPU 的 TTBR0 当前装的 pgdir
+
+#define PGDIR_ACTIVE(cpu) (1ull << (cpu))
+#define PGDIR_STALE(cpu) (1ull << (32 + (cpu)))
+#define PGDIR_ACTIVE_MASK 0xffffffffull
+
+static INLINE bool asid_used(u64 idx) { return asid_map[idx / 64] >> (idx % 64) & 1; }
+static INLINE void asid_set_used(u64 idx) { asid_map[idx / 64] |= 1ull << (idx % 64); }
+
+static void flush_context() {
+    memset(asid_map, 0, sizeof(asid_map));
+    for (int i = 0; i < NCPU; i++) {
+        u64 asid = __atomic_exchange_n(&active_asids[i], 0, __ATOMIC_RELAXED);
+        // 上次换代后这个 CPU 还没有切换过地址空间，继续保留之前那个
+        if (asid == 0) asid = reserved_asids[i];
+        asid_set_used(asid & ASID_MASK);
+        reserved_asids[i] = asid;
+    }
+    asid_set_used(0);
+    tlb_flush_pending = (1ull << NCPU) - 1;
+}
+
+static u64 find_free_asid() {
+    for (u64 idx = asid_next; idx < NUM_ASIDS; idx++)
+        if (!asid_used(idx)) return idx;
+    for (u64 idx = 1; idx < asid_next; idx++)
+        if (!asid_used(idx)) return idx;
+    return 0;
+}
+
+// 为 pd 分配本代的 ASID，调用者持有 asid_lock
+static u64 new_context(struct pgdir *pd) {
+    u64 asid = pd->asid, gen = asid_generation;
+    if (asid != 0) {
+        u64 newasid = gen | (asid & ASID_MASK);
+        bool reserved = false;
+        for (int i = 0; i < NCPU; i++) {
+            if (reserved_asids[i] == asid) {
+                reserved_asids[i] = newasid;
+                reserved = true;
+            }
+        }
+        // 换代前分配的 ASID 在本代还没人用，就接着用它
+        if (reserved || !asid_used(asid & ASID_MASK)) {
+            asid_set_used(asid & ASID_MASK);
+            return newasid;
+        }
+    }
+    u64 idx = find_free_asid();
+    if (idx == 0) {
+        gen = __atomic_add_fetch(&asid_generation, ASID_FIRST_GEN, __ATOMIC_RELAXED);
+        flush_context();
+        asid_stat.rollover++;
+        asid_next = 1;
+        idx = find_free_asid();
+        ASSERT(idx != 0);
+    }
+    asid_set_used(idx);
+    asid_next = idx + 1;
+    asid_stat.alloc++;
+    // 新分到的 ASID 在各 CPU 上都要等刷过本地 TLB 才会用，之前记下的残留 TLB 项都不用管了
+    __atomic_fetch_and(&pd->cpu_state, PGDIR_ACTIVE_MASK, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&pd->flush_cpus, 0, __ATOMIC_SEQ_CST);
+    return gen | idx;
+}
+
+// 本 CPU 离开上一个 pgdir：在它的 cpu_state 里从“正在用”变成“可能有残留的 TLB 项”，
+// 两位一起改，flush_tlb_range 不会漏看这个 CPU。
+static void detach_prev(int cpu, struct pgdir *pgdir) {
+    struct pgdir *prev = attached[cpu];
+    attached[cpu] = pgdir;
+    if (prev == NULL || prev == pgdir) return;
+    u64 old = __atomic_load_n(&prev->cpu_state, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&prev->cpu_state, &old,
+                                        (old & ~PGDIR_ACTIVE(cpu)) | PGDIR_STALE(cpu), false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        ;
+}
+
 void attach_pgdir(struct pgdir *pgdir) {
     extern PTEntries invalid_pt;
-    if (pgdir->pt) arch_set_ttbr0(K2P(pgdir->pt));
-    else arch_set_ttbr0(K2P(&invalid_pt));
-    // arch_tlbi_vmalle1is();
+    int cpu = cpuid();
+    // invalid_pt 里没有映射，用 ASID 0 即可；active_asids 保持不变，本 CPU 上还有那个 ASID 的 TLB 项
+    if (pgdir->pt == NULL) {
+        detach_prev(cpu, NULL);
+        arch_set_ttbr0_asid(K2P(&invalid_pt), 0);
+        return;
+    }
+    detach_prev(cpu, pgdir);
+    u64 asid = __atomic_load_n(&pgdir->asid, __ATOMIC_RELAXED);
+    u64 old_active = __atomic_load_n(&active_asids[cpu], __ATOMIC_RELAXED);
+    // 快速路径：ASID 属于当前这一代，且没有在换代（换代会把 active_asids 清零）
+    bool fast = old_active != 0 &&
+                ((asid ^ __atomic_load_n(&asid_generation, __ATOMIC_RELAXED)) >> ASID_BITS) == 0 &&
+                __atomic_compare_exchange_n(&active_asids[cpu], &old_active, asid, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    if (!fast) {
+        acquire_spinlock(&asid_lock);
+        asid = pgdir->asid;
+        if ((asid ^ asid_generation) >> ASID_BITS) {
+            asid = new_context(pgdir);
+            __atomic_store_n(&pgdir->asid, asid, __ATOMIC_RELEASE);
+        }
+        if (tlb_flush_pending >> cpu & 1) {
+            tlb_flush_pending &= ~(1ull << cpu);
+            arch_tlbi_vmalle1();
+        }
+        __atomic_store_n(&active_asids[cpu], asid, __ATOMIC_RELAXED);
+        release_spinlock(&asid_lock);
+    }
+    // 先登记正在用，再看有没有被推迟的作废，与 flush_tlb_range 的顺序相反，两边至少有一边能看到对方
+    __atomic_fetch_or(&pgdir->cpu_state, PGDIR_ACTIVE(cpu), __ATOMIC_SEQ_CST);
+    if (__atomic_fetch_and(&pgdir->flush_cpus, ~(1ull << cpu), __ATOMIC_SEQ_CST) >> cpu & 1)
+        arch_tlbi_aside1(asid & ASID_MASK);
+    arch_set_ttbr0_asid(K2P(pgdir->pt), asid & ASID_MASK);
+}
+
+// 作废 pgdir 的 TLB 项，只打扰可能用到旧 TLB 项的 CPU：
+// 1. 用过它、但现在没在用它的 CPU 不作废，记进 flush_cpus，等它们再次装入这个 pgdir 时作废整个 ASID；
+// 2. 只有本 CPU 在用它时用不广播的 tlbi；
+// 3. 还有别的 CPU 正在用它时（同一个地址空间同时在多个 CPU 上运行）才用广播的 tlbi。
+// 广播的 tlbi 由硬件在所有核上完成，不需要发 SGI 等对方响应；内核中大部分时间关着中断，
+// 靠 SGI 等待对方作废反而可能等很久甚至死锁。begin >= end 表示作废整个 ASID。
+static void shootdown(struct pgdir *pgdir, u64 begin, u64 end) {
+    // 先让页表项的修改对所有 CPU 可见，再读 ASID
+    arch_fence();
+    u64 asid = __atomic_load_n(&pgdir->asid, __ATOMIC_ACQUIRE) & ASID_MASK;
+    // 从没装入过 TTBR0 的 pgdir 没有 TLB 项
+    if (asid == 0) return;
+    int cpu = cpuid();
+    u64 old = __atomic_fetch_and(&pgdir->cpu_state, PGDIR_ACTIVE_MASK, __ATOMIC_SEQ_CST);
+    u64 stale = (old >> 32) & ~(1ull << cpu);
+    if (stale) {
+        __atomic_fetch_or(&pgdir->flush_cpus, stale, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&asid_stat.flush_deferred, __builtin_popcountll(stale), __ATOMIC_RELAXED);
+    }
+    // 登记 flush_cpus 之后再看一次谁在用，与 attach_pgdir 配合
+    bool broadcast = (__atomic_load_n(&pgdir->cpu_state, __ATOMIC_SEQ_CST) | old) &
+                     PGDIR_ACTIVE_MASK & ~PGDIR_ACTIVE(cpu);
+    u64 npages = begin < end ? (end - PAGE_BASE(begin) + PAGE_SIZE - 1) / PAGE_SIZE : 0;
+    if (npages == 0 || npages > TLB_FLUSH_MAX_PAGES) {
+        if (broadcast) arch_tlbi_aside1is(asid);
+        else arch_tlbi_aside1(asid);
+        __atomic_fetch_add(&asid_stat.flush_asid, 1, __ATOMIC_RELAXED);
+    } else {
+        for (u64 va = PAGE_BASE(begin); va < end; va += PAGE_SIZE) {
+            if (broadcast) __arch_tlbi_vae1is(asid, va);
+            else __arch_tlbi_vae1(asid, va);
+        }
+        arch_fence();
+        __atomic_fetch_add(&asid_stat.flush_va, npages, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(broadcast ? &asid_stat.flush_broadcast : &asid_stat.flush_local, 1,
+                       __ATOMIC_RELAXED);
+}
+
+void flush_tlb_range(struct pgdir *pgdir, u64 begin, u64 end) {
+    if (begin < end) shootdown(pgdir, begin, end);
+}
+
+void flush_tlb_page(struct pgdir *pgdir, u64 va) {
+    shootdown(pgdir, va, PAGE_BASE(va) + PAGE_SIZE);
+}
+
+void flush_tlb_pgdir(struct pgdir *pgdir) {
+    shootdown(pgdir, 0, 0);
+}
+
+void get_asid_stat(struct asid_stat *st) {
+    st->alloc = __atomic_load_n(&asid_stat.alloc, __ATOMIC_RELAXED);
+    st->rollover = __atomic_load_n(&asid_stat.rollover, __ATOMIC_RELAXED);
+    st->flush_va = __atomic_load_n(&asid_stat.flush_va, __ATOMIC_RELAXED);
+    st->flush_asid = __atomic_load_n(&asid_stat.flush_asid, __ATOMIC_RELAXED);
+    st->flush_local = __atomic_load_n(&asid_stat.flush_local, __ATOMIC_RELAXED);
+    st->flush_broadcast = __atomic_load_n(&asid_stat.flush_broadcast, __ATOMIC_RELAXED);
+    st->flush_deferred = __atomic_load_n(&asid_stat.flush_deferred, __ATOMIC_RELAXED);
 }
 
 /**
@@ -109,9 +300,7 @@ void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags) {
     *ptentry_ptr = K2P(ka0);
     *ptentry_ptr |= flags;
     u64 page_num = ((u64)K2P(ka0))/PAGE_SIZE;
-    acquire_spinlock(&(pages_ref[page_num].ref_lock));
     increment_rc(&(pages_ref[page_num].ref));
-    release_spinlock(&(pages_ref[page_num].ref_lock));
     /* (Final) TODO END */
 }
 
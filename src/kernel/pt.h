@@ -1,17 +1,38 @@
 #pragma once
 #include <aarch64/mmu.h>
 #include <common/list.h>
+#include <common/rbtree.h>
 #include <common/spinlock.h>
+#include <kernel/kstat.h>
 
 struct pgdir {
     PTEntriesPtr pt;
     SpinLock lock;
     ListNode section_head;
+    // sections indexed by address (an interval tree keyed by begin, augmented
+    // with the max end of each subtree), and the last section found in it
+    struct rb_root_ section_tree;
+    struct section *last_hit;
+    struct section *heap;
+    u64 asid;  // 分配时的代号 | ASID（低 ASID_BITS 位），0 表示还没装入过 TTBR0
+    // 第 i 位：CPU i 正在用它；第 32 + i 位：CPU i 用过它，可能还有它的 TLB 项
+    u64 cpu_state;
+    u64 flush_cpus;  // 第 i 位：CPU i 再次装入它之前要先作废整个 ASID
 };
 
+// 8 位 ASID（TCR_EL1.AS = 0），ASID 0 留给 invalid_pt
+#define ASID_BITS 8
+
 void init_pgdir(struct pgdir *pgdir);
 WARN_RESULT PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc);
 void free_pgdir(struct pgdir *pgdir);
 void attach_pgdir(struct pgdir *pgdir);
+// invalidate the TLB entries of pgdir on all CPUs: one page, the pages in
+// [begin, end) (the whole ASID if the range is large), or everything.
+// CPUs that only hold leftover entries are not interrupted, see flush_tlb_range.
+void flush_tlb_page(struct pgdir *pgdir, u64 va);
+void flush_tlb_range(struct pgdir *pgdir, u64 begin, u64 end);
+void flush_tlb_pgdir(struct pgdir *pgdir);
+void get_asid_stat(struct asid_stat *st);
 void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags);
 int copyout(struct pgdir *pd, void *va, void *p, usize len);
\ No newline at end of file
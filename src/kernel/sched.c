@@ -6,36 +6,81 @@
 #include <kernel/cpu.h>
 #include <common/rbtree.h>
 #include <driver/clock.h>
+#include <driver/gicv3.h>
+#include <driver/interrupt.h>
+#include <kernel/fpsimd.h>
 
 extern void swtch(KernelContext* new_ctx, KernelContext** old_ctx);
 
 extern bool panic_flag;
-static SpinLock schedulerlock;  // 调度器锁
-ListNode rq;  // runnable/running queue
+
+// 每个 CPU 一个运行队列，各用各的锁（struct sched 中的 lock）。
+// 一个进程的 state 与 rbnode 由 p->schinfo.cpu 所指 CPU 的队列锁保护；
+// 只有同时持有新旧两个 CPU 的锁才能修改 p->schinfo.cpu。
+#define SCHED_IMBALANCE 2  // 两个 CPU 上的进程数相差至少这么多才迁移
+#define SCHED_BALANCE_TICKS 4  // 每隔几次调度时钟做一次周期性负载均衡
+
+// CFS：运行队列是按 vruntime（实际运行的纳秒数）排序的红黑树，总是挑 vruntime 最小的进程。
+// 在 SCHED_LATENCY_NS 内让每个可运行进程都轮到一次，时间片为其均分，但不短于下限。
+#define SCHED_LATENCY_NS 24000000ll
+#define SCHED_MIN_GRANULARITY_NS 3000000ll
+// 调度类：实时进程（SCHED_FIFO/SCHED_RR）总是先于其它进程运行，按 rt_priority 从高到低，
+// 同优先级先来先服务，RR 进程每 SCHED_RR_SLICE_MS 轮转一次。普通进程与 SCHED_IDLE 进程
+// 都在 CFS 红黑树里，vruntime 按权重折算，SCHED_IDLE 的权重极小，只捡别人剩下的时间。
+#define SCHED_RR_SLICE_MS 100
+#define NICE_0_WEIGHT 1024
+#define SCHED_IDLE_WEIGHT 3
+
+// nice -20..19 对应的权重，相邻两级约差 1.25 倍，即 CPU 时间约差 10%（与 Linux 相同）
+static const u32 nice_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
+// 被唤醒的进程的 vruntime 要比当前进程小这么多才抢占它，避免来回切换
+#define SCHED_WAKEUP_GRANULARITY_NS 1000000ll
+// 调度时钟只在本 CPU 有进程排队时才开，空闲的 CPU 完全不开时钟，
+// 别的 CPU 往它的队列里放了进程或者有活可偷时，用 IPI_RESCHED 叫醒它。
 
 static struct timer sched_timer[NCPU];  // lab3-时钟中断，调度时钟
+static void kick_idle_cpu();
 void sched_timer_handler(struct timer* t) {
-    t->elapse = 8;
+    (void)t;
     acquire_sched_lock();
+    auto s = &cpus[cpuid()].sched;
+    if (++s->ticks % SCHED_BALANCE_TICKS == 0) {
+        s->need_balance = true;
+        // 本 CPU 有进程在排队而别的 CPU 闲着：叫醒一个空闲的 CPU 来偷
+        if (s->nr_queued > 0)
+            kick_idle_cpu();
+    }
     sched(RUNNABLE);
 }
 
+static void resched_ipi_handler();
+
 void init_sched(){
     // TODO: initialize the scheduler
     // 1. initialize the resources (e.g. locks, semaphores)
-    init_list_node(&rq);
-    init_spinlock(&schedulerlock);
     for (int i = 0; i < NCPU; i++) {
+        init_spinlock(&cpus[i].sched.lock, "schedulerlock");
+        cpus[i].sched.rq.rb_node = NULL;
+        for (int j = 0; j < SCHED_RT_PRIO_LEVELS; j++)
+            init_list_node(&cpus[i].sched.rt_rq[j]);
         sched_timer[i].triggered = true;
-        sched_timer[i].elapse = 8;
+        sched_timer[i].elapse = SCHED_LATENCY_NS / 1000000;
         sched_timer[i].handler = &sched_timer_handler;
     }
+    set_interrupt_handler(IPI_RESCHED, resched_ipi_handler);
     // 2. initialize the scheduler info of each CPU
     for (int i = 0; i < NCPU; i++) {
         Proc* p = kalloc(sizeof(Proc));
         p->idle = true;
         p->state = RUNNING;
         p->pid = -1;
+        p->schinfo.cpu = i;
         cpus[i].sched.thisproc = cpus[i].sched.idle = p;
         // idle进程是一个特殊的进程，也游离在进程树之外，所有永远不会进入rq，所以schinfo不用管，
         // 类似的，其它几个量也就不用初始化了，都和idle进程没什么关系。
@@ -45,94 +90,451 @@ void init_sched(){
 // TODO: return the current process
 Proc *thisproc() { return cpus[cpuid()].sched.thisproc; }
 // TODO: initialize your customized schinfo for every newly-created process
-void init_schinfo(struct schinfo *p) { init_list_node(&p->rqnode); }
+void init_schinfo(struct schinfo *p) {
+    init_list_node(&p->rtnode);
+    p->on_rq = false;
+    p->cpus_allowed = SCHED_ALL_CPUS;
+    p->nr_migrations = 0;
+    p->nr_switches = 0;
+    p->policy = SCHED_NORMAL;
+    p->rt_priority = 0;
+    p->nice = 0;
+    p->weight = NICE_0_WEIGHT;
+    init_seqlock(&p->attr_seq, "sched_attr");
+    p->cpu = cpuid();
+    p->vruntime = 0;
+    p->exec_start = 0;
+    p->sum_exec = 0;
+}
+
+// 先试一次，失败了才记一次争用再自旋
+static void acquire_rq_lock(int cpu) {
+    auto s = &cpus[cpu].sched;
+    __atomic_fetch_add(&s->stat.lock_acquire, 1, __ATOMIC_RELAXED);
+    if (try_acquire_spinlock(&s->lock)) return;
+    __atomic_fetch_add(&s->stat.lock_contended, 1, __ATOMIC_RELAXED);
+    acquire_spinlock(&s->lock);
+}
+static void release_rq_lock(int cpu) { release_spinlock(&cpus[cpu].sched.lock); }
+
+// 两把队列锁按 CPU 编号顺序获取，避免死锁
+static void acquire_two_rq_locks(int a, int b) {
+    if (a == b) { acquire_rq_lock(a); return; }
+    acquire_rq_lock(MIN(a, b));
+    acquire_rq_lock(MAX(a, b));
+}
+static void release_two_rq_locks(int a, int b) {
+    release_rq_lock(a);
+    if (a != b) release_rq_lock(b);
+}
+
+// 锁住 p 所在 CPU 的队列并返回该 CPU。拿锁前 p 可能刚被迁走，所以要复查。
+static int lock_proc_rq(Proc *p) {
+    while (1) {
+        int cpu = __atomic_load_n(&p->schinfo.cpu, __ATOMIC_RELAXED);
+        acquire_rq_lock(cpu);
+        if (p->schinfo.cpu == cpu) return cpu;
+        release_rq_lock(cpu);
+    }
+}
+
 // TODO: acquire the sched_lock if need
-void acquire_sched_lock() { acquire_spinlock(&schedulerlock); }
+void acquire_sched_lock() { acquire_rq_lock(cpuid()); }
 // TODO: release the sched_lock if need
-void release_sched_lock() { release_spinlock(&schedulerlock); }
+void release_sched_lock() { release_rq_lock(cpuid()); }
 
 // 判断一个进程状态是否是zombie
 bool is_zombie(Proc *p) {
-    bool r;
-    acquire_sched_lock();
-    r = p->state == ZOMBIE;
-    release_sched_lock();
+    int cpu = lock_proc_rq(p);
+    bool r = p->state == ZOMBIE;
+    release_rq_lock(cpu);
     return r;
 }
 bool is_unused(Proc *p) {
-    bool r;
+    int cpu = lock_proc_rq(p);
+    bool r = p->state == UNUSED;
+    release_rq_lock(cpu);
+    return r;
+}
+
+// vruntime 只增不减，用有符号差比较以容忍回绕
+static INLINE bool vruntime_before(u64 a, u64 b) { return (i64)(a - b) < 0; }
+
+static bool rq_cmp(rb_node lnode, rb_node rnode) {
+    u64 l = container_of(lnode, Proc, schinfo.rbnode)->schinfo.vruntime;
+    u64 r = container_of(rnode, Proc, schinfo.rbnode)->schinfo.vruntime;
+    if (l == r)
+        return lnode < rnode;
+    return vruntime_before(l, r);
+}
+
+static INLINE bool rt_policy(int policy) { return policy == SCHED_FIFO || policy == SCHED_RR; }
+static INLINE bool is_rt(Proc *p) { return rt_policy(p->schinfo.policy); }
+static INLINE bool cpu_allowed(Proc *p, int cpu) { return p->schinfo.cpus_allowed >> cpu & 1; }
+
+// 入队/出队，调用者持有该 CPU 的队列锁
+static void enqueue(int cpu, Proc *p) {
+    auto s = &cpus[cpu].sched;
+    ASSERT(cpu_allowed(p, cpu));
+    p->schinfo.on_rq = true;
+    if (is_rt(p)) {
+        int prio = p->schinfo.rt_priority;
+        _insert_into_list(s->rt_rq[prio].prev, &p->schinfo.rtnode);
+        s->rt_bitmap[prio / 64] |= 1ull << (prio % 64);
+    } else {
+        ASSERT(0 == _rb_insert(&p->schinfo.rbnode, &s->rq, rq_cmp));
+    }
+    s->nr_queued++;
+}
+static void dequeue(int cpu, Proc *p) {
+    auto s = &cpus[cpu].sched;
+    p->schinfo.on_rq = false;
+    if (is_rt(p)) {
+        int prio = p->schinfo.rt_priority;
+        _detach_from_list(&p->schinfo.rtnode);
+        if (_empty_list(&s->rt_rq[prio]))
+            s->rt_bitmap[prio / 64] &= ~(1ull << (prio % 64));
+    } else {
+        _rb_erase(&p->schinfo.rbnode, &s->rq);
+    }
+    s->nr_queued--;
+}
+
+// 队列中下一个该运行的进程：优先级最高的实时进程，没有则是 vruntime 最小的进程
+static Proc *first_queued(struct sched *s) {
+    for (int i = 1; i >= 0; i--) {
+        if (s->rt_bitmap[i]) {
+            int prio = i * 64 + 63 - __builtin_clzll(s->rt_bitmap[i]);
+            return container_of(s->rt_rq[prio].next, Proc, schinfo.rtnode);
+        }
+    }
+    rb_node first = _rb_first(&s->rq);
+    return first ? container_of(first, Proc, schinfo.rbnode) : NULL;
+}
+
+// 进程归属到/离开某个 CPU（排队或正在运行）时维护 nr_running 与 CFS 的总权重
+static void add_running(struct sched *s, Proc *p) {
+    s->nr_running++;
+    if (!is_rt(p)) s->cfs_load += p->schinfo.weight;
+}
+static void sub_running(struct sched *s, Proc *p) {
+    s->nr_running--;
+    if (!is_rt(p)) s->cfs_load -= p->schinfo.weight;
+}
+
+// vruntime 只在同一个 CPU 内可比：进程换 CPU 时保持它相对 min_vruntime 的位置
+static void migrate_vruntime(Proc *p, int from, int to) {
+    p->schinfo.vruntime = p->schinfo.vruntime - cpus[from].sched.min_vruntime +
+                          cpus[to].sched.min_vruntime;
+}
+
+// 把一个已计入 from 但不在运行的进程挪到 to 的队列上，调用者持有两边的队列锁
+static void move_proc(Proc *p, int from, int to) {
+    if (p->schinfo.on_rq) dequeue(from, p);
+    sub_running(&cpus[from].sched, p);
+    migrate_vruntime(p, from, to);
+    p->schinfo.cpu = to;
+    p->schinfo.nr_migrations++;
+    add_running(&cpus[to].sched, p);
+    enqueue(to, p);
+}
+
+// 把当前进程自上次记账以来的运行时间按权重折算后记到它的 vruntime 上
+static void update_curr(Proc *p) {
+    u64 now = get_timestamp();
+    u64 delta = (now - p->schinfo.exec_start) * 1000000000 / get_clock_frequency();
+    p->schinfo.exec_start = now;
+    p->schinfo.sum_exec += delta;
+    if (!is_rt(p))
+        p->schinfo.vruntime += delta * NICE_0_WEIGHT / p->schinfo.weight;
+}
+
+// 进程加入运行队列前决定它的 vruntime：新进程从队列当前的 min_vruntime 开始；
+// 睡醒的进程可以排到前面，但补偿最多半个调度周期，避免长睡的进程独占 CPU。
+static void place_proc(Proc *p, int cpu) {
+    u64 min_vruntime = cpus[cpu].sched.min_vruntime;
+    if (p->state == UNUSED) {
+        p->schinfo.vruntime = min_vruntime;
+        return;
+    }
+    u64 floor = min_vruntime - SCHED_LATENCY_NS / 2;
+    if (vruntime_before(p->schinfo.vruntime, floor))
+        p->schinfo.vruntime = floor;
+}
+
+// 为一个要变为 RUNNABLE 的进程选 CPU，只在 cpus_allowed 中选。nr_running 不加锁读，只作估计。
+// 新进程放到负载最轻的 CPU（相同时优先当前 CPU）；被唤醒的进程优先回到上次运行的 CPU，
+// 只有那里比最轻的 CPU 多出 SCHED_IMBALANCE 个以上的进程时才换地方。
+static int select_cpu(Proc *p, int prev) {
+    int best = cpu_allowed(p, cpuid()) ? (int)cpuid() : -1;
+    for (int i = 0; i < NCPU; i++) {
+        if (cpu_allowed(p, i) && cpus[i].online &&
+            (best < 0 || cpus[i].sched.nr_running < cpus[best].sched.nr_running))
+            best = i;
+    }
+    // 允许的 CPU 都还没上线（启动早期），先放到其中编号最小的那个上
+    if (best < 0)
+        return __builtin_ctzll(p->schinfo.cpus_allowed);
+    if (p->state != UNUSED && cpu_allowed(p, prev) && cpus[prev].online &&
+        cpus[prev].sched.nr_running < cpus[best].sched.nr_running + SCHED_IMBALANCE)
+        return prev;
+    return best;
+}
+
+// 按本 CPU 的进程数重新设置调度时钟，调用者持有本 CPU 的队列锁。
+// 空闲或只有一个进程时不需要抢占，时钟停掉；SCHED_FIFO 进程也不按时间轮转。
+static void update_tick(struct sched *s) {
+    auto t = &sched_timer[cpuid()];
+    auto curr = s->thisproc;
+    if (!t->triggered)
+        cancel_cpu_timer(t);
+    s->tick_stopped = s->nr_running <= 1 || curr->schinfo.policy == SCHED_FIFO;
+    if (s->tick_stopped)
+        return;
+    if (curr->schinfo.policy == SCHED_RR) {
+        t->elapse = SCHED_RR_SLICE_MS;
+    } else {
+        // 时间片按权重在本 CPU 的普通进程之间分配
+        i64 slice = SCHED_LATENCY_NS;
+        if (s->cfs_load)
+            slice = slice * curr->schinfo.weight / s->cfs_load;
+        t->elapse = MAX(slice, SCHED_MIN_GRANULARITY_NS) / 1000000;
+    }
+    set_cpu_timer(t);
+}
+
+// 队首的进程是否应该抢占 cpu 上正在运行的进程。调用者持有该 CPU 的队列锁；
+// 对别的 CPU 而言当前进程的 vruntime 最多落后一个时间片，只作估计，由对方在 IPI 中复查。
+static bool should_preempt(int cpu) {
+    auto s = &cpus[cpu].sched;
+    Proc *next = first_queued(s), *curr = s->thisproc;
+    if (next == NULL) return false;
+    if (curr->idle) return true;
+    if (is_rt(next) || is_rt(curr))
+        return is_rt(next) &&
+               (!is_rt(curr) || next->schinfo.rt_priority > curr->schinfo.rt_priority);
+    if (curr->schinfo.policy == SCHED_IDLE && next->schinfo.policy != SCHED_IDLE)
+        return true;
+    return vruntime_before(next->schinfo.vruntime + SCHED_WAKEUP_GRANULARITY_NS,
+                           curr->schinfo.vruntime);
+}
+
+// 让 cpu 重新调度。同一时刻只发一个 IPI，对方处理时清掉 ipi_pending。
+static void kick_cpu(int cpu) {
+    auto s = &cpus[cpu].sched;
+    if (__atomic_exchange_n(&s->ipi_pending, true, __ATOMIC_ACQ_REL)) return;
+    __atomic_fetch_add(&s->stat.ipi_sent, 1, __ATOMIC_RELAXED);
+    gic_send_sgi(cpu, IPI_RESCHED);
+}
+
+static void kick_idle_cpu() {
+    for (int i = 0; i < NCPU; i++) {
+        if (i != (int)cpuid() && cpus[i].online && cpus[i].sched.nr_running == 0 &&
+            cpus[i].sched.thisproc->idle) {
+            kick_cpu(i);
+            return;
+        }
+    }
+}
+
+// 别的 CPU 往本 CPU 的队列里放了进程：空闲时直接去运行它；否则按需重开调度时钟，
+// 被唤醒的进程 vruntime 明显更小时抢占当前进程。
+static void resched_ipi_handler() {
     acquire_sched_lock();
-    r = p->state == UNUSED;
+    auto s = &cpus[cpuid()].sched;
+    __atomic_store_n(&s->ipi_pending, false, __ATOMIC_RELEASE);
+    s->stat.ipi_received++;
+    if (!s->thisproc->idle)
+        update_curr(s->thisproc);
+    // 当前进程的 cpus_allowed 不再包含本 CPU 时也要让出，由 sched 把它推走
+    if (s->thisproc->idle || should_preempt(cpuid()) || !cpu_allowed(s->thisproc, cpuid())) {
+        if (!s->thisproc->idle) s->stat.wakeup_preempts++;
+        sched(RUNNABLE);
+        return;
+    }
+    update_tick(s);
     release_sched_lock();
-    return r;
 }
 
+// 本 CPU 上被唤醒的进程应该抢占当前进程时，sched 之外只能记下来，返回用户态前再让出
+void preempt_if_needed() {
+    if (!cpus[cpuid()].sched.need_resched) return;
+    cpus[cpuid()].sched.stat.wakeup_preempts++;
+    yield();
+}
 
 bool _activate_proc(Proc *p, bool onalert) {
     // TODO:(Lab5 new)
     // if the proc->state is RUNNING/RUNNABLE, do nothing and return false
     // if the proc->state is SLEEPING/UNUSED, set the process state to RUNNABLE, add it to the sched queue, and return true
     // if the proc->state is DEEPSLEEPING, do nothing if onalert or activate it if else, and return the corresponding value.
-    acquire_sched_lock();
+    int from, to;
+    bool kick = false;
+    while (1) {
+        from = __atomic_load_n(&p->schinfo.cpu, __ATOMIC_RELAXED);
+        to = select_cpu(p, from);
+        acquire_two_rq_locks(from, to);
+        // select_cpu 没有加锁，其间 sched_setaffinity 可能改了 cpus_allowed；
+        // 它要拿 from 的锁，所以这里拿到两把锁以后 cpus_allowed 不会再变
+        if (p->schinfo.cpu == from && cpu_allowed(p, to)) break;
+        release_two_rq_locks(from, to);
+    }
     // if the proc->state is RUNNING/RUNNABLE, do nothing
     if (p->state==RUNNING || p->state==RUNNABLE || p->state==ZOMBIE ||
         (p->state==DEEPSLEEPING && onalert)) {
-        release_sched_lock();
+        release_two_rq_locks(from, to);
         return false;   // 什么都不做，已经在调度队列中了
     }
     // if the proc->state if SLEEPING/UNUSED, set the process state to RUNNABLE and add it to the sched queue
     if (p->state==SLEEPING || p->state==UNUSED ||
         (p->state==DEEPSLEEPING && !onalert)) {
+        if (to != from && p->state != UNUSED) {
+            cpus[to].sched.stat.wake_migrations++;
+            p->schinfo.nr_migrations++;
+            migrate_vruntime(p, from, to);
+        }
+        place_proc(p, to);
         p->state = RUNNABLE;
-        _insert_into_list(&rq, &p->schinfo.rqnode);
+        p->schinfo.cpu = to;
+        add_running(&cpus[to].sched, p);
+        enqueue(to, p);
+        auto s = &cpus[to].sched;
+        if (to != (int)cpuid()) {
+            // 对方在睡觉、时钟停着，或者应该被抢占：叫醒它
+            kick = s->tick_stopped || should_preempt(to);
+        } else if (!s->thisproc->idle) {
+            // 本 CPU 上原来只有一个进程、时钟停着，现在要轮流跑了
+            update_tick(s);
+            update_curr(s->thisproc);
+            if (should_preempt(to))
+                s->need_resched = true;
+        }
     }
-    release_sched_lock();
+    release_two_rq_locks(from, to);
+    if (kick)
+        kick_cpu(to);
     return true;
 }
 
 static void update_this_state(enum procstate new_state) {
     // TODO: if you use template sched function, you should implement this routinue
     // update the state of current process to new_state, and modify the sched queue if necessary
-    auto origin_state = thisproc()->state;
+    // 正在运行的进程不在队列中，让出 CPU 时才排到队尾
     thisproc()->state = new_state;
     if (thisproc()->pid == -1) return;
-    if((origin_state==RUNNABLE || origin_state==RUNNING) && new_state!=RUNNING && new_state != RUNNABLE) {
-        _detach_from_list(&thisproc()->schinfo.rqnode);
+    // 本 CPU 已不在 cpus_allowed 中：先不入队，切换走之后再推到允许的 CPU 上（见 push_migrating）
+    if (new_state == RUNNABLE && !cpu_allowed(thisproc(), cpuid()))
+        cpus[cpuid()].sched.push_proc = thisproc();
+    else if (new_state == RUNNABLE)
+        enqueue(cpuid(), thisproc());
+    else if (new_state != RUNNING)
+        sub_running(&cpus[cpuid()].sched, thisproc());
+}
+
+// 在 s 的队列里找一个允许在 cpu 上运行的进程：普通进程从 vruntime 最大的开始找，
+// 其次是实时进程，从优先级最高的开始找。
+static Proc *find_stealable(struct sched *s, int cpu) {
+    for (rb_node node = _rb_last(&s->rq); node; node = _rb_prev(node)) {
+        Proc *p = container_of(node, Proc, schinfo.rbnode);
+        if (cpu_allowed(p, cpu)) return p;
     }
-    if (origin_state!=RUNNABLE && origin_state!=RUNNING && (new_state==RUNNABLE || new_state==RUNNING)) {
-        _insert_into_list(&rq, &thisproc()->schinfo.rqnode);
+    for (int prio = SCHED_RT_PRIO_LEVELS - 1; prio > 0; prio--) {
+        if (!(s->rt_bitmap[prio / 64] >> (prio % 64) & 1)) continue;
+        _for_in_list(node, &s->rt_rq[prio]) {
+            if (node == &s->rt_rq[prio]) continue;
+            Proc *p = container_of(node, Proc, schinfo.rtnode);
+            if (cpu_allowed(p, cpu)) return p;
+        }
+    }
+    return NULL;
+}
+
+// 从进程数最多的 CPU 拉一个 vruntime 最大的进程过来（它最晚运行，缓存最凉），
+// 对方只有实时进程在排队时拉优先级最高的那个。绑定在别的 CPU 上的进程不拉。
+// 调用者持有本 CPU 的队列锁；对方的锁只 try 一次，拿不到就下次再说，
+// 两个 CPU 互相偷时也不会死锁。min_imbalance 为 0 表示本 CPU 即将空闲，有就偷。
+static bool steal_task(int min_imbalance) {
+    int me = cpuid(), victim = -1;
+    for (int i = 0; i < NCPU; i++) {
+        if (i == me || !cpus[i].online || cpus[i].sched.nr_queued == 0) continue;
+        if (victim < 0 || cpus[i].sched.nr_running > cpus[victim].sched.nr_running)
+            victim = i;
+    }
+    if (victim < 0 ||
+        cpus[victim].sched.nr_running < cpus[me].sched.nr_running + min_imbalance)
+        return false;
+    if (!try_acquire_spinlock(&cpus[victim].sched.lock)) return false;
+    bool ok = false;
+    auto vs = &cpus[victim].sched;
+    if (vs->nr_queued > 0 && vs->nr_running >= cpus[me].sched.nr_running + min_imbalance) {
+        Proc *p = find_stealable(vs, me);
+        if (p) {
+            move_proc(p, victim, me);
+            ok = true;
+        }
     }
+    release_rq_lock(victim);
+    return ok;
 }
 
 static Proc *pick_next() {
     // TODO: if using template sched function, you should implement this routinue
     // choose the next process to run, and return idle if no runnable process
-    Proc *selected_proc = NULL;
-    int min_load = 1000000;
-    _for_in_list(p, &rq) {
-        if(p == &rq) continue;
-        auto proc = container_of(p, Proc, schinfo.rqnode);
-        if(proc->state == RUNNABLE && proc->timeload < min_load) {
-            selected_proc = proc;
-            min_load = proc->timeload;
-        }
+    int me = cpuid();
+    auto s = &cpus[me].sched;
+    if (s->nr_queued == 0) {
+        if (steal_task(0)) s->stat.steals++;
+    } else if (s->need_balance) {
+        if (steal_task(SCHED_IMBALANCE)) s->stat.balances++;
     }
-    if(selected_proc) {
-        selected_proc->timeload++;
-        return selected_proc;
+    s->need_balance = false;
+    Proc *p = first_queued(s);
+    if (p) {
+        // 队列里最小的 vruntime 只会增长，新来的进程以它为起点
+        if (!is_rt(p) && vruntime_before(s->min_vruntime, p->schinfo.vruntime))
+            s->min_vruntime = p->schinfo.vruntime;
+        dequeue(me, p);
+        return p;
     }
-
-    return cpus[cpuid()].sched.idle;
+    return s->idle;
 }
 
 static void update_this_proc(Proc *p) {
     // TODO: you should implement this routinue
     // update thisproc to the choosen process
-    cpus[cpuid()].sched.thisproc = p;
-    if (!sched_timer[cpuid()].triggered) {
-        cancel_cpu_timer(&sched_timer[cpuid()]);
+    auto s = &cpus[cpuid()].sched;
+    s->thisproc = p;
+    p->schinfo.exec_start = get_timestamp();
+    update_tick(s);
+}
+
+// 上一个在本 CPU 上运行的进程已不允许在这里运行，它的上下文已经在 swtch 中保存好了，
+// 现在可以把它放到允许的 CPU 的队列上。放开本 CPU 的锁再按顺序拿两把锁，
+// 其间它的状态是 RUNNABLE 但不在任何队列上（on_rq 为假），别人不会动它。
+static void push_migrating() {
+    int me = cpuid();
+    Proc *p = cpus[me].sched.push_proc;
+    if (p == NULL) return;
+    cpus[me].sched.push_proc = NULL;
+    int to;
+    while (1) {
+        to = select_cpu(p, me);
+        acquire_two_rq_locks(me, to);
+        // 同 _activate_proc：选 CPU 之后 cpus_allowed 可能又被改了
+        if (cpu_allowed(p, to)) break;
+        release_two_rq_locks(me, to);
     }
-    set_cpu_timer(&sched_timer[cpuid()]);
+    if (to != me) {
+        move_proc(p, me, to);
+        update_tick(&cpus[me].sched);
+    } else {
+        // 其间 cpus_allowed 又改回来了
+        enqueue(me, p);
+    }
+    bool kick = to != me && (cpus[to].sched.tick_stopped || should_preempt(to));
+    release_two_rq_locks(me, to);
+    if (kick)
+        kick_cpu(to);
 }
 
 // A simple scheduler.
@@ -143,6 +545,8 @@ void sched(enum procstate new_state) {
     ASSERT(this->state == RUNNING);
     // 如果当前进程带有killed标记，且new state不为zombie，则调度器直接返回，不做任何操作。
     if (this->killed && new_state!=ZOMBIE) { release_sched_lock(); return; }
+    cpus[cpuid()].sched.need_resched = false;
+    if (!this->idle) update_curr(this);
     update_this_state(new_state);
     auto next = pick_next();
     update_this_proc(next);
@@ -150,15 +554,165 @@ void sched(enum procstate new_state) {
     ASSERT(next->state == RUNNABLE);
     next->state = RUNNING;
     if (next != this) {
+        cpus[cpuid()].sched.stat.switches++;
+        next->schinfo.nr_switches++;
+        fpsimd_switch(this, next);
         attach_pgdir(&next->pgdir);
+        // 本 CPU 的队列锁跨过 swtch 交给 next，由它在 sched 返回或 proc_entry 中释放
         swtch(next->kcontext, &this->kcontext); // bug at here -- bug fixed
         // printk("333");
     }
     release_sched_lock();
+    push_migrating();
 }
 
 u64 proc_entry(void (*entry)(u64), u64 arg) {
     release_sched_lock();
+    push_migrating();
     set_return_addr(entry);
     return arg;
 }
+
+// 子进程继承父进程的调度策略与 nice 值
+void sched_fork(Proc *child, Proc *parent) {
+    u32 seq;
+    do {
+        seq = read_seqbegin(&parent->schinfo.attr_seq);
+        child->schinfo.policy = parent->schinfo.policy;
+        child->schinfo.rt_priority = parent->schinfo.rt_priority;
+        child->schinfo.nice = parent->schinfo.nice;
+        child->schinfo.weight = parent->schinfo.weight;
+    } while (read_seqretry(&parent->schinfo.attr_seq, seq));
+    child->schinfo.cpus_allowed = parent->schinfo.cpus_allowed;
+}
+
+void sched_getattr(Proc *p, struct sched_attr *attr) {
+    u32 seq;
+    do {
+        seq = read_seqbegin(&p->schinfo.attr_seq);
+        attr->policy = p->schinfo.policy;
+        attr->rt_priority = p->schinfo.rt_priority;
+        attr->nice = p->schinfo.nice;
+    } while (read_seqretry(&p->schinfo.attr_seq, seq));
+}
+
+// 修改 p 的调度属性。p 正在排队时先出队，改完按新的调度类重新入队；
+// 之后让 p 所在的 CPU 检查是否需要抢占。调用者保证 p 不会在中途被回收。
+int sched_setattr(Proc *p, const struct sched_attr *attr) {
+    if (attr->policy != SCHED_NORMAL && attr->policy != SCHED_IDLE && !rt_policy(attr->policy))
+        return -1;
+    if (rt_policy(attr->policy) ? attr->rt_priority < 1 || attr->rt_priority >= SCHED_RT_PRIO_LEVELS
+                                : attr->rt_priority != 0)
+        return -1;
+    if (p->idle) return -1;
+    int nice = MIN(MAX(attr->nice, -20), 19);
+    int cpu = lock_proc_rq(p);
+    auto s = &cpus[cpu].sched;
+    // 等待 push_migrating 的进程是 RUNNABLE 但不在队列上，它也计在本 CPU 的负载里
+    bool queued = p->schinfo.on_rq;
+    bool running = p->state == RUNNING || (p->state == RUNNABLE && !queued);
+    bool was_rt = is_rt(p);
+    if (queued) dequeue(cpu, p);
+    if (queued || running) sub_running(s, p);
+    write_seqlock(&p->schinfo.attr_seq);
+    p->schinfo.policy = attr->policy;
+    p->schinfo.rt_priority = attr->rt_priority;
+    p->schinfo.nice = nice;
+    p->schinfo.weight = attr->policy == SCHED_IDLE ? SCHED_IDLE_WEIGHT : nice_to_weight[nice + 20];
+    write_sequnlock(&p->schinfo.attr_seq);
+    // 实时进程不记 vruntime，回到 CFS 时从队列的 min_vruntime 开始
+    if (was_rt && !is_rt(p))
+        p->schinfo.vruntime = s->min_vruntime;
+    if (queued || running) add_running(s, p);
+    if (queued) enqueue(cpu, p);
+    bool kick = false;
+    if (queued || running) {
+        if (cpu == (int)cpuid()) {
+            update_tick(s);
+            if (should_preempt(cpu))
+                s->need_resched = true;
+        } else {
+            kick = true;
+        }
+    }
+    release_rq_lock(cpu);
+    if (kick)
+        kick_cpu(cpu);
+    return 0;
+}
+
+// 修改 p 的 cpus_allowed。正在排队的进程如果不能留在原来的 CPU，立即挪到允许的 CPU；
+// 正在运行的进程让它所在的 CPU 重新调度，在 sched 中被推走；睡眠中的进程醒来时再选 CPU。
+int sched_setaffinity(Proc *p, u64 mask) {
+    mask &= SCHED_ALL_CPUS;
+    if (mask == 0 || p->idle) return -1;
+    int from, to;
+    while (1) {
+        from = __atomic_load_n(&p->schinfo.cpu, __ATOMIC_RELAXED);
+        to = from;
+        if (!(mask >> from & 1)) {
+            // 选一个负载最轻的允许的 CPU
+            to = __builtin_ctzll(mask);
+            for (int i = 0; i < NCPU; i++)
+                if ((mask >> i & 1) && cpus[i].online &&
+                    cpus[i].sched.nr_running < cpus[to].sched.nr_running)
+                    to = i;
+        }
+        acquire_two_rq_locks(from, to);
+        if (p->schinfo.cpu == from) break;
+        release_two_rq_locks(from, to);
+    }
+    p->schinfo.cpus_allowed = mask;
+    int kick = -1;
+    if (!(mask >> from & 1)) {
+        if (p->schinfo.on_rq) {
+            move_proc(p, from, to);
+            if (to != (int)cpuid()) kick = to;
+        } else if (p->state == RUNNING) {
+            if (from == (int)cpuid()) cpus[from].sched.need_resched = true;
+            else kick = from;
+        }
+    }
+    release_two_rq_locks(from, to);
+    if (kick >= 0)
+        kick_cpu(kick);
+    return 0;
+}
+
+u64 sched_getaffinity(Proc *p) { return p->schinfo.cpus_allowed; }
+
+void sched_getstat(Proc *p, struct proc_sched_stat *st) {
+    st->cpu = p->schinfo.cpu;
+    st->nr_migrations = p->schinfo.nr_migrations;
+    st->nr_switches = p->schinfo.nr_switches;
+    st->sum_exec_ns = p->schinfo.sum_exec;
+}
+
+// 空闲 CPU 进入 wfi 前记下时间，醒来后第一次进中断时结算。
+// 不能等 wfi 返回再算：中断处理中可能已经切换到别的进程，idle 很久以后才回来。
+void idle_enter() { cpus[cpuid()].sched.idle_since = get_timestamp(); }
+void idle_exit() {
+    auto s = &cpus[cpuid()].sched;
+    if (!s->idle_since) return;
+    s->stat.idle_wakeups++;
+    s->stat.idle_ns += (get_timestamp() - s->idle_since) * 1000000000 / get_clock_frequency();
+    s->idle_since = 0;
+}
+
+void get_sched_stat(int cpu, struct sched_stat *st) {
+    auto s = &cpus[cpu].sched;
+    st->switches = s->stat.switches;
+    st->steals = s->stat.steals;
+    st->balances = s->stat.balances;
+    st->wake_migrations = s->stat.wake_migrations;
+    st->idle_wakeups = s->stat.idle_wakeups;
+    st->idle_ns = s->stat.idle_ns;
+    st->ipi_sent = __atomic_load_n(&s->stat.ipi_sent, __ATOMIC_RELAXED);
+    st->ipi_received = s->stat.ipi_received;
+    st->wakeup_preempts = s->stat.wakeup_preempts;
+    st->lock_acquire = __atomic_load_n(&s->stat.lock_acquire, __ATOMIC_RELAXED);
+    st->lock_contended = __atomic_load_n(&s->stat.lock_contended, __ATOMIC_RELAXED);
+    st->fp_traps = __atomic_load_n(&s->stat.fp_traps, __ATOMIC_RELAXED);
+    st->fp_restores = __atomic_load_n(&s->stat.fp_restores, __ATOMIC_RELAXED);
+    st->fp_saves = __atomic_load_n(&s->stat.fp_saves, __ATOMIC_RELAXED);
+}
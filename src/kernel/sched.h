@@ -2,6 +2,28 @@
 #include <kernel/proc.h>
 #include <common/checker.h>
 
+// 调度策略，取值与 Linux 相同
+#define SCHED_NORMAL 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+#define SCHED_IDLE 5
+#define SCHED_RT_PRIO_LEVELS 100
+#define SCHED_ALL_CPUS ((1ull << NCPU) - 1)
+
+struct sched_attr {
+    int policy;
+    int rt_priority;
+    int nice;
+};
+
+// 单个进程的调度统计，由 procstat 系统调用返回给用户态
+struct proc_sched_stat {
+    u64 cpu;  // 当前（或最后）所在的 CPU
+    u64 nr_migrations;
+    u64 nr_switches;
+    u64 sum_exec_ns;
+};
+
 void init_sched();
 void init_schinfo(struct schinfo *);
 
@@ -14,6 +36,15 @@ WARN_RESULT bool is_unused(Proc *);
 void acquire_sched_lock();
 void release_sched_lock();
 void sched(enum procstate new_state);
+void idle_enter();
+void idle_exit();
+void preempt_if_needed();
+void sched_fork(Proc *child, Proc *parent);
+void sched_getattr(Proc *, struct sched_attr *);
+WARN_RESULT int sched_setattr(Proc *, const struct sched_attr *);
+WARN_RESULT int sched_setaffinity(Proc *, u64 mask);
+WARN_RESULT u64 sched_getaffinity(Proc *);
+void sched_getstat(Proc *, struct proc_sched_stat *);
 
 // MUST call lock_for_sched() before sched() !!!
 #define yield() (acquire_sched_lock(), sched(RUNNABLE))
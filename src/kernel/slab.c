@@ -0,0 +1,187 @@
+#include <aarch64/mmu.h>
+#include <common/list.h>
+#include <common/spinlock.h>
+#include <common/string.h>
+#include <kernel/cpu.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <kernel/slab.h>
+
+#define NULL 0
+#define KMEM_MAX_CACHES 16
+#define SLAB_ALIGN 16
+// 每个 CPU 缓存的空闲对象数，空了/满了时与 slab 之间批量搬运一半
+#define SLAB_CPU_CACHE_SIZE 16
+#define SLAB_CPU_BATCH (SLAB_CPU_CACHE_SIZE / 2)
+
+// 每个 slab 占一整页：页首是 slab 头（含空闲对象下标栈），之后是 objs_per_slab 个对象。
+// 空闲对象用下标栈而不是把指针写进对象本身，这样构造过的对象在空闲时也保持原样。
+struct slab {
+    ListNode node;  // 挂在所属 cache 的 partial/full 链表上
+    KMemCache *cache;
+    usize inuse;  // 已分出去（包括躺在 CPU 缓存里）的对象数
+    u8 free[];  // free[0, objs_per_slab - inuse) 是空闲对象的下标
+};
+
+struct kmem_cpu_cache {
+    usize avail;
+    void *objs[SLAB_CPU_CACHE_SIZE];
+} __attribute__((aligned(64)));
+
+struct kmem_cache {
+    char name[KMEM_CACHE_NAME_LEN];
+    usize obj_size;
+    usize obj_start;  // 第一个对象在页内的偏移
+    usize objs_per_slab;
+    void (*ctor)(void *);
+    SpinLock lock;  // 保护 slab 链表与下面的计数
+    ListNode partial;  // 还有空闲对象的 slab
+    ListNode full;
+    struct slab *empty;  // 最多留一个全空的 slab，多余的还给页分配器
+    usize num_slabs;
+    usize num_inuse;
+    struct kmem_cpu_cache cpu[NCPU];
+};
+
+static KMemCache caches[KMEM_MAX_CACHES];
+static usize num_caches;
+static SpinLock caches_lock;
+
+KMemCache *kmem_cache_create(const char *name, usize size, void (*ctor)(void *)) {
+    acquire_spinlock(&caches_lock);
+    ASSERT(num_caches < KMEM_MAX_CACHES);
+    KMemCache *c = &caches[num_caches];
+    memset(c, 0, sizeof(KMemCache));
+    strncpy(c->name, name, KMEM_CACHE_NAME_LEN - 1);
+    c->obj_size = round_up(size, SLAB_ALIGN);
+    // 下标栈每个对象占 1 字节，先按 size + 1 估算，再扣掉对齐带来的浪费
+    usize n = MIN((PAGE_SIZE - sizeof(struct slab)) / (c->obj_size + 1), 255ull);
+    while (n > 0 && round_up(sizeof(struct slab) + n, SLAB_ALIGN) + n * c->obj_size > PAGE_SIZE)
+        n--;
+    ASSERT(n > 0);
+    c->objs_per_slab = n;
+    c->obj_start = round_up(sizeof(struct slab) + n, SLAB_ALIGN);
+    c->ctor = ctor;
+    init_spinlock(&c->lock, c->name);
+    init_list_node(&c->partial);
+    init_list_node(&c->full);
+    num_caches++;
+    release_spinlock(&caches_lock);
+    return c;
+}
+
+static INLINE void *slab_obj(KMemCache *c, struct slab *s, usize idx) {
+    return (u8 *)s + c->obj_start + idx * c->obj_size;
+}
+
+static struct slab *slab_create(KMemCache *c) {
+    struct slab *s = kalloc_page();
+    if (s == NULL)
+        return NULL;
+    init_list_node(&s->node);
+    s->cache = c;
+    s->inuse = 0;
+    for (usize i = 0; i < c->objs_per_slab; i++) {
+        // 倒序入栈，使对象按地址顺序分配出去
+        s->free[i] = c->objs_per_slab - 1 - i;
+        if (c->ctor)
+            c->ctor(slab_obj(c, s, i));
+    }
+    c->num_slabs++;
+    return s;
+}
+
+// 从 slab 中取出一批对象填充 CPU 缓存。
+static void cache_refill(KMemCache *c, struct kmem_cpu_cache *cc) {
+    acquire_spinlock(&c->lock);
+    while (cc->avail < SLAB_CPU_BATCH) {
+        struct slab *s;
+        if (!_empty_list(&c->partial)) {
+            s = container_of(c->partial.next, struct slab, node);
+        } else {
+            s = c->empty ? c->empty : slab_create(c);
+            c->empty = NULL;
+            if (s == NULL)
+                break;
+            _insert_into_list(&c->partial, &s->node);
+        }
+        while (cc->avail < SLAB_CPU_BATCH && s->inuse < c->objs_per_slab) {
+            s->inuse++;
+            c->num_inuse++;
+            cc->objs[cc->avail++] = slab_obj(c, s, s->free[c->objs_per_slab - s->inuse]);
+        }
+        if (s->inuse == c->objs_per_slab) {
+            _detach_from_list(&s->node);
+            _insert_into_list(&c->full, &s->node);
+        }
+    }
+    release_spinlock(&c->lock);
+}
+
+// 把一个对象还给它所在的 slab，调用者持有 c->lock。
+static void slab_put_obj(KMemCache *c, void *obj) {
+    struct slab *s = (struct slab *)PAGE_BASE((u64)obj);
+    ASSERT(s->cache == c);
+    if (s->inuse == c->objs_per_slab) {
+        _detach_from_list(&s->node);
+        _insert_into_list(&c->partial, &s->node);
+    }
+    s->free[c->objs_per_slab - s->inuse] = ((u64)obj - (u64)slab_obj(c, s, 0)) / c->obj_size;
+    s->inuse--;
+    c->num_inuse--;
+    if (s->inuse == 0) {
+        _detach_from_list(&s->node);
+        if (c->empty == NULL) {
+            c->empty = s;
+        } else {
+            kfree_page(s);
+            c->num_slabs--;
+        }
+    }
+}
+
+// 把 CPU 缓存中较早放入的一批对象还给 slab。
+static void cache_flush(KMemCache *c, struct kmem_cpu_cache *cc) {
+    acquire_spinlock(&c->lock);
+    for (usize i = 0; i < SLAB_CPU_BATCH; i++)
+        slab_put_obj(c, cc->objs[i]);
+    release_spinlock(&c->lock);
+    cc->avail -= SLAB_CPU_BATCH;
+    memmove(cc->objs, cc->objs + SLAB_CPU_BATCH, cc->avail * sizeof(void *));
+}
+
+void *kmem_cache_alloc(KMemCache *c) {
+    struct kmem_cpu_cache *cc = &c->cpu[cpuid()];
+    if (cc->avail == 0) {
+        cache_refill(c, cc);
+        if (cc->avail == 0)
+            return NULL;
+    }
+    return cc->objs[--cc->avail];
+}
+
+void kmem_cache_free(KMemCache *c, void *obj) {
+    struct kmem_cpu_cache *cc = &c->cpu[cpuid()];
+    if (cc->avail == SLAB_CPU_CACHE_SIZE)
+        cache_flush(c, cc);
+    cc->objs[cc->avail++] = obj;
+}
+
+// 对每个 cache 打印：使用中的对象数、slab 页数、slab 的额外开销，
+// 以及同样数量的对象用 kalloc（8 字节头 + 16 字节粒度）需要的字节数作对比。
+void kmem_cache_report() {
+    printk("kmem_cache_report: name objsize objs/slab active slabs bytes overhead kalloc_bytes\n");
+    for (usize i = 0; i < num_caches; i++) {
+        KMemCache *c = &caches[i];
+        acquire_spinlock(&c->lock);
+        usize active = c->num_inuse;
+        for (int j = 0; j < NCPU; j++)
+            active -= c->cpu[j].avail;
+        usize bytes = c->num_slabs * PAGE_SIZE;
+        usize kalloc_bytes = active * round_up(c->obj_size + 8, 16);
+        printk("%s %llu %llu %llu %llu %llu %llu %llu\n", c->name, c->obj_size,
+               c->objs_per_slab, active, c->num_slabs, bytes,
+               bytes - active * c->obj_size, kalloc_bytes);
+        release_spinlock(&c->lock);
+    }
+}
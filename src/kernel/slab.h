@@ -0,0 +1,25 @@
+#pragma once
+#include <common/defines.h>
+
+// 为固定大小的热点内核对象（Proc、Block、Inode、section）准备的 slab 分配器。
+// 每种对象一个 cache，cache 从 kalloc_page 拿整页切成等大的对象，
+// 每个 CPU 还有一个小的空闲对象缓存，常见路径下 alloc/free 不需要拿任何锁。
+
+#define KMEM_CACHE_NAME_LEN 16
+
+typedef struct kmem_cache KMemCache;
+
+/**
+    @brief create a cache for objects of `size` bytes.
+    @param ctor optional constructor (may be NULL). It runs once on every
+    object when a new slab is carved out, NOT on every allocation, so an
+    object must be handed back to `kmem_cache_free` in its constructed state.
+    @note call after `kinit`. Caches are never destroyed.
+ */
+WARN_RESULT KMemCache *kmem_cache_create(const char *name, usize size,
+                                         void (*ctor)(void *));
+WARN_RESULT void *kmem_cache_alloc(KMemCache *cache);
+void kmem_cache_free(KMemCache *cache, void *obj);
+
+// print object counts and memory overhead of every cache.
+void kmem_cache_report();
@@ -23,6 +23,11 @@ void syscall_entry(UserContext *context) { // TODO
     // Invoke syscall_table[id] with args and set the return value.
     // id is stored in x8. args are stored in x0-x5. return value is stored in x0.
     u64 id = context->x[8];
+    Proc *p = thisproc();
+    if (p->exec_start) {
+        exec_latency_record(get_timestamp() - p->exec_start);
+        p->exec_start = 0;
+    }
     // printk("syscall_table function id: %d\n", (int)id);
     u64 x[6];
     for(int i = 0; i < 6; i++) { x[i] = context->x[i]; }
@@ -42,18 +47,8 @@ void syscall_entry(UserContext *context) { // TODO
 bool user_readable(const void *start, usize size) {
     /* (Final) TODO BEGIN */
     if((u64)start >= KSPACE_MASK) return true;
-    bool ret = false;
-    struct section* st = NULL;
-    ListNode* st_head = &(thisproc()->pgdir.section_head);
-	_for_in_list(node, st_head) {
-		if(node == st_head) break;
-		st = container_of(node, struct section, stnode);
-		// printk("st->begin = %lld, st->end = %lld\n", st->begin, st->end);
-		if(st->begin <= (u64)start && ((u64)start + size) < st->end) {
-			ret = true; break;
-		}
-	}
-    return ret;
+    struct section* st = find_section(&thisproc()->pgdir, (u64)start);
+    return st != NULL && ((u64)start + size) <= st->end;
     /* (Final) TODO END */
 }
 
@@ -63,23 +58,9 @@ bool user_readable(const void *start, usize size) {
  */
 bool user_writeable(const void *start, usize size) {
     /* (Final) TODO Begin */
-    // printk("user writeable start\n");
     if((u64)start >= KSPACE_MASK) return true;
-    bool ret = false;
-    struct section* st = NULL;
-    ListNode* st_head = &(thisproc()->pgdir.section_head);
-	_for_in_list(node, st_head) {
-		if(node == st_head) break;
-		st = container_of(node, struct section, stnode);
-        if(st->flags & ST_RO) {
-            continue;
-        }
-		if(st->begin <= (u64)start && ((u64)start + size) < st->end) {
-			ret = true;
-            break;
-		}
-	}
-    return ret;
+    struct section* st = find_section(&thisproc()->pgdir, (u64)start);
+    return st != NULL && !(st->flags & ST_RO) && ((u64)start + size) <= st->end;
     /* (Final) TODO End */
 }
 
@@ -89,10 +70,18 @@ bool user_writeable(const void *start, usize size) {
  * not readable by the current user process.
  */
 usize user_strlen(const char *str, usize maxlen) {
+    // 每个段只查一次，在段内逐字节找结尾
+    u64 limit = 0;
     for (usize i = 0; i < maxlen; i++) {
-        if (user_readable(&str[i], 1)) {
-            if (str[i] == 0) return i + 1;
-        } else return 0;
+        if ((u64)&str[i] >= limit) {
+            if ((u64)&str[i] >= KSPACE_MASK) limit = (u64)-1;
+            else {
+                struct section* st = find_section(&thisproc()->pgdir, (u64)&str[i]);
+                if (st == NULL) return 0;
+                limit = st->end;
+            }
+        }
+        if (str[i] == 0) return i + 1;
     }
     return 0;
 }
\ No newline at end of file
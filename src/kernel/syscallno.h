@@ -4,6 +4,11 @@
 #define SYS_yield 124
 #define SYS_myreport 499
 #define SYS_pstat 500
+#define SYS_execstat 501
+#define SYS_schedstat 502
+#define SYS_procstat 503
+#define SYS_lockstat 504
+#define SYS_asidstat 505
 #define SYS_sbrk 12
 #define SYS_brk 214
 #define SYS_mprotect 226
@@ -27,6 +27,7 @@
 #include <aarch64/intrinsic.h>
 #include <common/string.h>
 #include <kernel/pt.h>
+#include <kernel/uaccess.h>
 
 struct iovec {
     void *iov_base; /* Starting address. */
@@ -71,6 +72,9 @@ define_syscall(ioctl, int fd, u64 request) {
     return 0;
 }
 
+// 路径（含结尾的 '\0'）最长的字节数
+#define MAX_PATH_LEN 256
+
 // mmap
 #define PAGE_ALIGN_UP(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
 #define PAGE_ALIGN_DOWN(x) ((x) & ~(PAGE_SIZE - 1))
@@ -104,119 +108,85 @@ void vma_init() {
     memset(vma_list, 0, sizeof(vma_list));
 }
 
+// 在 [USER_SPACE_START, USER_SPACE_END) 中从高地址往下找一段长为 length 的空闲区域，
+// 找不到时 *begin == *end。
 void get_free_vm(struct pgdir* pd, u64 length, u64* begin, u64* end) {
-    *begin = USER_SPACE_START;
-    *end = USER_SPACE_END;
-    printk("Initial free_begin: 0x%llx, free_end: 0x%llx\n", *begin, *end);
-    _for_in_list(p, &pd->section_head) {
-        auto sec = container_of(p, struct section, stnode);
-        if (sec->begin >= KMASK || sec->end >= KMASK) continue;
-        if (sec->begin == 0 && sec->end == 0) continue;
-        printk("Checking section: [0x%llx - 0x%llx]\n", sec->begin, sec->end);
-        if (sec->end > *begin) *begin = PAGE_ALIGN_UP(sec->end);
-        if (sec->begin < *end) *end = PAGE_ALIGN_DOWN(sec->begin);
-    }
-    *begin = *end - length;
-    printk("Final free_begin: 0x%llx, free_end: 0x%llx\n", *begin, *end);
+    *begin = find_free_range(pd, length, USER_SPACE_START, USER_SPACE_END);
+    *end = *begin ? *begin + length : 0;
 }
 
 define_syscall(mmap, void *addr, int length, int prot, int flags, int fd, int offset) {
     /* (Final) TODO BEGIN */
     if(prot == PROT_NONE || prot & PROT_EXEC || fd < 0 || fd >= NOPENFILE || length <= 0) return -1;
+    // 页缓存按页对齐，文件偏移也必须页对齐
+    if(offset < 0 || offset % PAGE_SIZE != 0) return -1;
     length = PAGE_ALIGN_UP(length);
-    auto st = (struct section*)kalloc(sizeof(struct section));
-    memset(st, 0, sizeof(struct section));
-    st->flags = (flags & MAP_SHARED) ? ST_MMAP_SHARED : ST_MMAP_PRIVATE;
-    st->offset = offset; st->prot = prot;
     auto cp = thisproc();
     auto f = fd2file(fd);
-    if(!f) { kfree(st); return -1; }
-    if((prot & PROT_WRITE) && !f->writable && flags != MAP_PRIVATE) { kfree(st); return -1; }
+    if(!f || f->type != FD_INODE) return -1;
+    if((prot & PROT_WRITE) && !f->writable && flags != MAP_PRIVATE) return -1;
+    auto st = alloc_section();
+    st->flags = (flags & MAP_SHARED) ? ST_MMAP_SHARED : ST_MMAP_PRIVATE;
+    st->offset = offset; st->prot = prot;
     acquire_spinlock(&cp->pgdir.lock);
     ASSERT(addr == 0); // 只有自动分配空间的情况
     u64 free_begin = 0, free_end = 0;
     get_free_vm(&cp->pgdir, length, &free_begin, &free_end);
     if(free_end == free_begin) {
         printk("can not find a space\n");
-        kfree(st); release_spinlock(&cp->pgdir.lock); return -1;
+        free_section(st); release_spinlock(&cp->pgdir.lock); return -1;
     }
     if (free_begin % PAGE_SIZE != 0) {
         printk("addr not aligned\n");
-        kfree(st); release_spinlock(&cp->pgdir.lock); return -1;
+        free_section(st); release_spinlock(&cp->pgdir.lock); return -1;
     }
     st->begin = free_begin; st->end = free_end;
-    // f->readable = 1; f->writable = 1;
-    f->off = offset; // 重置file的offset！！否则同一个fd，off他一直在累增
     st->fp = file_dup(f);
-    _insert_into_list(&cp->pgdir.section_head, &st->stnode);
-    // 读取文件内容到这个地址
-    file_read(f, (void *)st->begin, length);
+    insert_section(&cp->pgdir, st);
     release_spinlock(&cp->pgdir.lock);
-    printk("Allocated region: [0x%llx - 0x%llx]\n", st->begin, st->end);
+    // 此时不映射任何页，访问时在 pgfault_handler 中从文件页缓存映射
     return st->begin;
     /* (Final) TODO END */
 }
 
-void free_section_pages(struct pgdir* pd, struct section* sec) {
-    for(auto i = PAGE_BASE(sec->begin); i < sec->end; i+= PAGE_SIZE) {
-        auto pte = get_pte(pd, i, false);
-        if(pte && (*pte & PTE_VALID)) {
-            if((sec->flags == ST_MMAP_PRIVATE || sec->flags == ST_MMAP_SHARED)
-                && !(*pte & PTE_RO) && get_page_ref(P2K(PTE_ADDRESS(*pte))) == 1){
-                if(sec->fp->type == FD_INODE) {
-                    u64 this_begin = MAX(i, sec->begin);
-                    u64 this_end = MIN(i + PAGE_SIZE, sec->end);
-                    sec->fp->off = sec->offset + this_begin - sec->begin;
-                    file_write(sec->fp, (char*)P2K(PTE_ADDRESS(*pte)), this_end - this_begin);
-                }
-                else PANIC();
-            }
-            kfree_page((void*)P2K(PTE_ADDRESS(*pte)));
-            *pte = 0; // 确保清理页表项，防止重复映射
-        }
-    }
-}
-
 define_syscall(munmap, void *addr, size_t length) {
     /* (Final) TODO BEGIN */
     auto cp = thisproc();
     acquire_spinlock(&cp->pgdir.lock);
-    _for_in_list(p, &cp->pgdir.section_head){
-        if(p != &cp->pgdir.section_head) {
-            auto st = container_of(p, struct section, stnode);
-            if((u64)addr == st->begin) {
-                ASSERT(st->flags == ST_MMAP_PRIVATE || st->flags == ST_MMAP_SHARED);
-                if(length >= st->end - st->begin) {
-                    for (size_t i = 0; i < length; i++) ((char*)addr)[i] = 0;
-                    free_section_pages(&cp->pgdir, st);
-                    _detach_from_list(p); file_close(st->fp); kfree(st);
-                }
-                else {
-                    auto end = st->begin + length;
-                    for(auto i = PAGE_BASE(st->begin); i < end; i += PAGE_SIZE){
-                        auto pte = get_pte(&cp->pgdir, i, false);
-                        if(st->fp->type == FD_INODE){
-                            u64 this_begin = MAX(i, st->begin);
-                            u64 this_end = MIN(i + PAGE_SIZE, end);
-                            st->fp->off = st->offset + this_begin - st->begin;
-                            file_write(st->fp, (char*)P2K(PTE_ADDRESS(*pte)), MIN((u64)PAGE_SIZE, this_end - this_begin));
-                        }
-                        else PANIC();
-                        kfree_page((void*)P2K(PTE_ADDRESS(*pte)));
-                        *pte = 0;
-                    }
-                    st->begin = end;
-                }
-                printk("Freed region: [0x%llx - 0x%llx]\n", st->begin, st->end);
-                break;
-            }
-        }
-    }
+    struct section* st = find_section(&cp->pgdir, (u64)addr);
+    release_spinlock(&cp->pgdir.lock);
+    if(st == NULL || st->begin != (u64)addr || length == 0) return -1;
+    ASSERT(st->flags == ST_MMAP_PRIVATE || st->flags == ST_MMAP_SHARED);
+    u64 end = MIN(st->begin + PAGE_ALIGN_UP(length), st->end);
+    // 被写过的共享页写回文件，然后解除映射（写回会睡眠，不持有 pgdir 锁）
+    unmap_file_pages(&cp->pgdir, st, st->begin, end);
+    acquire_spinlock(&cp->pgdir.lock);
+    if(end == st->end) {
+        remove_section(&cp->pgdir, st);
+        release_spinlock(&cp->pgdir.lock);
+        file_close(st->fp); free_section(st);
+        return 0;
+    }
+    st->offset += end - st->begin;
+    resize_section(&cp->pgdir, st, end, st->end);
     release_spinlock(&cp->pgdir.lock);
     return 0;
     /* (Final) TODO END */
 }
 
+define_syscall(msync, void *addr, size_t length, int flags) {
+    auto cp = thisproc();
+    if((u64)addr % PAGE_SIZE != 0) return -1;
+    acquire_spinlock(&cp->pgdir.lock);
+    struct section* st = find_section(&cp->pgdir, (u64)addr);
+    release_spinlock(&cp->pgdir.lock);
+    if(st == NULL || !(st->flags & (ST_MMAP_SHARED | ST_MMAP_PRIVATE))) return -1;
+    // 写回是同步完成的，MS_ASYNC 也一样处理；页缓存就是唯一的一份，MS_INVALIDATE 无事可做
+    (void)flags;
+    sync_file_pages(&cp->pgdir, st, (u64)addr, MIN((u64)addr + length, st->end));
+    return 0;
+}
+
 define_syscall(dup, int fd) {
     //printk("sys_dup called: fd=%d\n", fd);
     struct file *f = fd2file(fd);
@@ -234,57 +204,84 @@ define_syscall(dup, int fd) {
     return new_fd;
 }
 
+// read/write 经过一页内核缓冲区中转：file_read/file_write 会在持有管道的自旋锁或 inode 锁时
+// 访问缓冲区，不能在那里直接访问用户内存（缺页可能睡眠，映射的就是同一个文件时还会死锁）。
+// 普通文件按页循环读写；管道和终端读一次就返回，否则可能一直阻塞。
+static isize write_from_user(struct file *f, const char *ubuf, usize size, char *kbuf) {
+    usize total = 0;
+    while (total < size) {
+        usize n = MIN((usize)PAGE_SIZE, size - total);
+        if (copy_from_user(kbuf, ubuf + total, n) < 0) return total ? (isize)total : -1;
+        isize w = file_write(f, kbuf, n);
+        if (w <= 0) return total ? (isize)total : w;
+        total += w;
+        if ((usize)w < n) break;
+    }
+    return total;
+}
+
 // 63
 define_syscall(read, int fd, char *buffer, int size) {
-    // printk("[syscall_read] fd: %d, buffer: %p, size: %d\n", fd, buffer, size);
     struct file *f = fd2file(fd);
-    if (!f) {
-        // printk("[syscall_read] Error: Invalid file descriptor (fd: %d)\n\n", fd);
-        return -1;
-    }
-    if (size <= 0) {
-        // printk("[syscall_read] Error: Invalid size (size: %d)\n\n", size);
-        return -1;
-    }
-    if (!user_writeable(buffer, size)) {
-        // printk("[syscall_read] Error: Buffer not writable or invalid (buffer: %p, size: %d)\n\n", buffer, size);
-        return -1;
+    if (!f || size <= 0) return -1;
+    bool regular = f->type == FD_INODE && f->ip->entry.type == INODE_REGULAR;
+    char *kbuf = kalloc_page();
+    if (!kbuf) return -1;
+    isize total = 0;
+    while (total < size) {
+        isize n = MIN((isize)PAGE_SIZE, size - total);
+        isize got = file_read(f, kbuf, n);
+        if (got <= 0) {
+            if (total == 0) total = got;
+            break;
+        }
+        isize done = copy_to_user_partial(buffer + total, kbuf, got);
+        total += done;
+        if (done < got) {
+            // 管道里取出的数据放不回去，返回已经拷贝的部分；普通文件把偏移退回去
+            if (regular) f->off -= got - done;
+            if (total == 0) total = -1;
+            break;
+        }
+        if (!regular || got < n) break;
     }
-    int bytes_read = file_read(f, buffer, size);
-    // printk("[syscall_read] Successfully read %d bytes from fd: %d\n\n", bytes_read, fd);
-    return bytes_read;
+    kfree_page(kbuf);
+    return total;
 }
 
 define_syscall(write, int fd, char *buffer, int size) {
     struct file *f = fd2file(fd);
-    if (!f || size <= 0 || !user_readable(buffer, size)) return -1;
-    return file_write(f, buffer, size);
+    if (!f || size <= 0) return -1;
+    char *kbuf = kalloc_page();
+    if (!kbuf) return -1;
+    isize ret = write_from_user(f, buffer, size, kbuf);
+    kfree_page(kbuf);
+    return ret;
 }
 
 // id == 66
 define_syscall(writev, int fd, struct iovec *iov, int iovcnt) {
-    // printk("writev called: fd=%d, iovcnt=%d\n", fd, iovcnt);
     struct file *f = fd2file(fd);
-    if (!f) {
-        //printk("writev: invalid fd or no file structure found for fd=%d\n\n", fd);
-        return -1;
-    }
-    struct iovec *p;
-    if (iovcnt <= 0 || !user_readable(iov, sizeof(struct iovec) * iovcnt)) {
-        //printk("writev: invalid iov or iovcnt=%d\n", iovcnt);
-        return -1;
-    }
-    // printk("writev: file path is %s\n", f->path);
-    usize tot = 0;
-    for (p = iov; p < iov + iovcnt; p++) {
-        if (!user_readable(p->iov_base, p->iov_len)) {
-            //printk("writev: invalid user buffer at base=%p, len=%llu\n", p->iov_base, p->iov_len);
-            return -1;
+    if (!f || iovcnt <= 0) return -1;
+    char *kbuf = kalloc_page();
+    if (!kbuf) return -1;
+    isize tot = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        struct iovec v;
+        if (copy_from_user(&v, &iov[i], sizeof(v)) < 0) {
+            if (tot == 0) tot = -1;
+            break;
         }
-        // printk("writev: writing %llu bytes from %p to fd=%d\n", p->iov_len, p->iov_base, fd);
-        tot += file_write(f, p->iov_base, p->iov_len);
+        if (v.iov_len == 0) continue;
+        isize w = write_from_user(f, v.iov_base, v.iov_len, kbuf);
+        if (w < 0) {
+            if (tot == 0) tot = -1;
+            break;
+        }
+        tot += w;
+        if ((usize)w < v.iov_len) break;
     }
-    //printk("writev: successfully written %llu bytes to fd=%d\n\n", tot, fd);
+    kfree_page(kbuf);
     return tot;
 }
 
@@ -301,12 +298,15 @@ define_syscall(close, int fd) {
 
 define_syscall(fstat, int fd, struct stat *st) {
     struct file *f = fd2file(fd);
-    if (!f || !user_writeable(st, sizeof(*st))) return -1;
-    return file_stat(f, st);
+    struct stat kst;
+    if (!f || file_stat(f, &kst) < 0) return -1;
+    return copy_to_user(st, &kst, sizeof(kst));
 }
 
-define_syscall(newfstatat, int dirfd, const char *path, struct stat *st, int flags) {
-    if (!user_strlen(path, 256) || !user_writeable(st, sizeof(*st))) return -1;
+define_syscall(newfstatat, int dirfd, const char *upath, struct stat *st, int flags) {
+    char path[MAX_PATH_LEN];
+    struct stat kst;
+    if (strncpy_from_user(path, upath, MAX_PATH_LEN) < 0) return -1;
     if (dirfd != AT_FDCWD) {
         printk("sys_fstatat: dirfd unimplemented\n"); return -1;
     }
@@ -320,11 +320,11 @@ define_syscall(newfstatat, int dirfd, const char *path, struct stat *st, int fla
         bcache.end_op(&ctx); return -1;
     }
     inodes.lock(ip);
-    stati(ip, st);
+    stati(ip, &kst);
     inodes.unlock(ip);
     inodes.put(&ctx, ip);
     bcache.end_op(&ctx);
-    return 0;
+    return copy_to_user(st, &kst, sizeof(kst));
 }
 
 static int isdirempty(Inode *dp) {
@@ -337,13 +337,13 @@ static int isdirempty(Inode *dp) {
     return 1;
 }
 
-define_syscall(unlinkat, int fd, const char *path, int flag) {
+define_syscall(unlinkat, int fd, const char *upath, int flag) {
     ASSERT(fd == AT_FDCWD && flag == 0);
     Inode *ip, *dp;
     DirEntry de;
-    char name[FILE_NAME_MAX_LENGTH];
+    char name[FILE_NAME_MAX_LENGTH], path[MAX_PATH_LEN];
     usize off;
-    if (!user_strlen(path, 256)) return -1;
+    if (strncpy_from_user(path, upath, MAX_PATH_LEN) < 0) return -1;
     OpContext ctx;
     bcache.begin_op(&ctx);
     if ((dp = nameiparent(path, name, &ctx)) == 0) {
@@ -445,10 +445,11 @@ Inode *create(const char *path, short type, short major, short minor, OpContext
     /* (Final) TODO END */
 }
 
-define_syscall(openat, int dirfd, const char *path, int omode) {
+define_syscall(openat, int dirfd, const char *upath, int omode) {
     //printk("sys_openat called: dirfd=%d, path=%s, omode=0x%x\n", dirfd, path, omode);
     int fd; struct file *f; Inode *ip;
-    if (!user_strlen(path, 256)) {
+    char path[MAX_PATH_LEN];
+    if (strncpy_from_user(path, upath, MAX_PATH_LEN) < 0) {
         //printk("sys_openat: invalid path\n");
         return -1;
     }
@@ -486,9 +487,10 @@ define_syscall(openat, int dirfd, const char *path, int omode) {
     return fd;
 }
 
-define_syscall(mkdirat, int dirfd, const char *path, int mode) {
+define_syscall(mkdirat, int dirfd, const char *upath, int mode) {
     Inode *ip;
-    if (!user_strlen(path, 256)) return -1;
+    char path[MAX_PATH_LEN];
+    if (strncpy_from_user(path, upath, MAX_PATH_LEN) < 0) return -1;
     if (dirfd != AT_FDCWD) {
         printk("sys_mkdirat: dirfd unimplemented\n"); return -1;
     }
@@ -506,10 +508,11 @@ define_syscall(mkdirat, int dirfd, const char *path, int mode) {
     return 0;
 }
 
-define_syscall(mknodat, int dirfd, const char *path, mode_t mode, dev_t dev) {
+define_syscall(mknodat, int dirfd, const char *upath, mode_t mode, dev_t dev) {
     //printk("sys_mknodat called: dirfd=%d, path=%s, mode=0x%x\n", dirfd, path, mode);
     Inode *ip; mode = mode;
-    if (!user_strlen(path, 256)) {
+    char path[MAX_PATH_LEN];
+    if (strncpy_from_user(path, upath, MAX_PATH_LEN) < 0) {
         printk("sys_mknodat: invalid path length\n\n"); return -1;
     }
     if (dirfd != AT_FDCWD) {  // 仅支持 AT_FDCWD
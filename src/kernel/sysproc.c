@@ -1,5 +1,8 @@
+#include <aarch64/intrinsic.h>
+#include <kernel/cpu.h>
 #include <kernel/mem.h>
 #include <kernel/paging.h>
+#include <kernel/uaccess.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
 #include <kernel/sched.h>
@@ -46,9 +49,41 @@ define_syscall(exit, int n) { exit(n); }
 define_syscall(exit_group, int n) { exit(n); }
 
 int execve(const char *path, char *const argv[], char *const envp[]);
+
+// execve 最多支持的参数（环境变量）个数，与 exec.c 中新栈上的指针数组大小一致
+#define EXEC_MAX_ARGS 31
+
+// 把用户态的字符串指针数组 uarr（以 NULL 结尾，可以是 NULL）复制到 karr，字符串本身
+// 依次放在 buf + *used 处（buf 共一页）。
+static int copy_user_strings(char *const *uarr, char **karr, char *buf, usize *used) {
+    int i = 0;
+    for (; uarr != NULL; i++) {
+        char *s;
+        if (copy_from_user(&s, &uarr[i], sizeof(s)) < 0) return -1;
+        if (s == NULL) break;
+        if (i == EXEC_MAX_ARGS) return -1;
+        isize len = strncpy_from_user(buf + *used, s, PAGE_SIZE - *used);
+        if (len < 0) return -1;
+        karr[i] = buf + *used;
+        *used += len + 1;
+    }
+    karr[i] = NULL;
+    return 0;
+}
+
 define_syscall(execve, const char *p, void *argv, void *envp) {
-    if (!user_strlen(p, 256)) { printk("what???\n\n"); return -1; }
-    return execve(p, argv, envp);
+    // 路径和参数先复制到内核中：execve 释放旧地址空间前后都不再访问用户内存
+    char *kargv[EXEC_MAX_ARGS + 1], *kenvp[EXEC_MAX_ARGS + 1];
+    char *buf = kalloc_page();
+    if (buf == NULL) return -1;
+    int ret = -1;
+    isize len = strncpy_from_user(buf, p, 256);
+    usize used = len + 1;
+    if (len >= 0 && copy_user_strings(argv, kargv, buf, &used) == 0
+        && copy_user_strings(envp, kenvp, buf, &used) == 0)
+        ret = execve(buf, kargv, kenvp);
+    kfree_page(buf);
+    return ret;
 }
 
 define_syscall(wait4, int pid, int *wstatus, int options, void *rusage) {
@@ -65,3 +100,170 @@ define_syscall(wait4, int pid, int *wstatus, int options, void *rusage) {
     // printk("sys_wait4 end...\n\n");
     return wait(&code);
 }
+
+struct __kernel_timespec {
+    i64 tv_sec;
+    i64 tv_nsec;
+};
+
+// 只支持单调时钟：返回开机以来的时间，用于用户态的性能测量
+define_syscall(clock_gettime, int clk, struct __kernel_timespec *tp) {
+    (void)clk;
+    u64 t = get_timestamp(), freq = get_clock_frequency();
+    struct __kernel_timespec ts = {.tv_sec = t / freq, .tv_nsec = (t % freq) * 1000000000 / freq};
+    return copy_to_user(tp, &ts, sizeof(ts));
+}
+
+static void sleep_timer_handler(struct timer *t) { activate_proc((Proc *)t->data); }
+
+// 定时器以毫秒计，不足 1ms 的部分向上取整。睡眠不能被 kill 打断，到点才返回。
+// 定时器挂在本 CPU 上，醒来时进程可能已在别的 CPU，所以不能再取消它，只能等它触发。
+define_syscall(nanosleep, const struct __kernel_timespec *req, struct __kernel_timespec *rem) {
+    (void)rem;
+    struct __kernel_timespec ts;
+    if (copy_from_user(&ts, req, sizeof(ts)) < 0) return -1;
+    if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) return -1;
+    i64 ms = ts.tv_sec * 1000 + (ts.tv_nsec + 999999) / 1000000;
+    if (ms == 0) return 0;
+    struct timer t;
+    t.elapse = MIN(ms, 0x7fffffffll);
+    t.handler = sleep_timer_handler;
+    t.data = (u64)thisproc();
+    set_cpu_timer(&t);
+    acquire_sched_lock();
+    sched(DEEPSLEEPING);
+    // 已被 kill 时 sched 直接返回，没有睡也没有换 CPU，定时器还在本 CPU 上
+    if (!t.triggered) cancel_cpu_timer(&t);
+    return 0;
+}
+
+define_syscall(execstat, struct exec_stat *ust) {
+    struct exec_stat kst, *st = &kst;
+    u64 freq = get_clock_frequency(), cnt, ticks, last, around;
+    get_exec_stat(&cnt, &ticks, &last);
+    st->exec_cnt = cnt;
+    st->exec_last_ns = last * 1000000000 / freq;
+    st->exec_avg_ns = cnt ? ticks / cnt * 1000000000 / freq : 0;
+    get_pgfault_stat(&cnt, &ticks, &around);
+    st->pgfault_cnt = cnt;
+    st->pgfault_avg_ns = cnt ? ticks / cnt * 1000000000 / freq : 0;
+    st->fault_around = around;
+    get_text_stat(&st->text_shared, &st->text_private);
+    struct page_cache_stat pc;
+    get_page_cache_stat(&pc);
+    st->pagecache_pages = pc.cached;
+    st->pagecache_mapped = pc.mapped;
+    st->mmap_fault = __atomic_load_n(&mmap_stat.fault, __ATOMIC_RELAXED);
+    st->mmap_dirtied = __atomic_load_n(&mmap_stat.dirtied, __ATOMIC_RELAXED);
+    st->mmap_writeback = __atomic_load_n(&mmap_stat.writeback, __ATOMIC_RELAXED);
+    return copy_to_user(ust, &kst, sizeof(kst));
+}
+
+// ASID 分配与 TLB 作废的计数（struct asid_stat）
+define_syscall(asidstat, struct asid_stat *ust) {
+    struct asid_stat kst;
+    get_asid_stat(&kst);
+    return copy_to_user(ust, &kst, sizeof(kst));
+}
+
+// 把前 n 个 CPU 的调度统计（struct sched_stat）拷给用户，返回 CPU 数
+define_syscall(schedstat, struct sched_stat *st, int n) {
+    if (n > NCPU) n = NCPU;
+    for (int i = 0; i < n; i++) {
+        // 先清零：get_sched_stat 漏填的字段不能把内核栈上的内容带给用户
+        struct sched_stat s = {0};
+        get_sched_stat(i, &s);
+        if (copy_to_user(st + i, &s, sizeof(s)) < 0) return -1;
+    }
+    return NCPU;
+}
+
+#define PRIO_PROCESS 0
+
+struct sched_param {
+    int sched_priority;
+};
+
+// 只支持 PRIO_PROCESS。与 Linux 一样返回 20 - nice，由 libc 换算回 nice。
+define_syscall(getpriority, int which, int who) {
+    struct sched_attr attr;
+    if (which != PRIO_PROCESS || get_sched_attr(who, &attr) < 0) return -1;
+    return 20 - attr.nice;
+}
+
+define_syscall(setpriority, int which, int who, int niceval) {
+    struct sched_attr attr;
+    if (which != PRIO_PROCESS || get_sched_attr(who, &attr) < 0) return -1;
+    attr.nice = niceval;
+    return set_sched_attr(who, &attr);
+}
+
+define_syscall(sched_setscheduler, int pid, int policy, const struct sched_param *param) {
+    struct sched_param sp;
+    struct sched_attr attr;
+    if (copy_from_user(&sp, param, sizeof(sp)) < 0 || get_sched_attr(pid, &attr) < 0) return -1;
+    attr.policy = policy;
+    attr.rt_priority = sp.sched_priority;
+    return set_sched_attr(pid, &attr);
+}
+
+define_syscall(sched_getscheduler, int pid) {
+    struct sched_attr attr;
+    if (get_sched_attr(pid, &attr) < 0) return -1;
+    return attr.policy;
+}
+
+define_syscall(sched_setparam, int pid, const struct sched_param *param) {
+    struct sched_param sp;
+    struct sched_attr attr;
+    if (copy_from_user(&sp, param, sizeof(sp)) < 0 || get_sched_attr(pid, &attr) < 0) return -1;
+    attr.rt_priority = sp.sched_priority;
+    return set_sched_attr(pid, &attr);
+}
+
+define_syscall(sched_getparam, int pid, struct sched_param *param) {
+    struct sched_attr attr;
+    if (get_sched_attr(pid, &attr) < 0) return -1;
+    struct sched_param sp = {attr.rt_priority};
+    return copy_to_user(param, &sp, sizeof(sp));
+}
+
+// CPU 掩码在用户态是按字节排列的位图，内核只看前 8 字节（NCPU <= 64），多出来的位忽略
+define_syscall(sched_setaffinity, int pid, usize len, const void *user_mask) {
+    u64 mask = 0;
+    if (len == 0 || copy_from_user(&mask, user_mask, MIN(len, sizeof(mask))) < 0) return -1;
+    return set_affinity(pid, mask);
+}
+
+// 与 Linux 一样返回写入的字节数
+define_syscall(sched_getaffinity, int pid, usize len, void *user_mask) {
+    u64 mask;
+    if (len < sizeof(mask) || get_affinity(pid, &mask) < 0) return -1;
+    if (copy_to_user(user_mask, &mask, sizeof(mask)) < 0) return -1;
+    return sizeof(mask);
+}
+
+define_syscall(procstat, int pid, struct proc_sched_stat *st) {
+    struct proc_sched_stat s;
+    if (get_proc_sched_stat(pid, &s) < 0) return -1;
+    return copy_to_user(st, &s, sizeof(s));
+}
+
+// 把至多 n 个锁类的统计（按等待时间从大到小）写入 st，返回锁类总数；
+// 内核没有打开 LOCK_STAT 时返回 -1
+define_syscall(lockstat, struct lock_stat *st, int n) {
+#ifdef LOCK_STAT
+    if (n < 0) return -1;
+    n = MIN(n, LOCK_STAT_MAX_CLASSES + 1);
+    // 一页放不下 LOCK_STAT_MAX_CLASSES + 1 项
+    struct lock_stat *buf = kalloc_pages(1);
+    if (buf == NULL) return -1;
+    int total = get_lock_stat(buf, n);
+    int ret = copy_to_user(st, buf, sizeof(struct lock_stat) * n) < 0 ? -1 : total;
+    kfree_pages(buf, 1);
+    return ret;
+#else
+    (void)st, (void)n;
+    return -1;
+#endif
+}
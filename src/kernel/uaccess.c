@@ -0,0 +1,49 @@
+#include <kernel/uaccess.h>
+
+extern u64 __arch_copy_user(void *dst, const void *src, u64 n);
+extern i64 __arch_strncpy_from_user(char *dst, const char *src, u64 n);
+
+struct exception_table_entry {
+    u64 insn;
+    u64 fixup;
+};
+
+// provided by linker.ld
+extern struct exception_table_entry __start_ex_table[], __stop_ex_table[];
+
+int copy_from_user(void *dst, const void *usrc, usize n) {
+    if (!access_ok(usrc, n))
+        return -1;
+    return __arch_copy_user(dst, usrc, n) ? -1 : 0;
+}
+
+int copy_to_user(void *udst, const void *src, usize n) {
+    if (!access_ok(udst, n))
+        return -1;
+    return __arch_copy_user(udst, src, n) ? -1 : 0;
+}
+
+usize copy_to_user_partial(void *udst, const void *src, usize n) {
+    if (!access_ok(udst, n))
+        return 0;
+    return n - __arch_copy_user(udst, src, n);
+}
+
+isize strncpy_from_user(char *dst, const char *usrc, usize n) {
+    if (n == 0 || !access_ok(usrc, 1))
+        return -1;
+    // 字符串可能比 n 短，只截到用户空间的末尾，不整段拒绝
+    n = MIN(n, USPACE_TOP - (u64)usrc);
+    i64 len = __arch_strncpy_from_user(dst, usrc, n);
+    if (len < 0 || (usize)len >= n)
+        return -1;
+    return len;
+}
+
+// 表项只有 uaccess.S 里的几条，线性查找即可
+u64 search_exception_table(u64 pc) {
+    for (struct exception_table_entry *e = __start_ex_table; e < __stop_ex_table; e++)
+        if (e->insn == pc)
+            return e->fixup;
+    return 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <aarch64/mmu.h>
+#include <common/defines.h>
+
+// 直接访问用户内存的拷贝函数：不预先检查用户地址，访问出错（地址不属于任何段、
+// 写只读段等）时由异常修复表（__ex_table）接住，返回错误而不是让内核崩溃。
+// 缺页照常由 pgfault_handler 处理，所以按需映射的页也能正确访问。
+// 拷贝用的是普通的 EL1 ldr/str，内核地址不会出错，所以先用 access_ok 挡住不在用户空间的范围。
+// 不能在持有自旋锁时调用（缺页处理可能睡眠）。
+
+// [uaddr, uaddr + n) lies entirely in user space (no wrap-around, no KSPACE bits).
+static INLINE bool access_ok(const void *uaddr, usize n) {
+    u64 begin = (u64)uaddr, end = begin + n;
+    return !(begin & KSPACE_MASK) && end >= begin && end <= USPACE_TOP;
+}
+
+// return 0 on success, -1 if some byte of the user range is not accessible.
+WARN_RESULT int copy_from_user(void *dst, const void *usrc, usize n);
+WARN_RESULT int copy_to_user(void *udst, const void *src, usize n);
+// like copy_to_user, but return how many bytes were copied before the fault
+// (n on success), for callers that cannot undo taking the data out of a pipe.
+WARN_RESULT usize copy_to_user_partial(void *udst, const void *src, usize n);
+
+// copy a '\0'-terminated string of at most n bytes (including '\0').
+// return its length without '\0', or -1 on fault or if it is too long.
+WARN_RESULT isize strncpy_from_user(char *dst, const char *usrc, usize n);
+
+// the fixup address for a faulting kernel instruction at pc, or 0 if none.
+u64 search_exception_table(u64 pc);
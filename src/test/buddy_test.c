@@ -0,0 +1,111 @@
+#include <aarch64/intrinsic.h>
+#include <aarch64/mmu.h>
+#include <common/rc.h>
+#include <common/string.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <test/test.h>
+#define NULL 0
+
+#define BD_ROUNDS 500
+#define BD_MAX_TEST_ORDER 4
+#define FRAG_BLOCKS 2048
+
+static RefCount bd_x;
+static void *bd_p[4][BD_ROUNDS];
+static int bd_order[4][BD_ROUNDS];
+static void *frag_p[FRAG_BLOCKS];
+static int frag_order[FRAG_BLOCKS];
+
+static int largest_free_order(struct buddy_stat *st) {
+    for (int k = BUDDY_MAX_ORDER; k >= 0; k--)
+        if (st->nr_free[k])
+            return k;
+    return -1;
+}
+
+// 外部碎片指数：空闲页中无法用来满足一次 `order` 阶分配的比例（千分比）
+static u64 frag_index(struct buddy_stat *st, int order) {
+    u64 total = 0, usable = 0;
+    for (int k = 0; k <= BUDDY_MAX_ORDER; k++) {
+        total += st->nr_free[k] << k;
+        if (k >= order)
+            usable += st->nr_free[k] << k;
+    }
+    return total ? (total - usable) * 1000 / total : 0;
+}
+
+static void print_free_area(const char *tag, struct buddy_stat *st) {
+    printk("%s: free blocks by order:", tag);
+    for (int k = 0; k <= BUDDY_MAX_ORDER; k++)
+        printk(" %llu", (u64)st->nr_free[k]);
+    printk(", largest order %d, frag(order 9) %llu/1000\n",
+           largest_free_order(st), frag_index(st, 9));
+}
+
+void buddy_test() {
+    int i = cpuid();
+    if (i == 0)
+        printk("\n\nbuddy_test\n");
+    // 四个 CPU 同时申请 0~4 阶的块，检查对齐且互不重叠
+    test_sync(&bd_x, 1);
+    for (int j = 0; j < BD_ROUNDS; j++) {
+        int order = rand() % (BD_MAX_TEST_ORDER + 1);
+        u64 *q = bd_p[i][j] = kalloc_pages(order);
+        bd_order[i][j] = order;
+        if (!q || ((u64)q & ((PAGE_SIZE << order) - 1)))
+            FAIL("FAIL: kalloc_pages(%d) = %p\n", order, q);
+        for (usize k = 0; k < (PAGE_SIZE << order) / sizeof(u64); k += PAGE_SIZE / sizeof(u64))
+            q[k] = (u64)i << 32 | j;
+    }
+    test_sync(&bd_x, 2);
+    for (int j = 0; j < BD_ROUNDS; j++) {
+        u64 *q = bd_p[i][j];
+        for (usize k = 0; k < (PAGE_SIZE << bd_order[i][j]) / sizeof(u64); k += PAGE_SIZE / sizeof(u64))
+            if (q[k] != ((u64)i << 32 | j))
+                FAIL("FAIL: block[%d][%d] overlapped\n", i, j);
+        kfree_pages(q, bd_order[i][j]);
+    }
+    test_sync(&bd_x, 3);
+    if (i == 0) {
+        // 碎片化基准：只用 1~3 阶（不经过 magazine），交错释放一半后观察空闲块分布，
+        // 再全部释放，检查伙伴能合并回初始状态。
+        struct buddy_stat before, mid, after;
+        get_buddy_stat(&before);
+        print_free_area("initial", &before);
+        u64 t0 = get_timestamp();
+        for (int j = 0; j < FRAG_BLOCKS; j++) {
+            frag_order[j] = rand() % 3 + 1;
+            frag_p[j] = kalloc_pages(frag_order[j]);
+            if (frag_p[j] == NULL)
+                FAIL("FAIL: kalloc_pages(%d) out of memory\n", frag_order[j]);
+        }
+        u64 t1 = get_timestamp();
+        for (int j = 0; j < FRAG_BLOCKS; j += 2)
+            kfree_pages(frag_p[j], frag_order[j]);
+        get_buddy_stat(&mid);
+        print_free_area("after freeing every other block", &mid);
+        void *huge = kalloc_pages(9);
+        if (huge == NULL)
+            FAIL("FAIL: no 2MB block left\n");
+        kfree_pages(huge, 9);
+        u64 t2 = get_timestamp();
+        for (int j = 1; j < FRAG_BLOCKS; j += 2)
+            kfree_pages(frag_p[j], frag_order[j]);
+        u64 t3 = get_timestamp();
+        get_buddy_stat(&after);
+        print_free_area("after freeing all", &after);
+        for (int k = 0; k <= BUDDY_MAX_ORDER; k++)
+            if (after.nr_free[k] != before.nr_free[k])
+                FAIL("FAIL: order %d has %llu free blocks, expected %llu\n", k,
+                     (u64)after.nr_free[k], (u64)before.nr_free[k]);
+        u64 freq = get_clock_frequency();
+        printk("alloc %lld ns/block, free %lld ns/block\n",
+               (t1 - t0) * 1000000000 / freq / FRAG_BLOCKS,
+               (t3 - t2) * 1000000000 / freq / (FRAG_BLOCKS / 2));
+        printk("split %llu merge %llu alloc_fail %llu\n",
+               (u64)(after.split - before.split),
+               (u64)(after.merge - before.merge), (u64)after.alloc_fail);
+        printk("buddy_test PASS\n");
+    }
+}
@@ -4,6 +4,8 @@
 #include <common/string.h>
 #include <aarch64/intrinsic.h>
 
+#define IO_LATENCY_ROUNDS 1000
+
 void io_test() {
     static Buf buffer[1 << 11];
     int num_blocks = sizeof(buffer) / sizeof(buffer[0]);
@@ -86,5 +88,24 @@ void io_test() {
            num_blocks * BSIZE, megabytes, timestamp,
            megabytes * frequency / timestamp, (megabytes * frequency * 10 / timestamp) % 10);
 
+    // 单个请求从提交到完成中断唤醒发起者的往返时间，每次只有一个请求在飞
+    printk("\e[0;32m[Test] Measuring completion latency... \e[0m\n");
+    i64 min = 0, max = 0, sum = 0;
+    for (int i = 0; i < IO_LATENCY_ROUNDS; i++) {
+        buffer[0].flags = 0;
+        buffer[0].block_no = (u32)(i % num_blocks);
+        i64 t = (i64)get_timestamp();
+        virtio_blk_rw(&buffer[0]);
+        t = (i64)get_timestamp() - t;
+        if (i == 0 || t < min)
+            min = t;
+        if (t > max)
+            max = t;
+        sum += t;
+    }
+    printk("\e[0;32m[Test] %d single-block reads: avg %lld ns, min %lld ns, max %lld ns\e[0m\n",
+           IO_LATENCY_ROUNDS, sum / IO_LATENCY_ROUNDS * 1000000000 / frequency,
+           min * 1000000000 / frequency, max * 1000000000 / frequency);
+
     printk("\e[0;32m[Test] io_test PASS\e[0m\n");
 }
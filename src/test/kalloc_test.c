@@ -3,34 +3,23 @@
 #include <common/rc.h>
 #include <common/string.h>
 #include <kernel/mem.h>
+#include <kernel/paging.h>
 #include <kernel/printk.h>
+#include <kernel/slab.h>
 #include <test/test.h>
 #define NULL 0
 
-extern RefCount kalloc_page_cnt;
-
 static RefCount x;
 static void *p[4][10000];
 static short sz[4][10000];
 
-#define FAIL(...)            \
-    {                        \
-        printk(__VA_ARGS__); \
-        while (1);           \
-    }
-#define SYNC(i)              \
-    arch_dsb_sy();           \
-    increment_rc(&x);        \
-    while (x.count < 4 * i); \
-    arch_dsb_sy();
-
 void kalloc_test() {
     int i = cpuid();
-    int r = kalloc_page_cnt.count;
+    int r = kalloc_page_cnt();
     int y = 10000 - i * 500;
     if (i == 0)
         printk("\n\nkalloc_test\n");
-    SYNC(1)
+    test_sync(&x, 1);
     for (int j = 0; j < y; j++) {
         p[i][j] = kalloc_page();
         if (!p[i][j] || ((u64)p[i][j] & 4095))
@@ -44,10 +33,10 @@ void kalloc_test() {
                 FAIL("FAIL: page[%d][%d] wrong\n", i, j);
         kfree_page(p[i][j]);
     }
-    SYNC(2)
-    if (kalloc_page_cnt.count != r)
-        FAIL("FAIL: kalloc_page_cnt %d -> %lld\n", r, kalloc_page_cnt.count);
-    SYNC(3)
+    test_sync(&x, 2);
+    if (kalloc_page_cnt() != r)
+        FAIL("FAIL: kalloc_page_cnt %d -> %lld\n", r, kalloc_page_cnt());
+    test_sync(&x, 3);
     for (int j = 0; j < 10000;) {
         if (j < 1000 || rand() > RAND_MAX / 16 * 7) {
             int z = 0;
@@ -89,18 +78,159 @@ void kalloc_test() {
             sz[i][k] = sz[i][j];
         }
     }
-    SYNC(4)
+    test_sync(&x, 4);
     if (cpuid() == 0) {
         i64 z = 0;
         for (int j = 0; j < 4; j++)
             for (int k = 0; k < 10000; k++)
                 z += sz[j][k];
-        printk("Total: %lld\nUsage: %lld\n", z, kalloc_page_cnt.count - r);
+        printk("Total: %lld\nUsage: %lld\n", z, kalloc_page_cnt() - r);
     }
-    SYNC(5)
+    test_sync(&x, 5);
     for (int j = 0; j < 10000; j++)
         kfree(p[i][j]);
-    SYNC(6)
+    test_sync(&x, 6);
     if (cpuid() == 0)
         printk("kalloc_test PASS\n");
 }
+
+#define TP_ROUNDS 20000
+#define TP_BURST 16
+
+static RefCount tp_x;
+static void *tp_p[4][TP_BURST];
+static u64 tp_cycles[4];
+
+// 吞吐模式：依次让 1~4 个 CPU 同时反复 kalloc_page/kfree_page，
+// 报告每个核每秒处理的页数，用来观察 magazine 对多核争用的缓解效果。
+void kalloc_throughput_test() {
+    int i = cpuid();
+    if (i == 0)
+        printk("\n\nkalloc_throughput_test\n");
+    for (int n = 1; n <= 4; n++) {
+        test_sync(&tp_x, 2 * n - 1);
+        if (i < n) {
+            u64 t0 = get_timestamp();
+            for (int r = 0; r < TP_ROUNDS; r++) {
+                for (int k = 0; k < TP_BURST; k++)
+                    tp_p[i][k] = kalloc_page();
+                for (int k = 0; k < TP_BURST; k++)
+                    kfree_page(tp_p[i][k]);
+            }
+            tp_cycles[i] = get_timestamp() - t0;
+        }
+        test_sync(&tp_x, 2 * n);
+        if (i == 0) {
+            for (int j = 0; j < n; j++) {
+                u64 pages = (u64)TP_ROUNDS * TP_BURST;
+                printk("%d cpu(s): cpu %d %lld pages/s\n", n, j,
+                       pages * get_clock_frequency() / tp_cycles[j]);
+            }
+        }
+    }
+    if (i == 0)
+        printk("kalloc_throughput_test PASS\n");
+}
+
+#define SLAB_TEST_OBJS 2000
+
+static RefCount sl_x;
+static KMemCache *sl_cache;
+static void *sl_p[4][SLAB_TEST_OBJS];
+
+static void slab_test_ctor(void *obj) {
+    memset(obj, 0x5a, 40);
+}
+
+// 四个 CPU 同时从同一个 cache 申请/释放对象，检查对象互不重叠、构造状态被保持，
+// 最后打印所有 cache 的对象数与内存开销。
+void slab_test() {
+    int i = cpuid();
+    if (i == 0) {
+        printk("\n\nslab_test\n");
+        sl_cache = kmem_cache_create("slab_test", 40, slab_test_ctor);
+    }
+    test_sync(&sl_x, 1);
+    for (int j = 0; j < SLAB_TEST_OBJS; j++) {
+        u8 *obj = sl_p[i][j] = kmem_cache_alloc(sl_cache);
+        if (!obj || ((u64)obj & 15))
+            FAIL("FAIL: kmem_cache_alloc() = %p\n", obj);
+        for (int k = 0; k < 40; k++)
+            if (obj[k] != 0x5a)
+                FAIL("FAIL: object %p not constructed\n", obj);
+        *(u64 *)obj = (u64)i << 32 | j;
+    }
+    test_sync(&sl_x, 2);
+    for (int j = 0; j < SLAB_TEST_OBJS; j++) {
+        u64 *obj = sl_p[i][j];
+        if (*obj != ((u64)i << 32 | j))
+            FAIL("FAIL: object[%d][%d] overlapped\n", i, j);
+        memset(obj, 0x5a, 8);
+        kmem_cache_free(sl_cache, obj);
+    }
+    test_sync(&sl_x, 3);
+    if (i == 0) {
+        kmem_cache_report();
+        printk("slab_test PASS\n");
+    }
+}
+
+#define ZP_PAGES 64
+
+static void *zp_p[ZP_PAGES];
+
+static void zp_check_and_free(const char *tag, u64 ticks) {
+    for (int j = 0; j < ZP_PAGES; j++) {
+        u64 *q = zp_p[j];
+        for (usize k = 0; k < PAGE_SIZE / sizeof(u64); k++)
+            if (q[k] != 0)
+                FAIL("FAIL: %s page %p not zeroed\n", tag, q);
+        memset(q, 0xcc, PAGE_SIZE);  // 弄脏后再还回去，后面的分配才能检查出没清零的页
+        kfree_page(q);
+    }
+    printk("%s: %lld ns/page\n", tag,
+           ticks * 1000000000 / get_clock_frequency() / ZP_PAGES);
+}
+
+// 比较三种拿到全零页的方式的延迟：kalloc_page + 逐字节 memset、kalloc_page + zero_page、
+// 以及从预清零页池中直接取；最后打印页池命中率和缺页平均延迟。
+void zeroed_page_test() {
+    if (cpuid() != 0)
+        return;
+    printk("\n\nzeroed_page_test\n");
+    u64 t0 = get_timestamp();
+    for (int j = 0; j < ZP_PAGES; j++) {
+        zp_p[j] = kalloc_page();
+        memset(zp_p[j], 0, PAGE_SIZE);
+    }
+    zp_check_and_free("kalloc_page + memset", get_timestamp() - t0);
+    t0 = get_timestamp();
+    for (int j = 0; j < ZP_PAGES; j++) {
+        zp_p[j] = kalloc_page();
+        zero_page(zp_p[j]);
+    }
+    zp_check_and_free("kalloc_page + zero_page", get_timestamp() - t0);
+    // 池是每个 CPU 一个，把本 CPU 的池补满（ZP_PAGES 正好是一个池的大小）
+    struct zero_pool_stat st;
+    usize refilled;
+    do {
+        get_zero_pool_stat(&st);
+        refilled = st.refilled;
+        refill_zeroed_pages();
+        get_zero_pool_stat(&st);
+    } while (st.refilled != refilled);
+    t0 = get_timestamp();
+    for (int j = 0; j < ZP_PAGES; j++)
+        zp_p[j] = kalloc_zeroed_page();
+    zp_check_and_free("kalloc_zeroed_page (pool hit)", get_timestamp() - t0);
+    get_zero_pool_stat(&st);
+    printk("zero pool: hit %llu miss %llu (hit rate %llu%%) refilled %llu pooled %llu\n",
+           (u64)st.hit, (u64)st.miss,
+           st.hit + st.miss ? (u64)st.hit * 100 / (st.hit + st.miss) : 0,
+           (u64)st.refilled, (u64)st.pooled);
+    u64 cnt, ticks, around;
+    get_pgfault_stat(&cnt, &ticks, &around);
+    printk("page faults: %llu (+%llu pages by fault-around), avg %lld ns\n", cnt, around,
+           cnt ? ticks * 1000000000 / get_clock_frequency() / cnt : 0);
+    printk("zeroed_page_test PASS\n");
+}
@@ -18,12 +18,6 @@ static bool rb_cmp(rb_node n1, rb_node n2)
 static struct mytype p[4][1000], tmp;
 static struct rb_root_ rt;
 static SpinLock lock;
-#define FAIL(...)            \
-    {                        \
-        printk(__VA_ARGS__); \
-        while (1)            \
-            ;                \
-    }
 static RefCount x;
 
 void rbtree_test()
@@ -34,12 +28,8 @@ void rbtree_test()
         p[cid][i].data = -p[cid][i].key;
     }
     if (cid == 0)
-        init_spinlock(&lock);
-    arch_dsb_sy();
-    increment_rc(&x);
-    while (x.count < 4)
-        ;
-    arch_dsb_sy();
+        init_spinlock(&lock, "rbtree_test");
+    test_sync(&x, 1);
     for (int i = 0; i < 1000; i++) {
         acquire_spinlock(&lock);
         int ok = _rb_insert(&p[cid][i].node, &rt, rb_cmp);
@@ -60,11 +50,7 @@ void rbtree_test()
         }
         release_spinlock(&lock);
     }
-    arch_dsb_sy();
-    increment_rc(&x);
-    while (x.count < 8)
-        ;
-    arch_dsb_sy();
+    test_sync(&x, 2);
     if (cid == 0)
         printk("rbtree_test PASS\n");
 }
\ No newline at end of file
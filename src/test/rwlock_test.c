@@ -0,0 +1,118 @@
+#include <aarch64/intrinsic.h>
+#include <common/rc.h>
+#include <common/rwlock.h>
+#include <common/seqlock.h>
+#include <common/spinlock.h>
+#include <kernel/printk.h>
+#include <test/test.h>
+
+#define RW_ROUNDS 20000
+#define RW_WRITES 2000
+#define RW_DATA 32  // 读者每次读的字数，模拟一次短的查找
+#define RW_KINDS 3
+
+static RefCount rw_x;
+static SpinLock rw_spin;
+static RWLock rw_lock;
+static SeqLock rw_seq;
+static volatile u64 rw_data[RW_DATA];
+static u64 rw_ops[4];
+static u64 rw_t0, rw_t1[4];
+static const char *rw_names[RW_KINDS] = {"spinlock", "rwlock", "seqlock"};
+
+// 读一遍 rw_data，写者总是把所有字改成同一个值，读到不一致说明锁有问题
+static bool rw_read(int kind) {
+    u64 first, sum = 0;
+    if (kind == 0) {
+        acquire_spinlock(&rw_spin);
+        first = rw_data[0];
+        for (int k = 0; k < RW_DATA; k++)
+            sum += rw_data[k];
+        release_spinlock(&rw_spin);
+    } else if (kind == 1) {
+        read_lock(&rw_lock);
+        first = rw_data[0];
+        for (int k = 0; k < RW_DATA; k++)
+            sum += rw_data[k];
+        read_unlock(&rw_lock);
+    } else {
+        u32 seq;
+        do {
+            seq = read_seqbegin(&rw_seq);
+            first = rw_data[0];
+            sum = 0;
+            for (int k = 0; k < RW_DATA; k++)
+                sum += rw_data[k];
+        } while (read_seqretry(&rw_seq, seq));
+    }
+    return sum == first * RW_DATA;
+}
+
+static void rw_write(int kind, u64 v) {
+    if (kind == 0)
+        acquire_spinlock(&rw_spin);
+    else if (kind == 1)
+        write_lock(&rw_lock);
+    else
+        write_seqlock(&rw_seq);
+    for (int k = 0; k < RW_DATA; k++)
+        rw_data[k] = v;
+    if (kind == 0)
+        release_spinlock(&rw_spin);
+    else if (kind == 1)
+        write_unlock(&rw_lock);
+    else
+        write_sequnlock(&rw_seq);
+}
+
+void rwlock_test() {
+    int i = cpuid(), phase = 0;
+    if (i == 0) {
+        printk("\n\nrwlock_test\n");
+        init_spinlock(&rw_spin, "rwlock_test");
+        init_rwlock(&rw_lock, "rwlock_test");
+        init_seqlock(&rw_seq, "rwlock_test");
+    }
+    u64 freq = get_clock_frequency();
+    for (int kind = 0; kind < RW_KINDS; kind++) {
+        // 正确性：CPU 3 不停地写，其余 CPU 检查每次读到的都是一致的快照
+        test_sync(&rw_x, ++phase);
+        if (i == 3) {
+            for (u64 v = 1; v <= RW_WRITES; v++)
+                rw_write(kind, v);
+        } else {
+            for (int j = 0; j < RW_ROUNDS / 4; j++)
+                if (!rw_read(kind))
+                    FAIL("FAIL: %s reader saw a torn write\n", rw_names[kind]);
+        }
+        // 扩展性：只有读者，1~4 个 CPU 同时读
+        for (int ncpu = 1; ncpu <= 4; ncpu++) {
+            if (i == 0) {
+                for (int k = 0; k < 4; k++)
+                    rw_ops[k] = rw_t1[k] = 0;
+                rw_t0 = get_timestamp();
+            }
+            test_sync(&rw_x, ++phase);
+            if (i < ncpu) {
+                for (int j = 0; j < RW_ROUNDS; j++)
+                    if (!rw_read(kind))
+                        FAIL("FAIL: %s reader saw a torn write\n", rw_names[kind]);
+                rw_t1[i] = get_timestamp();
+                rw_ops[i] = RW_ROUNDS;
+            }
+            test_sync(&rw_x, ++phase);
+            if (i != 0)
+                continue;
+            u64 ops = 0, end = rw_t0;
+            for (int k = 0; k < ncpu; k++) {
+                ops += rw_ops[k];
+                end = MAX(end, rw_t1[k]);
+            }
+            u64 ticks = end - rw_t0 ? end - rw_t0 : 1;
+            printk("%s, %d readers: %llu reads/ms\n", rw_names[kind], ncpu,
+                   ops * freq / 1000 / ticks);
+        }
+    }
+    if (i == 0)
+        printk("rwlock_test PASS\n");
+}
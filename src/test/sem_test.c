@@ -0,0 +1,120 @@
+#include <aarch64/intrinsic.h>
+#include <common/sem.h>
+#include <kernel/printk.h>
+#include <kernel/sched.h>
+#include <test/test.h>
+
+#define SEM_ROUNDS 10000
+#define SEM_WAITERS 16
+
+void set_parent_to_this(Proc *proc);
+
+static Semaphore ping, pong;
+static SpinLock wq_lock;
+static WaitQueue wq;
+static volatile int wq_queued, wq_woken;
+static volatile u64 wq_last;
+
+static void pingpong_proc(u64 rounds) {
+    for (u64 i = 0; i < rounds; i++) {
+        unalertable_wait_sem(&ping);
+        post_sem(&pong);
+    }
+    exit(0);
+}
+
+// 睡在 wq 上，被叫醒后记下个数与时间
+static void waiter_proc(u64 exclusive) {
+    acquire_spinlock(&wq_lock);
+    wq_queued++;
+    ASSERT(_sleep_on(&wq, &wq_lock, exclusive, false));
+    wq_woken++;
+    wq_last = get_timestamp();
+    release_spinlock(&wq_lock);
+    exit(0);
+}
+
+static void spawn(void (*entry)(u64), u64 arg) {
+    auto p = create_proc();
+    set_parent_to_this(p);
+    start_proc(p, entry, arg);
+}
+
+static void reap(int n) {
+    int code;
+    for (int i = 0; i < n; i++)
+        ASSERT(wait(&code) != -1);
+}
+
+// 起 SEM_WAITERS 个等待者，等它们全部睡下
+static void spawn_waiters(bool exclusive) {
+    wq_queued = wq_woken = 0;
+    for (int i = 0; i < SEM_WAITERS; i++)
+        spawn(waiter_proc, exclusive);
+    while (1) {
+        acquire_spinlock(&wq_lock);
+        bool all = wq_queued == SEM_WAITERS;
+        release_spinlock(&wq_lock);
+        if (all)
+            break;
+        yield();
+    }
+}
+
+// 需要在进程上下文中调用
+void sem_test() {
+    printk("\n\nsem_test\n");
+    u64 freq = get_clock_frequency();
+
+    // 两个内核进程通过一对信号量来回传递，测一次往返（两次睡眠-唤醒）的时间
+    init_sem(&ping, 0);
+    init_sem(&pong, 0);
+    spawn(pingpong_proc, SEM_ROUNDS);
+    u64 min = 0, max = 0, sum = 0;
+    for (int i = 0; i < SEM_ROUNDS; i++) {
+        u64 t = get_timestamp();
+        post_sem(&ping);
+        unalertable_wait_sem(&pong);
+        t = get_timestamp() - t;
+        if (i == 0 || t < min)
+            min = t;
+        max = MAX(max, t);
+        sum += t;
+    }
+    reap(1);
+    ASSERT(ping.val == 0 && pong.val == 0);
+    printk("sem ping-pong: %d round trips, avg %llu ns, min %llu ns, max %llu ns\n",
+           SEM_ROUNDS, sum / SEM_ROUNDS * 1000000000 / freq, min * 1000000000 / freq,
+           max * 1000000000 / freq);
+
+    init_spinlock(&wq_lock, "sem_test");
+    init_wait_queue(&wq);
+
+    // 独占等待：每次 wake_up_one 恰好叫醒一个，队列空了返回 0
+    spawn_waiters(true);
+    for (int i = 0; i < SEM_WAITERS; i++) {
+        acquire_spinlock(&wq_lock);
+        if (_wake_up_one(&wq) != 1)
+            PANIC();
+        release_spinlock(&wq_lock);
+    }
+    acquire_spinlock(&wq_lock);
+    ASSERT(_wake_up_one(&wq) == 0);
+    release_spinlock(&wq_lock);
+    reap(SEM_WAITERS);
+    ASSERT(wq_woken == SEM_WAITERS);
+
+    // 非独占等待：一次 wake_up_all 全部叫醒，测到最后一个开始运行的时间
+    spawn_waiters(false);
+    acquire_spinlock(&wq_lock);
+    u64 t0 = get_timestamp();
+    if (_wake_up_all(&wq) != SEM_WAITERS)
+        PANIC();
+    release_spinlock(&wq_lock);
+    reap(SEM_WAITERS);
+    ASSERT(wq_woken == SEM_WAITERS);
+    printk("wake_up_all: %d waiters, last one running after %llu ns\n", SEM_WAITERS,
+           (wq_last - t0) * 1000000000 / freq);
+
+    printk("sem_test PASS\n");
+}
@@ -0,0 +1,109 @@
+#include <aarch64/intrinsic.h>
+#include <common/rc.h>
+#include <common/spinlock.h>
+#include <kernel/printk.h>
+#include <test/test.h>
+
+#define LK_ROUNDS 20000
+#define LK_KINDS 3
+
+// 原来的 test-and-set 锁，作为对照
+typedef struct {
+    volatile bool locked;
+} TASLock;
+
+static void acquire_tas(TASLock *lock) {
+    while (lock->locked || __atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE))
+        arch_yield();
+}
+
+static void release_tas(TASLock *lock) {
+    __atomic_clear(&lock->locked, __ATOMIC_RELEASE);
+}
+
+static RefCount lk_x;
+static TASLock tas;
+static SpinLock ticket;
+static MCSLock mcs;
+static volatile u64 lk_counter;
+static u64 lk_ops[4], lk_max_wait[4];
+static u64 lk_t0, lk_t1[4];
+static const char *lk_names[LK_KINDS] = {"test-and-set", "ticket", "mcs"};
+
+static INLINE void lk_acquire(int kind) {
+    if (kind == 0)
+        acquire_tas(&tas);
+    else if (kind == 1)
+        acquire_spinlock(&ticket);
+    else
+        acquire_mcs_lock(&mcs);
+}
+
+static INLINE void lk_release(int kind) {
+    if (kind == 0)
+        release_tas(&tas);
+    else if (kind == 1)
+        release_spinlock(&ticket);
+    else
+        release_mcs_lock(&mcs);
+}
+
+// 前 ncpu 个 CPU 抢同一把锁，临界区很短（一次非原子的加一），
+// 临界区外也只做少量工作，这样几乎每次获取都要和别人竞争。
+static void lk_round(int i, int kind, int ncpu) {
+    if (i >= ncpu)
+        return;
+    u64 max_wait = 0;
+    for (int j = 0; j < LK_ROUNDS; j++) {
+        u64 t = get_timestamp();
+        lk_acquire(kind);
+        t = get_timestamp() - t;
+        if (t > max_wait)
+            max_wait = t;
+        lk_counter = lk_counter + 1;
+        lk_release(kind);
+        for (volatile int k = 0; k < 16; k++);
+    }
+    lk_t1[i] = get_timestamp();
+    lk_ops[i] = LK_ROUNDS;
+    lk_max_wait[i] = max_wait;
+}
+
+void spinlock_test() {
+    int i = cpuid(), phase = 0;
+    if (i == 0) {
+        printk("\n\nspinlock_test\n");
+        init_spinlock(&ticket, "spinlock_test");
+        init_mcs_lock(&mcs, "spinlock_test");
+    }
+    u64 freq = get_clock_frequency();
+    for (int kind = 0; kind < LK_KINDS; kind++) {
+        for (int ncpu = 1; ncpu <= 4; ncpu++) {
+            if (i == 0) {
+                lk_counter = 0;
+                for (int k = 0; k < 4; k++)
+                    lk_ops[k] = lk_max_wait[k] = lk_t1[k] = 0;
+                lk_t0 = get_timestamp();
+            }
+            test_sync(&lk_x, ++phase);
+            lk_round(i, kind, ncpu);
+            test_sync(&lk_x, ++phase);
+            if (i != 0)
+                continue;
+            u64 ops = 0, max_wait = 0, end = lk_t0;
+            for (int k = 0; k < ncpu; k++) {
+                ops += lk_ops[k];
+                max_wait = MAX(max_wait, lk_max_wait[k]);
+                end = MAX(end, lk_t1[k]);
+            }
+            if (lk_counter != ops)
+                FAIL("FAIL: %s lock lost updates: counter %llu, expected %llu\n",
+                     lk_names[kind], lk_counter, ops);
+            u64 ticks = end - lk_t0 ? end - lk_t0 : 1;
+            printk("%s, %d cpus: %llu acquires/ms, worst acquire %llu ns\n", lk_names[kind],
+                   ncpu, ops * freq / 1000 / ticks, max_wait * 1000000000 / freq);
+        }
+    }
+    if (i == 0)
+        printk("spinlock_test PASS\n");
+}
@@ -0,0 +1,153 @@
+#include <aarch64/intrinsic.h>
+#include <aarch64/mmu.h>
+#include <common/string.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <test/test.h>
+#define NULL 0
+
+// 两块 64KB 的缓冲区（kalloc_pages(4)），外加一块同样大小的参照区
+#define ST_ORDER 4
+#define ST_BYTES (PAGE_SIZE << ST_ORDER)
+#define ST_SMALL 300
+
+static u8 *st_a, *st_b, *st_ref;
+
+// 只填充/检查前 len 字节：被测区域前后各留几十字节，足以发现越界写
+static void st_fill(usize len) {
+    for (usize i = 0; i < len; i++) {
+        st_a[i] = (u8)rand();
+        st_b[i] = (u8)rand();
+    }
+}
+
+static void st_expect(const char *fn, usize len, usize n, int da, int sa) {
+    for (usize i = 0; i < len; i++)
+        if (st_a[i] != st_ref[i])
+            FAIL("FAIL: %s(n=%llu, dst+%d, src+%d): byte %llu is %d, expected %d\n",
+                 fn, n, da, sa, i, st_a[i], st_ref[i]);
+}
+
+static int ref_memcmp(const u8 *p, const u8 *q, usize n) {
+    for (usize i = 0; i < n; i++)
+        if (p[i] != q[i])
+            return p[i] - q[i];
+    return 0;
+}
+
+static void check_copy_set(usize n, int da, int sa) {
+    u8 *d = st_a + 64 + da, *s = st_b + 64 + sa;
+    usize len = MIN(n + 160, (usize)ST_BYTES);
+    void *r;
+    st_fill(len);
+    for (usize i = 0; i < len; i++)
+        st_ref[i] = st_a[i];
+    for (usize i = 0; i < n; i++)
+        st_ref[64 + da + i] = s[i];
+    if ((r = memcpy(d, s, n)) != d)
+        FAIL("FAIL: memcpy returned %p, expected %p\n", r, d);
+    st_expect("memcpy", len, n, da, sa);
+
+    for (int c = 0; c <= 0xa5; c += 0xa5) {
+        for (usize i = 0; i < n; i++)
+            st_ref[64 + da + i] = (u8)c;
+        // 高位应被忽略
+        if ((r = memset(d, c | 0x100, n)) != d)
+            FAIL("FAIL: memset returned %p, expected %p\n", r, d);
+        st_expect(c ? "memset" : "memset(0)", len, n, da, sa);
+    }
+
+    st_fill(len);
+    for (usize i = 0; i < n; i++)
+        d[i] = s[i];
+    if (n > 0) {
+        usize k = rand() % n;
+        d[k] = (u8)(s[k] + 1 + rand() % 255);
+    }
+    int got = memcmp(d, s, n), want = ref_memcmp(d, s, n);
+    if (got != want)
+        FAIL("FAIL: memcmp(n=%llu, +%d, +%d) = %d, expected %d\n", n, da, sa, got, want);
+}
+
+// 在同一块缓冲区内搬运，src 与 dst 相距 delta 字节（可以重叠）
+static void check_move(usize n, int delta) {
+    usize s = ST_BYTES / 2, d = s + delta;
+    st_fill(ST_BYTES);
+    for (usize i = 0; i < ST_BYTES; i++)
+        st_ref[i] = st_a[i];
+    for (usize i = 0; i < n; i++)
+        st_ref[d + i] = st_a[s + i];
+    if (memmove(st_a + d, st_a + s, n) != st_a + d)
+        FAIL("FAIL: memmove returned a wrong pointer\n");
+    st_expect("memmove", ST_BYTES, n, delta, 0);
+}
+
+enum { ST_MEMCPY, ST_MEMSET, ST_MEMSET0, ST_MEMCMP };
+static const char *st_names[] = {"memcpy", "memset", "memset(0)", "memcmp"};
+
+// 同一参数重复到累计约 4MB，报告 bytes/tick 和 MB/s。memcmp 比较的是两块相同的内容。
+static void bench_one(int fn, usize n, int da, int sa) {
+    u8 *d = st_a + da, *s = st_b + sa;
+    usize rounds = (4 << 20) / n;
+    if (fn == ST_MEMCMP)
+        memcpy(d, s, n);
+    u64 t0 = get_timestamp();
+    for (usize j = 0; j < rounds; j++) {
+        if (fn == ST_MEMCPY)
+            memcpy(d, s, n);
+        else if (fn == ST_MEMSET)
+            memset(d, 0x5a, n);
+        else if (fn == ST_MEMSET0)
+            memset(d, 0, n);
+        else if (memcmp(d, s, n) != 0)
+            FAIL("FAIL: memcmp of equal buffers\n");
+    }
+    u64 ticks = get_timestamp() - t0;
+    if (ticks == 0)
+        ticks = 1;
+    u64 bytes = (u64)rounds * n, frac = bytes * 100 / ticks % 100;
+    printk("%s n=%llu dst+%d src+%d: %llu.%llu%llu bytes/tick, %llu MB/s\n", st_names[fn], n,
+           da, sa, bytes / ticks, frac / 10, frac % 10,
+           bytes * get_clock_frequency() / ticks >> 20);
+}
+
+void string_test() {
+    if (cpuid() != 0)
+        return;
+    printk("\n\nstring_test\n");
+    st_a = kalloc_pages(ST_ORDER);
+    st_b = kalloc_pages(ST_ORDER);
+    st_ref = kalloc_pages(ST_ORDER);
+    if (st_a == NULL || st_b == NULL || st_ref == NULL)
+        FAIL("FAIL: out of memory\n");
+
+    // 每个长度都覆盖 16 字节内的各种对齐组合（跳着取，控制时间）
+    for (usize n = 0; n <= ST_SMALL; n++)
+        for (int da = 0; da < 16; da += 3)
+            for (int sa = 0; sa < 16; sa += 5)
+                check_copy_set(n, da, sa);
+    static const usize big[] = {511, 1024, 4096, 4096 + 7, 3 * PAGE_SIZE + 100,
+                                ST_BYTES - 128};
+    for (usize i = 0; i < sizeof(big) / sizeof(big[0]); i++)
+        for (int da = 0; da < 16; da += 7)
+            check_copy_set(big[i], da, 15 - da);
+    static const int deltas[] = {-100, -17, -16, -9, -8, -1, 0, 1, 7, 8, 15, 16, 17, 100};
+    for (usize n = 0; n <= 200; n += 39)
+        for (usize i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++)
+            check_move(n, deltas[i]);
+    check_move(ST_BYTES / 4, 33);
+    check_move(ST_BYTES / 4, -33);
+    printk("correctness OK\n");
+
+    static const usize sizes[] = {64, 512, 4096, 65536 - 64};
+    for (int f = ST_MEMCPY; f <= ST_MEMCMP; f++)
+        for (usize i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            bench_one(f, sizes[i], 0, 0);
+            bench_one(f, sizes[i], 3, 13);
+        }
+
+    kfree_pages(st_a, ST_ORDER);
+    kfree_pages(st_b, ST_ORDER);
+    kfree_pages(st_ref, ST_ORDER);
+    printk("string_test PASS\n");
+}
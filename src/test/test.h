@@ -1,9 +1,36 @@
 #pragma once
+#include <aarch64/intrinsic.h>
 #include <common/defines.h>
+#include <common/rc.h>
+#include <kernel/printk.h>
 
 #define RAND_MAX 32768
 
+// 多核测试共用：打印错误后停住这个 CPU
+#define FAIL(...)            \
+    {                        \
+        printk(__VA_ARGS__); \
+        while (1);           \
+    }
+
+// 四个 CPU 的屏障：每个 CPU 第 i 次到达时等 x 加到 4 * i。每组屏障用一个从 0 开始的 x
+static INLINE void test_sync(RefCount *x, int i)
+{
+    arch_dsb_sy();
+    increment_rc(x);
+    while (*(volatile isize *)&x->count < 4 * i);
+    arch_dsb_sy();
+}
+
 void kalloc_test();
+void kalloc_throughput_test();
+void slab_test();
+void buddy_test();
+void zeroed_page_test();
+void string_test();
+void spinlock_test();
+void rwlock_test();
+void sem_test();
 void rbtree_test();
 void proc_test();
 void vm_test();
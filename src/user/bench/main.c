@@ -0,0 +1,985 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <kernel/kstat.h>
+
+// 内核/用户态性能测量。用法: bench <fork | exec prog | read | vma | syscall | sched | fair | idle | pingpong | prio | affinity | tlb | munmap | fp | locks>
+
+#define PGSIZE 4096
+#define MAX_PAGES 1024
+#define FORK_ROUNDS 8
+#define EXEC_ROUNDS 4
+#define READ_ROUNDS 8
+#define READ_FILE_SIZE (64 * 1024)
+#define READ_CHUNK 512
+#define VMA_MAX_MAPS 256
+#define VMA_FAULT_PAGES 256
+#define VMA_SYSCALLS 200
+#define SYSCALL_ROUNDS 1000
+#define SYSCALL_IO 64
+#define SCHED_NCPU 4
+#define SCHED_MAX_PROCS 8
+#define SCHED_RUN_NS 500000000ll
+#define FAIR_MAX_HOGS 8
+#define FAIR_RUN_NS 1000000000ll
+#define IDLE_SLEEP_SEC 2
+#define PINGPONG_ROUNDS 1000
+#define PRIO_HOGS 4
+#define PRIO_RT 10
+#define AFFINITY_PROCS 8
+#define AFFINITY_BUF (128 * 1024)
+#define AFFINITY_RUN_NS 1000000000ll
+#define TLB_PAGES 256
+#define TLB_ROUNDS 16
+#define TLB_SWITCH_ROUNDS 2000
+#define MUNMAP_PAGES 16
+#define MUNMAP_ROUNDS 64
+#define MUNMAP_HOG_NS 300000000ll
+#define FP_COPY_BYTES (256 * 1024)
+#define FP_COPY_ROUNDS 64
+#define FP_SWITCH_ROUNDS 2000
+#define LOCK_CLASSES 65
+#define LOCK_TOP 20
+
+#ifndef SCHED_IDLE
+#define SCHED_IDLE 5
+#endif
+
+#define SYS_execstat 501
+#define SYS_schedstat 502
+#define SYS_procstat 503
+#define SYS_lockstat 504
+#define SYS_asidstat 505
+// 内核自己的 sbrk，参数是页数
+#define SYS_sbrk 12
+
+// 与内核 cpu.h 中的 struct sched_stat 一致
+struct sched_stat {
+    unsigned long long switches;
+    unsigned long long steals;
+    unsigned long long balances;
+    unsigned long long wake_migrations;
+    unsigned long long lock_acquire;
+    unsigned long long lock_contended;
+    unsigned long long idle_wakeups;
+    unsigned long long idle_ns;
+    unsigned long long ipi_sent;
+    unsigned long long ipi_received;
+    unsigned long long wakeup_preempts;
+    unsigned long long fp_traps;
+    unsigned long long fp_restores;
+    unsigned long long fp_saves;
+};
+
+// 与内核 sched.h 中的 struct proc_sched_stat 一致
+struct proc_sched_stat {
+    unsigned long long cpu;
+    unsigned long long nr_migrations;
+    unsigned long long nr_switches;
+    unsigned long long sum_exec_ns;
+};
+
+// 与内核 spinlock.h 中的 struct lock_stat 一致
+struct lock_stat {
+    char name[24];
+    unsigned long long sleep;
+    unsigned long long acquire;
+    unsigned long long contended;
+    unsigned long long wait_ns;
+    unsigned long long max_wait_ns;
+    unsigned long long max_hold_ns;
+};
+
+static char heap[MAX_PAGES * PGSIZE];
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// 父进程先写脏 npages 页，再测量 fork + 子进程退出 + wait 的总时间，
+// 以及子进程第一次写一页（触发写时复制）的时间。
+static void fork_bench() {
+    printf("fork latency vs parent size\n");
+    printf("pages  fork+exit+wait(us)  child first write(us/page)\n");
+    for (int npages = 0; npages <= MAX_PAGES; npages = npages ? npages * 4 : 16) {
+        for (int i = 0; i < npages; i++)
+            heap[i * PGSIZE] = (char)i;
+        long long total = 0, write_total = 0;
+        for (int r = 0; r < FORK_ROUNDS; r++) {
+            int fds[2];
+            if (pipe(fds) < 0) {
+                printf("bench: pipe failed\n");
+                exit(1);
+            }
+            long long t0 = now_ns();
+            int pid = fork();
+            if (pid < 0) {
+                printf("bench: fork failed\n");
+                exit(1);
+            }
+            if (pid == 0) {
+                close(fds[0]);
+                long long w0 = now_ns();
+                for (int i = 0; i < npages; i++)
+                    heap[i * PGSIZE]++;
+                long long w = now_ns() - w0;
+                write(fds[1], &w, sizeof(w));
+                close(fds[1]);
+                exit(0);
+            }
+            close(fds[1]);
+            wait(0);
+            total += now_ns() - t0;
+            long long w = 0;
+            read(fds[0], &w, sizeof(w));
+            close(fds[0]);
+            write_total += w;
+            // 父进程的页不应被子进程的写影响
+            for (int i = 0; i < npages; i++)
+                if (heap[i * PGSIZE] != (char)i) {
+                    printf("bench: parent page %d corrupted by child\n", i);
+                    exit(1);
+                }
+        }
+        printf("%d  %lld  %lld\n", npages, total / FORK_ROUNDS / 1000,
+               npages ? write_total / FORK_ROUNDS / npages / 1000 : 0);
+    }
+}
+
+// 子进程 exec 目标程序（标准输入接一个已关闭写端的管道，sh 读到 EOF 就退出），
+// 报告 execve 到新程序第一次系统调用的延迟，以及整个运行期间的缺页数。
+static void exec_bench(char *path) {
+    printf("exec latency of %s\n", path);
+    printf("exec->first syscall(us)  page faults  fault-around pages  avg fault(us)\n");
+    for (int r = 0; r < EXEC_ROUNDS; r++) {
+        struct exec_stat before, after;
+        syscall(SYS_execstat, &before);
+        int fds[2];
+        if (pipe(fds) < 0) {
+            printf("bench: pipe failed\n");
+            exit(1);
+        }
+        int pid = fork();
+        if (pid < 0) {
+            printf("bench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            close(0);
+            dup(fds[0]);
+            close(fds[0]);
+            close(fds[1]);
+            char *argv[] = {path, 0};
+            execv(path, argv);
+            printf("bench: exec %s failed\n", path);
+            exit(1);
+        }
+        close(fds[0]);
+        close(fds[1]);
+        wait(0);
+        syscall(SYS_execstat, &after);
+        printf("%llu  %llu  %llu  %llu\n", after.exec_last_ns / 1000,
+               after.pgfault_cnt - before.pgfault_cnt,
+               after.fault_around - before.fault_around,
+               after.pgfault_avg_ns / 1000);
+    }
+    struct exec_stat st;
+    syscall(SYS_execstat, &st);
+    printf("text page mappings: %llu shared, %llu private\n", st.text_shared,
+           st.text_private);
+    printf("page cache: %llu pages, %llu mappings\n", st.pagecache_pages,
+           st.pagecache_mapped);
+}
+
+// 顺序读吞吐：新写一个文件（写入不会填充页缓存），第一遍读要从块缓存装入页缓存，
+// 之后几遍直接命中页缓存。
+static void read_bench() {
+    const char *f = "bench.dat";
+    static char buf[READ_CHUNK];
+    unlink(f);
+    int fd = open(f, O_WRONLY | O_CREAT);
+    if (fd < 0) {
+        printf("bench: create %s failed\n", f);
+        exit(1);
+    }
+    memset(buf, 'x', sizeof(buf));
+    for (int i = 0; i < READ_FILE_SIZE / READ_CHUNK; i++)
+        if (write(fd, buf, READ_CHUNK) != READ_CHUNK) {
+            printf("bench: write failed\n");
+            exit(1);
+        }
+    close(fd);
+    printf("sequential read of %d bytes, %d bytes per read\n", READ_FILE_SIZE, READ_CHUNK);
+    printf("pass  time(us)  throughput(KB/s)\n");
+    for (int r = 0; r < READ_ROUNDS; r++) {
+        fd = open(f, O_RDONLY);
+        long long t0 = now_ns();
+        int total = 0, n;
+        while ((n = read(fd, buf, READ_CHUNK)) > 0)
+            total += n;
+        long long t = now_ns() - t0;
+        close(fd);
+        if (total != READ_FILE_SIZE) {
+            printf("bench: read %d bytes, expected %d\n", total, READ_FILE_SIZE);
+            exit(1);
+        }
+        printf("%d%s  %lld  %lld\n", r, r == 0 ? " (cold)" : "", t / 1000,
+               t ? (long long)READ_FILE_SIZE * 1000000000ll / 1024 / t : 0);
+    }
+    struct exec_stat st;
+    syscall(SYS_execstat, &st);
+    printf("page cache: %llu pages, %llu mappings\n", st.pagecache_pages,
+           st.pagecache_mapped);
+    unlink(f);
+}
+
+// 缺页与系统调用的开销随映射数的变化：每轮再多建一批单页的 mmap 映射，然后
+// fork 一个子进程写 VMA_FAULT_PAGES 页（每页一次写时复制缺页，缺页时要查找所在的段），
+// 再测 open 一个 255 字节长的不存在路径（内核逐字节检查路径是否在用户段内）。
+static void vma_bench() {
+    const char *f = "bench.vma";
+    static char path[256];
+    unlink(f);
+    int fd = open(f, O_RDWR | O_CREAT);
+    if (fd < 0 || write(fd, heap, PGSIZE) != PGSIZE) {
+        printf("bench: create %s failed\n", f);
+        exit(1);
+    }
+    memset(path, 'v', sizeof(path) - 1);
+    path[0] = '/';
+    for (int i = 0; i < VMA_FAULT_PAGES; i++)
+        heap[i * PGSIZE] = 1;
+    printf("mappings  COW fault(ns)  open 255-byte path(ns)\n");
+    int nmaps = 0;
+    for (int target = 0; target <= VMA_MAX_MAPS; target = target ? target * 4 : 4) {
+        for (; nmaps < target; nmaps++)
+            if (mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0) == MAP_FAILED) {
+                printf("bench: mmap failed\n");
+                exit(1);
+            }
+        int fds[2];
+        if (pipe(fds) < 0) {
+            printf("bench: pipe failed\n");
+            exit(1);
+        }
+        int pid = fork();
+        if (pid < 0) {
+            printf("bench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            long long t0 = now_ns();
+            for (int i = 0; i < VMA_FAULT_PAGES; i++)
+                heap[i * PGSIZE]++;
+            long long t = (now_ns() - t0) / VMA_FAULT_PAGES;
+            write(fds[1], &t, sizeof(t));
+            close(fds[1]);
+            exit(0);
+        }
+        close(fds[1]);
+        wait(0);
+        long long fault = 0;
+        read(fds[0], &fault, sizeof(fault));
+        close(fds[0]);
+        long long t0 = now_ns();
+        for (int i = 0; i < VMA_SYSCALLS; i++)
+            if (open(path, O_RDONLY) >= 0) {
+                printf("bench: %s should not exist\n", path);
+                exit(1);
+            }
+        long long sys = (now_ns() - t0) / VMA_SYSCALLS;
+        printf("%d  %lld  %lld\n", nmaps, fault, sys);
+    }
+    close(fd);
+    unlink(f);
+}
+
+static void report(const char *name, long long t0) {
+    printf("%s  %lld\n", name, (now_ns() - t0) / SYSCALL_ROUNDS);
+}
+
+// 常用系统调用各自的平均开销（ns），它们都要在内核与用户缓冲区之间拷贝数据
+static void syscall_bench() {
+    const char *f = "bench.sys";
+    static char buf[SYSCALL_IO];
+    struct stat st;
+    int fds[2], fd;
+    unlink(f);
+    fd = open(f, O_RDWR | O_CREAT);
+    for (int i = 0; i < SYSCALL_ROUNDS; i++)
+        write(fd, buf, SYSCALL_IO);
+    close(fd);
+    printf("syscall  ns/call\n");
+
+    long long t0 = now_ns();
+    for (int i = 0; i < SYSCALL_ROUNDS; i++)
+        syscall(SYS_gettid);
+    report("gettid", t0);
+
+    fd = open(f, O_RDONLY);
+    t0 = now_ns();
+    for (int i = 0; i < SYSCALL_ROUNDS; i++)
+        fstat(fd, &st);
+    report("fstat", t0);
+    t0 = now_ns();
+    for (int i = 0; i < SYSCALL_ROUNDS; i++)
+        read(fd, buf, SYSCALL_IO);
+    report("read 64B", t0);
+    close(fd);
+
+    t0 = now_ns();
+    for (int i = 0; i < SYSCALL_ROUNDS; i++)
+        close(open(f, O_RDONLY));
+    report("open+close", t0);
+
+    if (pipe(fds) < 0) {
+        printf("bench: pipe failed\n");
+        exit(1);
+    }
+    t0 = now_ns();
+    for (int i = 0; i < SYSCALL_ROUNDS; i++) {
+        write(fds[1], buf, SYSCALL_IO);
+        read(fds[0], buf, SYSCALL_IO);
+    }
+    report("pipe write+read 64B", t0);
+    close(fds[0]);
+    close(fds[1]);
+    unlink(f);
+}
+
+static void sched_sum(struct sched_stat *sum, int ncpu, unsigned long long *switches) {
+    struct sched_stat st[SCHED_NCPU];
+    syscall(SYS_schedstat, st, ncpu);
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; i < ncpu; i++) {
+        switches[i] = st[i].switches;
+        sum->switches += st[i].switches;
+        sum->steals += st[i].steals;
+        sum->balances += st[i].balances;
+        sum->wake_migrations += st[i].wake_migrations;
+        sum->lock_acquire += st[i].lock_acquire;
+        sum->lock_contended += st[i].lock_contended;
+    }
+}
+
+// 调度器吞吐：nproc 个进程各自不停地 sched_yield 一段时间，统计上下文切换速率、
+// 偷取/均衡迁移次数和运行队列锁的争用。CPU 数由 qemu 的 -smp 决定，
+// 分别用 -smp 1/2/4 启动后运行本测试即可对比。
+static void sched_bench() {
+    struct sched_stat probe[SCHED_NCPU];
+    int ncpu = syscall(SYS_schedstat, probe, SCHED_NCPU);
+    if (ncpu <= 0 || ncpu > SCHED_NCPU) {
+        printf("bench: schedstat failed\n");
+        exit(1);
+    }
+    printf("procs  yields/s  switches/s  steals  balances  wake migrations  "
+           "rq lock contended/acquired  switches per cpu\n");
+    for (int nproc = 1; nproc <= SCHED_MAX_PROCS; nproc *= 2) {
+        struct sched_stat before, after;
+        unsigned long long sw0[SCHED_NCPU], sw1[SCHED_NCPU];
+        int fds[2];
+        if (pipe(fds) < 0) {
+            printf("bench: pipe failed\n");
+            exit(1);
+        }
+        sched_sum(&before, ncpu, sw0);
+        long long t0 = now_ns();
+        for (int i = 0; i < nproc; i++) {
+            int pid = fork();
+            if (pid < 0) {
+                printf("bench: fork failed\n");
+                exit(1);
+            }
+            if (pid == 0) {
+                close(fds[0]);
+                long long n = 0;
+                while (now_ns() - t0 < SCHED_RUN_NS) {
+                    syscall(SYS_sched_yield);
+                    n++;
+                }
+                write(fds[1], &n, sizeof(n));
+                close(fds[1]);
+                exit(0);
+            }
+        }
+        close(fds[1]);
+        long long yields = 0, n;
+        for (int i = 0; i < nproc; i++) {
+            wait(0);
+            if (read(fds[0], &n, sizeof(n)) == sizeof(n))
+                yields += n;
+        }
+        close(fds[0]);
+        long long t = now_ns() - t0;
+        sched_sum(&after, ncpu, sw1);
+        printf("%d  %lld  %lld  %llu  %llu  %llu  %llu/%llu ", nproc,
+               yields * 1000000000ll / t,
+               (long long)(after.switches - before.switches) * 1000000000ll / t,
+               after.steals - before.steals, after.balances - before.balances,
+               after.wake_migrations - before.wake_migrations,
+               after.lock_contended - before.lock_contended,
+               after.lock_acquire - before.lock_acquire);
+        for (int i = 0; i < ncpu; i++)
+            printf(" %llu", sw1[i] - sw0[i]);
+        printf("\n");
+    }
+}
+
+static int spawn(int fds[2]) {
+    int pid = fork();
+    if (pid < 0) {
+        printf("bench: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0)
+        close(fds[0]);
+    return pid;
+}
+
+// libc 的 sched_setscheduler 不发系统调用，直接调用
+static void set_sched(int policy, int nice) {
+    struct sched_param sp = {policy == SCHED_FIFO || policy == SCHED_RR ? PRIO_RT : 0};
+    if (syscall(SYS_sched_setscheduler, 0, policy, &sp) < 0 ||
+        setpriority(PRIO_PROCESS, 0, nice) < 0) {
+        printf("bench: set policy %d nice %d failed\n", policy, nice);
+        exit(1);
+    }
+}
+
+// 公平性与交互延迟：nhogs 个纯计算进程与一对交互进程同时运行。计算进程报告各自完成的
+// 循环次数（越接近越公平，给出最少/最多之比和 Jain 公平指数，均为千分比）；交互进程
+// 通过管道一来一回，大部分时间睡眠，报告往返延迟的平均值与最大值。
+// 计算进程与交互进程分别使用 hog_policy/hog_nice 和 pair_policy 调度，结果行以 label 开头。
+static void fair_round(const char *label, int nhogs, int hog_policy, int hog_nice,
+                       int pair_policy) {
+    int hog[2], lat[2], ping[2], pong[2];
+    if (pipe(hog) < 0 || pipe(lat) < 0 || pipe(ping) < 0 || pipe(pong) < 0) {
+        printf("bench: pipe failed\n");
+        exit(1);
+    }
+    long long t0 = now_ns();
+    for (int i = 0; i < nhogs; i++) {
+        if (spawn(hog) == 0) {
+            long long n = 0;
+            set_sched(hog_policy, hog_nice);
+            while (now_ns() - t0 < FAIR_RUN_NS)
+                for (volatile int k = 0; k < 1000; k++)
+                    n++;
+            write(hog[1], &n, sizeof(n));
+            exit(0);
+        }
+    }
+    // 回声进程：收到一个字节就原样写回，读到 EOF 退出
+    if (spawn(lat) == 0) {
+        char c;
+        set_sched(pair_policy, 0);
+        close(ping[1]);
+        close(pong[0]);
+        while (read(ping[0], &c, 1) == 1)
+            write(pong[1], &c, 1);
+        exit(0);
+    }
+    if (spawn(lat) == 0) {
+        long long r[3] = {0, 0, 0};  // 往返次数、总延迟、最大延迟
+        char c = 'p';
+        set_sched(pair_policy, 0);
+        close(ping[0]);
+        close(pong[1]);
+        while (now_ns() - t0 < FAIR_RUN_NS) {
+            long long t = now_ns();
+            write(ping[1], &c, 1);
+            read(pong[0], &c, 1);
+            t = now_ns() - t;
+            r[0]++;
+            r[1] += t;
+            if (t > r[2])
+                r[2] = t;
+        }
+        close(ping[1]);
+        write(lat[1], r, sizeof(r));
+        exit(0);
+    }
+    close(hog[1]);
+    close(lat[1]);
+    close(ping[0]);
+    close(ping[1]);
+    close(pong[0]);
+    close(pong[1]);
+    for (int i = 0; i < nhogs + 2; i++)
+        wait(0);
+    long long min = 0, max = 0, sum = 0, sq = 0, n, r[3] = {0, 0, 0};
+    for (int i = 0; i < nhogs; i++) {
+        if (read(hog[0], &n, sizeof(n)) != sizeof(n))
+            break;
+        n /= 1000;
+        if (i == 0 || n < min)
+            min = n;
+        if (n > max)
+            max = n;
+        sum += n;
+        sq += n * n;
+    }
+    read(lat[0], r, sizeof(r));
+    close(hog[0]);
+    close(lat[0]);
+    printf("%s%d  %lld  %lld  %lld  %lld  %lld  %lld\n", label, nhogs, sum,
+           max ? min * 1000 / max : 1000, sq ? sum * sum * 1000 / (nhogs * sq) : 1000,
+           r[0], r[0] ? r[1] / r[0] / 1000 : 0, r[2] / 1000);
+}
+
+static void fair_bench() {
+    printf("hogs  hog work(k loops)  min/max  jain  round trips  avg rtt(us)  max rtt(us)\n");
+    for (int nhogs = 0; nhogs <= FAIR_MAX_HOGS; nhogs = nhogs ? nhogs * 2 : 1)
+        fair_round("", nhogs, SCHED_OTHER, 0, SCHED_OTHER);
+}
+
+// 后台计算负载下的交互延迟：PRIO_HOGS 个计算进程分别以 nice 0、nice 19、SCHED_IDLE 运行，
+// 最后一行让交互进程使用 SCHED_FIFO。
+static void prio_bench() {
+    printf("config / hogs  hog work(k loops)  min/max  jain  round trips  avg rtt(us)  max rtt(us)\n");
+    fair_round("hogs nice 0 / ", PRIO_HOGS, SCHED_OTHER, 0, SCHED_OTHER);
+    fair_round("hogs nice 19 / ", PRIO_HOGS, SCHED_OTHER, 19, SCHED_OTHER);
+    fair_round("hogs SCHED_IDLE / ", PRIO_HOGS, SCHED_IDLE, 0, SCHED_OTHER);
+    fair_round("pair SCHED_FIFO / ", PRIO_HOGS, SCHED_OTHER, 0, SCHED_FIFO);
+}
+
+// 空闲 CPU 的唤醒次数：本进程睡 IDLE_SLEEP_SEC 秒，期间系统里没有别的活，
+// 报告每个 CPU 空闲时间的占比，以及空闲时每秒从 wfi 醒来的次数。
+static void idle_bench() {
+    struct sched_stat before[SCHED_NCPU], after[SCHED_NCPU];
+    int ncpu = syscall(SYS_schedstat, before, SCHED_NCPU);
+    if (ncpu <= 0 || ncpu > SCHED_NCPU) {
+        printf("bench: schedstat failed\n");
+        exit(1);
+    }
+    struct timespec ts = {IDLE_SLEEP_SEC, 0};
+    long long t0 = now_ns();
+    nanosleep(&ts, 0);
+    long long t = now_ns() - t0;
+    syscall(SYS_schedstat, after, ncpu);
+    printf("slept %lld ms\n", t / 1000000);
+    printf("cpu  idle(%%)  wakeups  wakeups/s while idle\n");
+    for (int i = 0; i < ncpu; i++) {
+        unsigned long long w = after[i].idle_wakeups - before[i].idle_wakeups;
+        unsigned long long ns = after[i].idle_ns - before[i].idle_ns;
+        printf("%d  %llu  %llu  %llu\n", i, ns * 100 / t, w, ns ? w * 1000000000ull / ns : 0);
+    }
+}
+
+// 唤醒到运行的延迟：两个进程通过一对管道来回传一个字节，其余 CPU 空闲。
+// 每次往返包含两次“写管道唤醒对方 -> 对方开始运行”，单程延迟约为往返的一半。
+static void pingpong_bench() {
+    int ping[2], pong[2];
+    struct sched_stat before[SCHED_NCPU], after[SCHED_NCPU];
+    if (pipe(ping) < 0 || pipe(pong) < 0) {
+        printf("bench: pipe failed\n");
+        exit(1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+        printf("bench: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        char c;
+        close(ping[1]);
+        close(pong[0]);
+        while (read(ping[0], &c, 1) == 1)
+            write(pong[1], &c, 1);
+        exit(0);
+    }
+    close(ping[0]);
+    close(pong[1]);
+    int ncpu = syscall(SYS_schedstat, before, SCHED_NCPU);
+    long long min = 0, max = 0, sum = 0;
+    char c = 'p';
+    for (int i = 0; i < PINGPONG_ROUNDS; i++) {
+        long long t = now_ns();
+        write(ping[1], &c, 1);
+        read(pong[0], &c, 1);
+        t = now_ns() - t;
+        if (i == 0 || t < min)
+            min = t;
+        if (t > max)
+            max = t;
+        sum += t;
+    }
+    syscall(SYS_schedstat, after, ncpu);
+    close(ping[1]);
+    close(pong[0]);
+    wait(0);
+    printf("round trips  avg rtt(us)  min rtt(us)  max rtt(us)  avg wakeup-to-run(us)\n");
+    printf("%d  %lld  %lld  %lld  %lld\n", PINGPONG_ROUNDS, sum / PINGPONG_ROUNDS / 1000,
+           min / 1000, max / 1000, sum / PINGPONG_ROUNDS / 2000);
+    printf("cpu  switches  ipi sent  ipi received  wakeup preempts\n");
+    for (int i = 0; i < ncpu; i++)
+        printf("%d  %llu  %llu  %llu  %llu\n", i, after[i].switches - before[i].switches,
+               after[i].ipi_sent - before[i].ipi_sent,
+               after[i].ipi_received - before[i].ipi_received,
+               after[i].wakeup_preempts - before[i].wakeup_preempts);
+}
+
+// 绑核对缓存局部性的影响：AFFINITY_PROCS 个进程各自反复写一块 AFFINITY_BUF 大小的私有
+// 缓冲区，每遍之后睡 1ms 让出 CPU，醒来时可能被放到别的 CPU 上。先不绑核跑一轮，
+// 再把第 i 个进程绑到 CPU i % ncpu 上跑一轮，报告完成的遍数与每个进程的迁移次数。
+static char affinity_buf[AFFINITY_BUF];
+
+static void affinity_round(const char *label, int ncpu, int pin) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("bench: pipe failed\n");
+        exit(1);
+    }
+    long long t0 = now_ns();
+    for (int i = 0; i < AFFINITY_PROCS; i++) {
+        if (spawn(fds) == 0) {
+            unsigned long mask = 1ul << (i % ncpu);
+            if (pin && syscall(SYS_sched_setaffinity, 0, sizeof(mask), &mask) < 0) {
+                printf("bench: sched_setaffinity failed\n");
+                exit(1);
+            }
+            struct timespec ts = {0, 1000000};
+            long long r[3] = {0, 0, 0};  // 遍数、迁移次数、切换次数
+            while (now_ns() - t0 < AFFINITY_RUN_NS) {
+                for (int k = 0; k < AFFINITY_BUF; k += 64)
+                    affinity_buf[k]++;
+                r[0]++;
+                nanosleep(&ts, 0);
+            }
+            struct proc_sched_stat st;
+            if (syscall(SYS_procstat, 0, &st) == 0) {
+                r[1] = st.nr_migrations;
+                r[2] = st.nr_switches;
+            }
+            write(fds[1], r, sizeof(r));
+            exit(0);
+        }
+    }
+    close(fds[1]);
+    for (int i = 0; i < AFFINITY_PROCS; i++)
+        wait(0);
+    long long passes = 0, migrations = 0, switches = 0, r[3];
+    for (int i = 0; i < AFFINITY_PROCS; i++) {
+        if (read(fds[0], r, sizeof(r)) != sizeof(r))
+            break;
+        passes += r[0];
+        migrations += r[1];
+        switches += r[2];
+    }
+    close(fds[0]);
+    long long t = now_ns() - t0;
+    printf("%s  %lld  %lld  %lld  %lld\n", label, passes * 1000000000ll / t,
+           migrations / AFFINITY_PROCS, switches / AFFINITY_PROCS,
+           switches ? migrations * 1000 / switches : 0);
+}
+
+static void affinity_bench() {
+    struct sched_stat probe[SCHED_NCPU];
+    int ncpu = syscall(SYS_schedstat, probe, SCHED_NCPU);
+    if (ncpu <= 0 || ncpu > SCHED_NCPU) {
+        printf("bench: schedstat failed\n");
+        exit(1);
+    }
+    printf("config  passes/s  migrations/proc  switches/proc  migrations per 1000 switches\n");
+    affinity_round("unpinned", ncpu, 0);
+    affinity_round("pinned", ncpu, 1);
+}
+
+// 缺页率与上下文切换开销，以及期间 ASID 分配和 TLB 作废的次数。
+// 缺页：sbrk 扩大 TLB_PAGES 页后逐页写一遍（每页一次按需分配缺页），再缩回去，重复 TLB_ROUNDS 轮。
+// 切换：两个进程绑在同一个 CPU 上用管道来回传一个字节，每次往返两次切换（含两次读写管道）。
+static void tlb_bench() {
+    struct asid_stat before, after;
+    syscall(SYS_asidstat, &before);
+    long long fault_ns = 0;
+    for (int r = 0; r < TLB_ROUNDS; r++) {
+        char *p = (char *)syscall(SYS_sbrk, TLB_PAGES);
+        if (p == (char *)-1) {
+            printf("bench: sbrk failed\n");
+            exit(1);
+        }
+        long long t0 = now_ns();
+        for (int i = 0; i < TLB_PAGES; i++)
+            p[i * PGSIZE] = (char)i;
+        fault_ns += now_ns() - t0;
+        syscall(SYS_sbrk, -TLB_PAGES);
+    }
+    unsigned long mask = 1, all = ~0ul;
+    int ping[2], pong[2];
+    if (pipe(ping) < 0 || pipe(pong) < 0 ||
+        syscall(SYS_sched_setaffinity, 0, sizeof(mask), &mask) < 0) {
+        printf("bench: pipe or sched_setaffinity failed\n");
+        exit(1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+        printf("bench: fork failed\n");
+        exit(1);
+    }
+    char c = 't';
+    if (pid == 0) {
+        close(ping[1]);
+        close(pong[0]);
+        while (read(ping[0], &c, 1) == 1)
+            write(pong[1], &c, 1);
+        exit(0);
+    }
+    close(ping[0]);
+    close(pong[1]);
+    long long t0 = now_ns();
+    for (int i = 0; i < TLB_SWITCH_ROUNDS; i++) {
+        write(ping[1], &c, 1);
+        read(pong[0], &c, 1);
+    }
+    long long switch_ns = (now_ns() - t0) / TLB_SWITCH_ROUNDS / 2;
+    close(ping[1]);
+    close(pong[0]);
+    wait(0);
+    syscall(SYS_sched_setaffinity, 0, sizeof(all), &all);
+    syscall(SYS_asidstat, &after);
+    printf("page faults/s  fault(ns)  switch(ns)  asid allocs  asid rollovers  "
+           "tlbi pages  tlbi asids\n");
+    printf("%lld  %lld  %lld  %llu  %llu  %llu  %llu\n",
+           fault_ns ? (long long)TLB_ROUNDS * TLB_PAGES * 1000000000ll / fault_ns : 0,
+           fault_ns / (TLB_ROUNDS * TLB_PAGES), switch_ns,
+           after.alloc - before.alloc, after.rollover - before.rollover,
+           after.flush_va - before.flush_va, after.flush_asid - before.flush_asid);
+}
+
+// munmap 的延迟随其他 CPU 上负载的变化：0~3 个计算进程占着别的 CPU，本进程反复
+// mmap 一个 MUNMAP_PAGES 页的文件、逐页读一遍（建立映射与 TLB 项）、再 munmap。
+// 同时报告 TLB 作废中只在本地完成、需要广播、以及推迟到别的 CPU 下次装入时的次数。
+static void munmap_bench() {
+    const char *f = "bench.unmap";
+    unlink(f);
+    int fd = open(f, O_RDWR | O_CREAT);
+    for (int i = 0; i < MUNMAP_PAGES; i++)
+        if (fd < 0 || write(fd, heap, PGSIZE) != PGSIZE) {
+            printf("bench: create %s failed\n", f);
+            exit(1);
+        }
+    printf("busy cpus  munmap(us)  local  broadcast  deferred cpus\n");
+    for (int nbusy = 0; nbusy < SCHED_NCPU; nbusy++) {
+        long long t0 = now_ns();
+        for (int i = 0; i < nbusy; i++) {
+            int pid = fork();
+            if (pid < 0) {
+                printf("bench: fork failed\n");
+                exit(1);
+            }
+            if (pid == 0) {
+                while (now_ns() - t0 < MUNMAP_HOG_NS)
+                    ;
+                exit(0);
+            }
+        }
+        struct asid_stat before, after;
+        syscall(SYS_asidstat, &before);
+        long long total = 0;
+        volatile char sum = 0;
+        for (int r = 0; r < MUNMAP_ROUNDS; r++) {
+            char *p = mmap(0, MUNMAP_PAGES * PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                printf("bench: mmap failed\n");
+                exit(1);
+            }
+            for (int i = 0; i < MUNMAP_PAGES; i++)
+                sum += p[i * PGSIZE];
+            long long t = now_ns();
+            munmap(p, MUNMAP_PAGES * PGSIZE);
+            total += now_ns() - t;
+        }
+        syscall(SYS_asidstat, &after);
+        for (int i = 0; i < nbusy; i++)
+            wait(0);
+        printf("%d  %lld  %llu  %llu  %llu\n", nbusy, total / MUNMAP_ROUNDS / 1000,
+               after.flush_local - before.flush_local,
+               after.flush_broadcast - before.flush_broadcast,
+               after.flush_deferred - before.flush_deferred);
+    }
+    close(fd);
+    unlink(f);
+}
+
+// FP/SIMD 的开销。拷贝吞吐：同样的缓冲区分别用 8 字节的通用寄存器循环、16 字节的 SIMD
+// 寄存器循环和 libc 的 memcpy 拷贝。切换开销：两个进程绑在 CPU 0 上用管道来回传一个字节，
+// 分别是两边都不用 FP/SIMD、只有一边用、两边都用（每次往返都碰一下 SIMD 寄存器），
+// 并报告期间 FP/SIMD 陷入、装入与保存的次数。
+typedef unsigned char v16 __attribute__((vector_size(16)));
+static char fp_src[FP_COPY_BYTES], fp_dst[FP_COPY_BYTES];
+
+static void copy_gpr(void *dst, const void *src, int n) {
+    long *d = dst;
+    const long *s = src;
+    for (int i = 0; i < n / 8; i += 2) {
+        d[i] = s[i];
+        d[i + 1] = s[i + 1];
+    }
+}
+
+static void copy_simd(void *dst, const void *src, int n) {
+    v16 *d = dst;
+    const v16 *s = src;
+    for (int i = 0; i < n / 16; i++)
+        d[i] = s[i];
+}
+
+static void copy_libc(void *dst, const void *src, int n) {
+    memcpy(dst, src, n);
+}
+
+static void fp_copy(const char *label, void (*copy)(void *, const void *, int)) {
+    long long t0 = now_ns();
+    for (int r = 0; r < FP_COPY_ROUNDS; r++)
+        copy(fp_dst, fp_src, FP_COPY_BYTES);
+    long long t = now_ns() - t0;
+    printf("%s  %lld\n", label,
+           t ? (long long)FP_COPY_BYTES * FP_COPY_ROUNDS * 1000000000ll / 1024 / 1024 / t : 0);
+}
+
+static void touch_simd(int use) {
+    static volatile v16 acc;
+    if (use)
+        acc += (v16){1};
+}
+
+static void fp_switch(const char *label, int ncpu, int parent_fp, int child_fp) {
+    struct sched_stat before[SCHED_NCPU], after[SCHED_NCPU];
+    int ping[2], pong[2];
+    if (pipe(ping) < 0 || pipe(pong) < 0) {
+        printf("bench: pipe failed\n");
+        exit(1);
+    }
+    syscall(SYS_schedstat, before, ncpu);
+    int pid = fork();
+    if (pid < 0) {
+        printf("bench: fork failed\n");
+        exit(1);
+    }
+    char c = 'f';
+    if (pid == 0) {
+        close(ping[1]);
+        close(pong[0]);
+        while (read(ping[0], &c, 1) == 1) {
+            touch_simd(child_fp);
+            write(pong[1], &c, 1);
+        }
+        exit(0);
+    }
+    close(ping[0]);
+    close(pong[1]);
+    long long t0 = now_ns();
+    for (int i = 0; i < FP_SWITCH_ROUNDS; i++) {
+        touch_simd(parent_fp);
+        write(ping[1], &c, 1);
+        read(pong[0], &c, 1);
+    }
+    long long t = now_ns() - t0;
+    close(ping[1]);
+    close(pong[0]);
+    wait(0);
+    syscall(SYS_schedstat, after, ncpu);
+    struct sched_stat d = {0};
+    for (int i = 0; i < ncpu; i++) {
+        d.fp_traps += after[i].fp_traps - before[i].fp_traps;
+        d.fp_restores += after[i].fp_restores - before[i].fp_restores;
+        d.fp_saves += after[i].fp_saves - before[i].fp_saves;
+    }
+    printf("%s  %lld  %llu  %llu  %llu\n", label, t / FP_SWITCH_ROUNDS / 2, d.fp_traps,
+           d.fp_restores, d.fp_saves);
+}
+
+static void fp_bench() {
+    struct sched_stat probe[SCHED_NCPU];
+    int ncpu = syscall(SYS_schedstat, probe, SCHED_NCPU);
+    if (ncpu <= 0 || ncpu > SCHED_NCPU) {
+        printf("bench: schedstat failed\n");
+        exit(1);
+    }
+    memset(fp_src, 'f', sizeof(fp_src));
+    printf("copy  MB/s\n");
+    fp_copy("gpr", copy_gpr);
+    fp_copy("simd", copy_simd);
+    fp_copy("memcpy", copy_libc);
+    unsigned long mask = 1, all = ~0ul;
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), &mask) < 0) {
+        printf("bench: sched_setaffinity failed\n");
+        exit(1);
+    }
+    printf("fp users  switch(ns)  fp traps  restores  saves\n");
+    fp_switch("none", ncpu, 0, 0);
+    fp_switch("one", ncpu, 1, 0);
+    fp_switch("both", ncpu, 1, 1);
+    syscall(SYS_sched_setaffinity, 0, sizeof(all), &all);
+}
+
+// 打印开机以来等待时间最长的 LOCK_TOP 个锁类（内核需要以 -DLOCK_STAT=ON 构建）
+static void locks_report() {
+    static struct lock_stat st[LOCK_CLASSES];
+    int n = syscall(SYS_lockstat, st, LOCK_CLASSES);
+    if (n < 0) {
+        printf("bench: kernel built without LOCK_STAT\n");
+        exit(1);
+    }
+    if (n > LOCK_TOP)
+        n = LOCK_TOP;
+    printf("lock  type  acquire  contended  wait(us)  max wait(ns)  max hold(ns)\n");
+    for (int i = 0; i < n; i++)
+        printf("%s  %s  %llu  %llu  %llu  %llu  %llu\n", st[i].name,
+               st[i].sleep ? "sleep" : "spin", st[i].acquire, st[i].contended,
+               st[i].wait_ns / 1000, st[i].max_wait_ns, st[i].max_hold_ns);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("usage: bench <fork | exec prog | read | vma | syscall | sched | fair | idle | pingpong | prio | affinity | tlb | munmap | fp | locks>\n");
+        exit(1);
+    }
+    if (strcmp(argv[1], "fork") == 0)
+        fork_bench();
+    else if (strcmp(argv[1], "exec") == 0 && argc >= 3)
+        exec_bench(argv[2]);
+    else if (strcmp(argv[1], "read") == 0)
+        read_bench();
+    else if (strcmp(argv[1], "vma") == 0)
+        vma_bench();
+    else if (strcmp(argv[1], "syscall") == 0)
+        syscall_bench();
+    else if (strcmp(argv[1], "sched") == 0)
+        sched_bench();
+    else if (strcmp(argv[1], "fair") == 0)
+        fair_bench();
+    else if (strcmp(argv[1], "idle") == 0)
+        idle_bench();
+    else if (strcmp(argv[1], "pingpong") == 0)
+        pingpong_bench();
+    else if (strcmp(argv[1], "prio") == 0)
+        prio_bench();
+    else if (strcmp(argv[1], "affinity") == 0)
+        affinity_bench();
+    else if (strcmp(argv[1], "tlb") == 0)
+        tlb_bench();
+    else if (strcmp(argv[1], "munmap") == 0)
+        munmap_bench();
+    else if (strcmp(argv[1], "fp") == 0)
+        fp_bench();
+    else if (strcmp(argv[1], "locks") == 0)
+        locks_report();
+    else {
+        printf("bench: unknown benchmark %s\n", argv[1]);
+        exit(1);
+    }
+    exit(0);
+}
@@ -2,8 +2,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
+#include <kernel/kstat.h>
 
 #define PROT_NONE 0x0
 #define PROT_READ 0x1
@@ -13,12 +16,15 @@
 #define MAP_SHARED 0x01
 #define MAP_PRIVATE 0x02
 
+#define MS_SYNC 4
+
 #define PGSIZE 4096
 #define BSIZE 512
 #define O_CREATE O_CREAT
 
 void mmap_test();
 void fork_test();
+void throughput_test();
 char buf[BSIZE];
 
 #define MAP_FAILED ((char *)-1)
@@ -26,6 +32,7 @@ char buf[BSIZE];
 int main(int argc, char *argv[]) {
     mmap_test();
     // fork_test();
+    throughput_test();
     printf("mmaptest: all tests succeeded\n");
     printf("mmaptest end -------------\n\n\n");
     exit(0);
@@ -277,4 +284,98 @@ void fork_test(void)
     _v1(p2);
 
     printf("fork_test parent OK\n");
-}
\ No newline at end of file
+}
+
+#define SYS_execstat 501
+#define BIG_PAGES 16
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+}
+
+//
+// map a large file twice with MAP_SHARED, compare read() and mmap
+// throughput, and check that only the dirtied page is written back.
+//
+void throughput_test(void) {
+    const char *const f = "mmap.big";
+    static char big[PGSIZE];
+    int fd, i;
+    struct exec_stat s0, s1, s2;
+
+    printf("throughput_test starting\n");
+    testname = "throughput_test";
+
+    unlink(f);
+    if ((fd = open(f, O_RDWR | O_CREATE)) == -1)
+        err("open");
+    for (i = 0; i < BIG_PAGES; i++) {
+        memset(big, 'a' + i, PGSIZE);
+        if (write(fd, big, PGSIZE) != PGSIZE)
+            err("write big file");
+    }
+    if (close(fd) == -1)
+        err("close");
+
+    if ((fd = open(f, O_RDWR)) == -1)
+        err("open");
+    long long t0 = now_us();
+    for (i = 0; i < BIG_PAGES; i++)
+        if (read(fd, big, PGSIZE) != PGSIZE || big[PGSIZE - 1] != 'a' + i)
+            err("read big file");
+    long long t_read = now_us() - t0;
+
+    syscall(SYS_execstat, &s0);
+    char *p1 = mmap(0, PGSIZE * BIG_PAGES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    char *p2 = mmap(0, PGSIZE * BIG_PAGES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p1 == MAP_FAILED || p2 == MAP_FAILED)
+        err("mmap big file");
+    if (close(fd) == -1)
+        err("close");
+    long sum = 0;
+    t0 = now_us();
+    for (i = 0; i < PGSIZE * BIG_PAGES; i++)
+        sum += p1[i];
+    long long t_first = now_us() - t0;
+    t0 = now_us();
+    for (i = 0; i < PGSIZE * BIG_PAGES; i++)
+        sum -= p1[i];
+    long long t_second = now_us() - t0;
+    if (sum != 0)
+        err("mapped content changed");
+    for (i = 0; i < BIG_PAGES; i++)
+        if (p1[i * PGSIZE] != 'a' + i)
+            err("mapped content mismatch");
+    syscall(SYS_execstat, &s1);
+    printf("read() %d KB: %lld us; mmap first pass: %lld us (%llu faults); second pass: %lld us\n",
+           BIG_PAGES * PGSIZE / 1024, t_read, t_first, s1.mmap_fault - s0.mmap_fault, t_second);
+
+    // both shared mappings see the same physical page
+    p1[3 * PGSIZE + 7] = 'Z';
+    if (p2[3 * PGSIZE + 7] != 'Z')
+        err("shared mappings do not share pages");
+    if (msync(p1, PGSIZE * BIG_PAGES, MS_SYNC) == -1)
+        err("msync");
+    syscall(SYS_execstat, &s2);
+    if (s2.mmap_writeback - s1.mmap_writeback != 1)
+        err("msync should write back exactly one dirty page");
+    if (munmap(p1, PGSIZE * BIG_PAGES) == -1 || munmap(p2, PGSIZE * BIG_PAGES) == -1)
+        err("munmap big file");
+    syscall(SYS_execstat, &s1);
+    if (s1.mmap_writeback != s2.mmap_writeback)
+        err("munmap wrote back clean pages");
+
+    if ((fd = open(f, O_RDONLY)) == -1)
+        err("open");
+    for (i = 0; i < BIG_PAGES; i++) {
+        if (read(fd, big, PGSIZE) != PGSIZE)
+            err("read big file (2)");
+        if (big[7] != (i == 3 ? 'Z' : 'a' + i))
+            err("file does not contain modifications");
+    }
+    close(fd);
+    unlink(f);
+    printf("throughput_test: OK\n");
+}
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -157,6 +158,38 @@ int getcmd(char *buf, int nbuf)
     return 0;
 }
 
+// 解析命令前的 "@<cpu 列表> "，如 "@1 bench sched"、"@0,2-3 bench fair"。
+// CPU 掩码写到 *mask 并把 *ps 移到命令开头；没有前缀时掩码为 0，格式错误返回 -1。
+int parsepin(char **ps, unsigned long *mask) {
+    char *s = *ps;
+    *mask = 0;
+    if (*s != '@')
+        return 0;
+    s++;
+    while (1) {
+        if (*s < '0' || *s > '9')
+            return -1;
+        int lo = strtol(s, &s, 10), hi = lo;
+        if (*s == '-') {
+            s++;
+            if (*s < '0' || *s > '9')
+                return -1;
+            hi = strtol(s, &s, 10);
+        }
+        if (hi < lo || hi >= 64)
+            return -1;
+        for (int i = lo; i <= hi; i++)
+            *mask |= 1ul << i;
+        if (*s != ',')
+            break;
+        s++;
+    }
+    if (*s != ' ' && *s != '\t')
+        return -1;
+    *ps = s;
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     printf("\nsh start----------------\n");
     for (int i = 0; i < argc; i++) {
@@ -188,8 +221,21 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "cannot cd %s\n", buf + 3);
             continue;
         }
-        if (fork1() == 0)
-            runcmd(parsecmd(buf));
+        char *cmd = buf;
+        unsigned long mask;
+        if (parsepin(&cmd, &mask) < 0) {
+            fprintf(stderr, "usage: @<cpu>[-<cpu>][,...] command\n");
+            continue;
+        }
+        if (fork1() == 0) {
+            // 亲和性随 fork/exec 继承，命令及其子进程都只在这些 CPU 上运行
+            // 掩码里没有一个存在的 CPU 时内核拒绝，报错而不是让 sh 的子进程崩掉
+            if (mask && syscall(SYS_sched_setaffinity, 0, sizeof(mask), &mask) < 0) {
+                fprintf(stderr, "sh: no such cpu in %s", buf);
+                exit(1);
+            }
+            runcmd(parsecmd(cmd));
+        }
         wait(NULL);
     }
     printf("sh end---------------\n\n");